@@ -0,0 +1,231 @@
+#include "mqtt_lite.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <chrono>
+
+static const uint8_t MQTT_CONNECT     = 0x10;
+static const uint8_t MQTT_CONNACK     = 0x20;
+static const uint8_t MQTT_PUBLISH     = 0x30;
+static const uint8_t MQTT_SUBSCRIBE   = 0x82; //con i bit riservati a 0010
+static const uint8_t MQTT_SUBACK      = 0x90;
+static const uint8_t MQTT_PINGREQ     = 0xC0;
+static const uint8_t MQTT_PINGRESP    = 0xD0;
+static const uint8_t MQTT_DISCONNECT  = 0xE0;
+
+static uint64_t monoMs() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void putStr(std::vector<uint8_t>& b, const char* s, size_t n) {
+  b.push_back((uint8_t)(n >> 8));
+  b.push_back((uint8_t)n);
+  b.insert(b.end(), (const uint8_t*)s, (const uint8_t*)s + n);
+}
+static void putStr(std::vector<uint8_t>& b, const char* s) { putStr(b, s, strlen(s)); }
+
+MqttLite::MqttLite()
+  : fd_(-1), nextId_(1), keepAliveS_(30), lastTxMs_(0), fn_(nullptr), ctx_(nullptr) {}
+
+MqttLite::~MqttLite() { disconnect(); }
+
+void MqttLite::fail() {
+  if (fd_ >= 0) close(fd_);
+  fd_ = -1;
+  rx_.clear();
+}
+
+bool MqttLite::writeAll(const uint8_t* p, size_t n) {
+  while (n > 0) {
+    ssize_t w = ::send(fd_, p, n, MSG_NOSIGNAL);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        struct pollfd pf = { fd_, POLLOUT, 0 };
+        if (::poll(&pf, 1, 1000) <= 0) { fail(); return false; }
+        continue;
+      }
+      fail();
+      return false;
+    }
+    p += w;
+    n -= (size_t)w;
+  }
+  return true;
+}
+
+bool MqttLite::sendPacket(uint8_t header, const std::vector<uint8_t>& body) {
+  if (fd_ < 0) return false;
+  std::vector<uint8_t> pkt;
+  pkt.reserve(body.size() + 5);
+  pkt.push_back(header);
+  //remaining length a 7 bit per byte
+  size_t n = body.size();
+  do {
+    uint8_t d = n % 128;
+    n /= 128;
+    if (n) d |= 0x80;
+    pkt.push_back(d);
+  } while (n);
+  pkt.insert(pkt.end(), body.begin(), body.end());
+  lastTxMs_ = monoMs();
+  return writeAll(pkt.data(), pkt.size());
+}
+
+bool MqttLite::connect(const char* host, uint16_t port, const char* clientId,
+                       const char* user, const char* pass, uint16_t keepAliveS, uint32_t timeoutMs) {
+  disconnect();
+
+  char portStr[8];
+  snprintf(portStr, sizeof(portStr), "%u", (unsigned)port);
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* res = nullptr;
+  if (getaddrinfo(host, portStr, &hints, &res) != 0) return false;
+
+  for (struct addrinfo* ai = res; ai && fd_ < 0; ai = ai->ai_next) {
+    int s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (s < 0) continue;
+    if (::connect(s, ai->ai_addr, ai->ai_addrlen) == 0) fd_ = s;
+    else close(s);
+  }
+  freeaddrinfo(res);
+  if (fd_ < 0) return false;
+
+  int one = 1;
+  setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); //i PUBLISH sono piccoli: niente Nagle
+
+  keepAliveS_ = keepAliveS;
+  std::vector<uint8_t> b;
+  putStr(b, "MQTT");
+  b.push_back(4); //3.1.1
+  uint8_t flags = 0x02; //clean session
+  if (user) flags |= 0x80;
+  if (user && pass) flags |= 0x40;
+  b.push_back(flags);
+  b.push_back((uint8_t)(keepAliveS >> 8));
+  b.push_back((uint8_t)keepAliveS);
+  putStr(b, clientId);
+  if (user) putStr(b, user);
+  if (user && pass) putStr(b, pass);
+  if (!sendPacket(MQTT_CONNECT, b)) return false;
+
+  //CONNACK: 20 02 <flags> <rc>
+  uint8_t ack[4];
+  size_t got = 0;
+  uint64_t deadline = monoMs() + timeoutMs;
+  while (got < sizeof(ack)) {
+    uint64_t now = monoMs();
+    if (now >= deadline) { fail(); return false; }
+    struct pollfd pf = { fd_, POLLIN, 0 };
+    if (::poll(&pf, 1, (int)(deadline - now)) <= 0) continue;
+    ssize_t r = ::recv(fd_, ack + got, sizeof(ack) - got, 0);
+    if (r <= 0) { fail(); return false; }
+    got += (size_t)r;
+  }
+  if (ack[0] != MQTT_CONNACK || ack[1] != 2 || ack[3] != 0) { fail(); return false; }
+
+  fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL, 0) | O_NONBLOCK);
+  return true;
+}
+
+void MqttLite::disconnect() {
+  if (fd_ < 0) return;
+  std::vector<uint8_t> none;
+  sendPacket(MQTT_DISCONNECT, none);
+  fail();
+}
+
+bool MqttLite::subscribe(const char* filter) {
+  std::vector<uint8_t> b;
+  uint16_t id = nextId_++;
+  if (!nextId_) nextId_ = 1;
+  b.push_back((uint8_t)(id >> 8));
+  b.push_back((uint8_t)id);
+  putStr(b, filter);
+  b.push_back(0); //QoS 0
+  return sendPacket(MQTT_SUBSCRIBE, b);
+}
+
+bool MqttLite::publish(const std::string& topic, const void* payload, size_t len, bool retain) {
+  std::vector<uint8_t> b;
+  b.reserve(topic.size() + len + 2);
+  putStr(b, topic.c_str(), topic.size());
+  b.insert(b.end(), (const uint8_t*)payload, (const uint8_t*)payload + len);
+  return sendPacket(MQTT_PUBLISH | (retain ? 0x01 : 0x00), b);
+}
+
+bool MqttLite::publish(const std::string& topic, const char* payload, bool retain) {
+  return publish(topic, payload, strlen(payload), retain);
+}
+
+bool MqttLite::service(uint64_t nowMs) {
+  if (fd_ < 0) return false;
+
+  uint8_t buf[4096];
+  for (;;) {
+    ssize_t r = ::recv(fd_, buf, sizeof(buf), 0);
+    if (r > 0) { rx_.insert(rx_.end(), buf, buf + r); continue; }
+    if (r == 0) { fail(); return false; }
+    if (errno == EINTR) continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+    fail();
+    return false;
+  }
+  if (!parse()) { fail(); return false; }
+
+  if (keepAliveS_ && nowMs - lastTxMs_ >= (uint64_t)keepAliveS_ * 500ULL) {
+    std::vector<uint8_t> none;
+    if (!sendPacket(MQTT_PINGREQ, none)) return false;
+  }
+  return fd_ >= 0;
+}
+
+//consuma dal buffer tutti i pacchetti completi. Ogni PUBLISH esce da rx_ prima della callback:
+//se la callback pubblica e la scrittura fallisce, fail() chiude il socket e svuota rx_
+bool MqttLite::parse() {
+  while (fd_ >= 0 && rx_.size() >= 2) {
+    uint8_t hdr = rx_[0];
+    size_t len = 0, mult = 1, i = 1;
+    bool complete = false;
+    for (int k = 0; k < 4 && i < rx_.size(); k++, i++) {
+      len += (rx_[i] & 0x7F) * mult;
+      mult *= 128;
+      if (!(rx_[i] & 0x80)) { complete = true; i++; break; }
+    }
+    if (!complete) {
+      if (i > 4) return false; //remaining length non valida
+      break;
+    }
+    if (rx_.size() - i < len) break;
+
+    const uint8_t* p = rx_.data() + i;
+    bool publish = (hdr & 0xF0) == MQTT_PUBLISH;
+    std::string topic;
+    std::vector<uint8_t> payload;
+    if (publish) {
+      if (len < 2) return false;
+      size_t tl = ((size_t)p[0] << 8) | p[1];
+      size_t qos = (hdr >> 1) & 0x03;
+      size_t head = 2 + tl + (qos ? 2 : 0);
+      if (head > len) return false;
+      topic.assign((const char*)p + 2, tl);
+      payload.assign(p + head, p + len);
+    }
+    //SUBACK, PINGRESP e il resto: solo consumati
+    rx_.erase(rx_.begin(), rx_.begin() + i + len);
+    if (publish && fn_) fn_(ctx_, topic, payload.data(), payload.size());
+  }
+  return true;
+}
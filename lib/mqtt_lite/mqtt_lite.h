@@ -0,0 +1,52 @@
+#pragma once
+/*
+  MQTT 3.1.1 minimo per i tool Linux (bridge, load generator)
+  Solo quello che serve: CONNECT (user/pass opzionali), SUBSCRIBE e PUBLISH QoS 0
+  (anche retained), PINGREQ per il keepalive. Socket TCP in chiaro verso un broker locale.
+  Non bloccante dopo il connect: il chiamante mette fd() nel suo poll() e chiama service().
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class MqttLite {
+public:
+  typedef void (*MessageFn)(void* ctx, const std::string& topic, const uint8_t* payload, size_t len);
+
+  MqttLite();
+  ~MqttLite();
+
+  //connessione bloccante (timeout in ms) fino al CONNACK
+  bool connect(const char* host, uint16_t port, const char* clientId,
+               const char* user = nullptr, const char* pass = nullptr,
+               uint16_t keepAliveS = 30, uint32_t timeoutMs = 3000);
+  void disconnect();
+  bool connected() const { return fd_ >= 0; }
+  int fd() const { return fd_; }
+
+  void onMessage(MessageFn fn, void* ctx) { fn_ = fn; ctx_ = ctx; }
+
+  bool subscribe(const char* filter);
+  bool publish(const std::string& topic, const void* payload, size_t len, bool retain = false);
+  bool publish(const std::string& topic, const char* payload, bool retain = false);
+
+  //legge quello che c'è sul socket, consegna i PUBLISH, manda PINGREQ se serve.
+  //false se la connessione è caduta.
+  bool service(uint64_t nowMs);
+
+private:
+  bool writeAll(const uint8_t* p, size_t n);
+  bool sendPacket(uint8_t header, const std::vector<uint8_t>& body);
+  bool parse();
+  void fail();
+
+  int fd_;
+  uint16_t nextId_;
+  uint16_t keepAliveS_;
+  uint64_t lastTxMs_;
+  std::vector<uint8_t> rx_;
+  MessageFn fn_;
+  void* ctx_;
+};
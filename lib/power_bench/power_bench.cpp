@@ -0,0 +1,195 @@
+#include "power_bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+static const char* BENCH_NS = "evebench";
+//regole fuori dall'ora del benchmark (minuto 0): il motore le scorre tutte senza eseguirne nessuna
+static const uint16_t BENCH_RULE_MIN = 600;
+
+PowerBench::PowerBench(PowerHal& hal, PowerNode& node, const PowerBenchConfig& cfg, BenchLineFn out, void* ctx)
+  : hal_(hal), node_(node), cfg_(cfg), out_(out), ctx_(ctx), cases_(0), count_(0) {
+  if (cfg_.batch == 0) cfg_.batch = 1;
+}
+
+// ===================== MISURA =====================
+template <typename Op>
+void PowerBench::sample(uint16_t samples, Op op) {
+  if (samples == 0) samples = 1;
+  if (samples > BENCH_MAX_SAMPLES) samples = BENCH_MAX_SAMPLES;
+
+  for (uint16_t s = 0; s < samples; s++) {
+    if (cfg_.gapMs) hal_.delayMs(cfg_.gapMs);
+    uint32_t t0 = cfg_.counter();
+    for (uint32_t b = 0; b < cfg_.batch; b++) op();
+    uint32_t t1 = cfg_.counter();
+    samples_[s] = (t1 - t0) / cfg_.batch;
+  }
+  std::sort(samples_, samples_ + samples);
+  count_ = samples;
+}
+
+void PowerBench::report(const char* name, const char* extra) {
+  uint32_t p50 = samples_[count_ / 2];
+  char line[224];
+  snprintf(line, sizeof(line),
+           "{\"bench\":\"%s\",\"samples\":%u,\"batch\":%lu,\"unit\":\"%s\",\"min\":%lu,\"p50\":%lu,\"max\":%lu,\"us\":%.3f%s%s}",
+           name, (unsigned)count_, (unsigned long)cfg_.batch, cfg_.unit,
+           (unsigned long)samples_[0], (unsigned long)p50, (unsigned long)samples_[count_ - 1],
+           (double)p50 / (double)cfg_.unitsPerUs, extra ? "," : "", extra ? extra : "");
+  out_(ctx_, line);
+  cases_++;
+}
+
+template <typename Op>
+void PowerBench::measure(const char* name, uint16_t samples, Op op, const char* extra) {
+  sample(samples, op);
+  report(name, extra);
+}
+
+void PowerBench::deliver(const void* pkt, size_t len) {
+  node_.onEspNowRecv(node_.masterMac(), (const uint8_t*)pkt, (int)len);
+}
+
+void PowerBench::setRules(uint8_t ch, uint8_t count) {
+  PowerRelayRulesPacket rp;
+  memset(&rp, 0, sizeof(rp));
+  rp.type = PWR_RELAYRULE_TYPE;
+  rp.ch = ch;
+  rp.count = count;
+  for (uint8_t k = 0; k < MAX_RULES; k++) {
+    rp.rules[k].minuteOfDay = BENCH_RULE_MIN + k;
+    rp.rules[k].on = k & 1;
+    rp.rules[k].daysMask = 0x7F;
+  }
+  deliver(&rp, sizeof(rp));
+}
+
+// ===================== CASI =====================
+void PowerBench::prepare() {
+  node_.begin();
+  node_.initEspNowOnChannel(1);
+
+  HelloPacket h = { HELLO_TYPE, 1, 0 };
+  deliver(&h, sizeof(h));
+  PowerTimePacket t = { PWR_TIME_TYPE, 0, 0, 1, 0 };
+  deliver(&t, sizeof(t));
+}
+
+void PowerBench::runHandlers() {
+  //HELLO ripetuto sul canale agganciato: peer + HELLO_ACK + STATE
+  HelloPacket h = { HELLO_TYPE, node_.channel(), 0 };
+  measure("rx_hello", cfg_.samples, [&] { deliver(&h, sizeof(h)); });
+
+  //relè 1 cambia ogni volta: GPIO + saveRelayMask + STATE
+  PowerCmdPacket toggle = { PWR_CMD_TYPE, 0x01, node_.relayMaskGet(1) ? (uint8_t)0x00 : (uint8_t)0x01, 1, 0 };
+  measure("rx_cmd_toggle", cfg_.nvsSamples, [&] {
+    deliver(&toggle, sizeof(toggle));
+    toggle.maskVal ^= 0x01;
+  });
+
+  //relè 2 già nello stato chiesto: solo STATE
+  PowerCmdPacket same = { PWR_CMD_TYPE, 0x02, (uint8_t)(node_.relayMask() & 0x02), 1, 0 };
+  measure("rx_cmd_nochange", cfg_.samples, [&] { deliver(&same, sizeof(same)); });
+
+  //10 regole sul relè 1, sempre diverse dalle precedenti (la NVS non riscrive dati uguali)
+  PowerRelayRulesPacket rp;
+  memset(&rp, 0, sizeof(rp));
+  rp.type = PWR_RELAYRULE_TYPE;
+  rp.ch = 1;
+  rp.count = MAX_RULES;
+  for (uint8_t k = 0; k < MAX_RULES; k++) {
+    rp.rules[k].minuteOfDay = BENCH_RULE_MIN + k;
+    rp.rules[k].daysMask = 0x7F;
+  }
+  measure("rx_rules", cfg_.nvsSamples, [&] {
+    deliver(&rp, sizeof(rp));
+    rp.rules[0].on ^= 1;
+  });
+
+  //TIME valido: motore regole + STATE
+  PowerTimePacket t = { PWR_TIME_TYPE, 0, 0, 1, 0 };
+  measure("rx_time", cfg_.samples, [&] { deliver(&t, sizeof(t)); });
+
+  //lunghezza sconosciuta: solo smistamento
+  uint8_t junk[3] = { 0x63, 0, 0 };
+  measure("rx_unknown", cfg_.samples, [&] { deliver(junk, sizeof(junk)); });
+
+  measure("loop_idle", cfg_.samples, [&] { node_.loopOnce(); });
+}
+
+void PowerBench::runRulesScaling() {
+  static const uint8_t COUNTS[] = { 0, 1, 2, 5, MAX_RULES };
+  for (uint8_t n : COUNTS) {
+    for (uint8_t ch = 1; ch <= RELAY_COUNT; ch++) setRules(ch, n);
+
+    char name[24], extra[16];
+    unsigned total = (unsigned)n * RELAY_COUNT;
+    snprintf(name, sizeof(name), "apply_rules_%u", total);
+    snprintf(extra, sizeof(extra), "\"rules\":%u", total);
+    measure(name, cfg_.samples, [&] { node_.applyRulesExactNow(false); }, extra);
+  }
+}
+
+void PowerBench::runHal() {
+  //stesse scritture di saveRelayMask / saveRules, valori alternati per forzare la scrittura vera
+  hal_.nvsBegin(BENCH_NS);
+  uint8_t mask = 0;
+  measure("nvs_save_relay_mask", cfg_.nvsSamples, [&] { hal_.nvsPutUChar("relayMask", mask ^= 0x01); });
+
+  RelayRuleBin rules[MAX_RULES];
+  memset(rules, 0, sizeof(rules));
+  uint8_t count = 0;
+  measure("nvs_save_rules", cfg_.nvsSamples, [&] {
+    count = (uint8_t)((count + 1) % (MAX_RULES + 1));
+    rules[0].minuteOfDay = count;
+    hal_.nvsPutUChar("rc1", count);
+    hal_.nvsPutBytes("rb1", rules, sizeof(rules));
+  });
+
+  PowerStatePacket st = { PWR_STATE_TYPE, 0, 1, 1, 0 };
+  uint32_t errors = 0;
+  sample(cfg_.samples, [&] {
+    if (hal_.radioSend(node_.masterMac(), (const uint8_t*)&st, sizeof(st)) != 0) errors++;
+  });
+  char extra[24];
+  snprintf(extra, sizeof(extra), "\"errors\":%lu", (unsigned long)errors); //es. coda TX piena
+  report("radio_send", extra);
+
+  hal_.pinOutput(cfg_.gpioPin);
+  bool level = false;
+  measure("gpio_write", cfg_.samples, [&] { hal_.pinWrite(cfg_.gpioPin, level = !level); });
+}
+
+void PowerBench::runAll() {
+  prepare();
+  runHandlers();
+  runRulesScaling();
+  runHal();
+}
+
+// ===================== CONFRONTO =====================
+static bool jsonString(const char* line, const char* key, char* out, size_t n) {
+  const char* p = strstr(line, key);
+  if (!p || n == 0) return false;
+  p += strlen(key);
+  size_t i = 0;
+  while (*p && *p != '"' && i + 1 < n) out[i++] = *p++;
+  out[i] = 0;
+  return *p == '"';
+}
+
+bool parseBenchLine(const char* line, const char* field, char* name, size_t nameLen, char* unit, size_t unitLen, double& value) {
+  if (!jsonString(line, "{\"bench\":\"", name, nameLen)) return false;
+  if (!jsonString(line, "\"unit\":\"", unit, unitLen)) return false;
+  char key[24];
+  snprintf(key, sizeof(key), "\"%s\":", field);
+  const char* p = strstr(line, key);
+  if (!p) return false;
+  p += strlen(key);
+  char* end = nullptr;
+  value = strtod(p, &end);
+  return end != p;
+}
@@ -0,0 +1,73 @@
+#pragma once
+/*
+  EVE-POWER - benchmark dei percorsi caldi del nodo
+  Gli stessi casi girano sull'host (tools/bench, contatore in ns) e sull'ESP32
+  (tools/bench_target, contatore cicli CPU). Ogni caso stampa una riga JSON:
+    {"bench":"rx_cmd_toggle","samples":20,"batch":1,"unit":"cycles","min":..,"p50":..,"max":..,"us":..}
+  min/p50/max sono per singola chiamata, us = p50 in microsecondi.
+  Casi:
+  - rx_*          : onEspNowRecv per tipo di pacchetto (parsing + logica + NVS + risposte)
+  - loop_idle     : loopOnce() senza cambio minuto
+  - apply_rules_N : applyRulesExactNow con N regole in totale, nessuna all'ora corrente (caso peggiore)
+  - nvs_*         : le stesse scritture di saveRelayMask / saveRules, nel namespace "evebench"
+  - radio_send    : esp_now_send di uno STATE verso il master
+  - gpio_write    : un digitalWrite
+  ATTENZIONE: rx_cmd_toggle e rx_rules scrivono davvero relayMask e regole del relè 1 nella NVS del nodo.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include "power_hal.h"
+#include "power_node.h"
+
+static const uint16_t BENCH_MAX_SAMPLES = 256;
+
+//contatore monotono: cicli CPU sull'ESP32, ns sull'host (basta che non giri durante un campione)
+typedef uint32_t (*BenchCounterFn)();
+typedef void (*BenchLineFn)(void* ctx, const char* line);
+
+struct PowerBenchConfig {
+  BenchCounterFn counter = nullptr;
+  const char* unit = "cycles";
+  float unitsPerUs = 160.0f;   //MHz della CPU, 1000 per i ns
+  uint16_t samples = 50;       //campioni per caso
+  uint16_t nvsSamples = 20;    //casi che scrivono in flash: meno campioni (usura)
+  uint32_t batch = 1;          //chiamate per campione: sull'host tante, per stare sopra la risoluzione
+  uint32_t gapMs = 0;          //pausa non misurata tra due campioni (coda TX di ESP-NOW)
+  uint8_t gpioPin = 0;         //pin libero per gpio_write, non un relè
+};
+
+class PowerBench {
+public:
+  PowerBench(PowerHal& hal, PowerNode& node, const PowerBenchConfig& cfg, BenchLineFn out, void* ctx);
+
+  //nodo pronto come in campo: NVS, relè, ESP-NOW sul canale 1, HELLO e TIME ricevuti
+  void prepare();
+  void runHandlers();
+  void runRulesScaling();
+  //per ultimo: lascia la NVS aperta sul namespace "evebench"
+  void runHal();
+  void runAll();
+
+  uint32_t cases() const { return cases_; }
+
+private:
+  template <typename Op> void sample(uint16_t samples, Op op);
+  void report(const char* name, const char* extra = nullptr);
+  template <typename Op> void measure(const char* name, uint16_t samples, Op op, const char* extra = nullptr);
+  void deliver(const void* pkt, size_t len);
+  void setRules(uint8_t ch, uint8_t count);
+
+  PowerHal& hal_;
+  PowerNode& node_;
+  PowerBenchConfig cfg_;
+  BenchLineFn out_;
+  void* ctx_;
+  uint32_t cases_;
+  uint16_t count_;
+  uint32_t samples_[BENCH_MAX_SAMPLES];
+};
+
+//riga JSON di un caso -> nome, unità e valore di field ("p50", "min"...). false per le altre righe.
+//Per confrontare due build.
+bool parseBenchLine(const char* line, const char* field, char* name, size_t nameLen, char* unit, size_t unitLen, double& value);
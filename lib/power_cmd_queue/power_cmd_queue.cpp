@@ -0,0 +1,156 @@
+#include "power_cmd_queue.h"
+
+#include <string.h>
+
+PowerCmdQueue::PowerCmdQueue()
+  : send_(nullptr), sendCtx_(nullptr), linked_(false), relayMask_(0),
+    pendSet_(0), pendVal_(0), pendSinceMs_(0),
+    inflight_(false), inSet_(0), inVal_(0), inSentMs_(0), inRetries_(0) {
+  memset(rules_, 0, sizeof(rules_));
+  memset(rulesDirty_, 0, sizeof(rulesDirty_));
+  memset(rulesInflight_, 0, sizeof(rulesInflight_));
+  memset(rulesSentMs_, 0, sizeof(rulesSentMs_));
+  memset(rulesRetries_, 0, sizeof(rulesRetries_));
+}
+
+void PowerCmdQueue::begin(const PowerCmdQueueConfig& cfg, SendFn fn, void* ctx) {
+  cfg_ = cfg;
+  send_ = fn;
+  sendCtx_ = ctx;
+}
+
+void PowerCmdQueue::linkUp(uint64_t now) {
+  if (linked_) { //HELLO_ACK di keepalive: niente da rimandare
+    flushCmd(now);
+    return;
+  }
+  linked_ = true;
+  //riaggancio (reboot del nodo): quello in volo è probabilmente perso, riparte con i retry pieni
+  for (int i = 0; i < 4; i++) if (rulesDirty_[i] || rulesInflight_[i]) sendRules(i, now);
+  if (inflight_) {
+    inRetries_ = 0;
+    resendCmd(now);
+  }
+  flushCmd(now);
+}
+
+// ===================== CMD =====================
+void PowerCmdQueue::set(uint8_t ch1to4, PowerSetOp op, uint64_t now) {
+  if (ch1to4 < 1 || ch1to4 > 4) return;
+  uint8_t bit = (uint8_t)(1u << (ch1to4 - 1));
+  bool on = op == POWER_SET_ON;
+  if (op == POWER_SET_TOGGLE) {
+    //valore "attuale" = quello che il nodo avrà dopo i comandi già accodati
+    bool cur = (pendSet_ & bit) ? (pendVal_ & bit) : (inflight_ && (inSet_ & bit)) ? (inVal_ & bit) : (relayMask_ & bit);
+    on = !cur;
+  }
+  if (!pendSet_) pendSinceMs_ = now;
+  pendSet_ |= bit;
+  pendVal_ = on ? (uint8_t)(pendVal_ | bit) : (uint8_t)(pendVal_ & ~bit);
+  if (cfg_.batchMs == 0) flushCmd(now);
+}
+
+void PowerCmdQueue::onState(uint8_t mask, uint64_t now) {
+  relayMask_ = mask;
+  //STATE che conferma il CMD in volo -> sblocca il prossimo batch
+  if (inflight_ && (mask & inSet_) == inVal_) {
+    inflight_ = false;
+    pendSinceMs_ = 0; //il batch accumulato durante il volo parte subito
+    flushCmd(now);
+  }
+}
+
+void PowerCmdQueue::flushCmd(uint64_t now) {
+  if (inflight_ || !pendSet_ || !linked_) return; //non agganciato: i comandi restano accorpati
+  if (now - pendSinceMs_ < cfg_.batchMs) return;
+
+  inflight_ = true;
+  inSet_ = pendSet_;
+  inVal_ = pendVal_ & pendSet_;
+  inRetries_ = 0;
+  pendSet_ = pendVal_ = 0;
+  sendCmd(now);
+  stats_.cmdFrames++;
+}
+
+void PowerCmdQueue::resendCmd(uint64_t now) {
+  //nel retry entrano anche i set arrivati nel frattempo
+  inVal_ = (uint8_t)((inVal_ & ~pendSet_) | (pendVal_ & pendSet_));
+  inSet_ |= pendSet_;
+  pendSet_ = pendVal_ = 0;
+  sendCmd(now);
+  stats_.cmdRetries++;
+}
+
+void PowerCmdQueue::sendCmd(uint64_t now) {
+  inSentMs_ = now;
+  PowerCmdPacket p;
+  p.type = PWR_CMD_TYPE;
+  p.maskSet = inSet_;
+  p.maskVal = inVal_;
+  p.applyNow = 1;
+  p.ms = (uint32_t)now;
+  if (send_) send_(sendCtx_, &p, sizeof(p));
+}
+
+// ===================== RULES =====================
+void PowerCmdQueue::setRules(const PowerRelayRulesPacket& r, uint64_t now) {
+  if (r.ch < 1 || r.ch > 4) return;
+  int idx = r.ch - 1;
+  rules_[idx] = r;
+  //l'ultima vince: se una RULES è in volo questa parte al suo ACK
+  if (rulesInflight_[idx] || !linked_) rulesDirty_[idx] = true;
+  else sendRules(idx, now);
+}
+
+void PowerCmdQueue::onRulesAck(uint8_t ch1to4, uint64_t now) {
+  if (ch1to4 < 1 || ch1to4 > 4) return;
+  int idx = ch1to4 - 1;
+  rulesInflight_[idx] = false;
+  if (rulesDirty_[idx]) sendRules(idx, now);
+}
+
+void PowerCmdQueue::rulesFailed(uint8_t ch1to4) {
+  if (ch1to4 >= 1 && ch1to4 <= 4) rulesInflight_[ch1to4 - 1] = false;
+}
+
+void PowerCmdQueue::sendRules(int idx, uint64_t now, bool retry) {
+  if (!retry) rulesRetries_[idx] = 0;
+  rules_[idx].ms = (uint32_t)now;
+  if (send_) send_(sendCtx_, &rules_[idx], sizeof(rules_[idx]));
+  rulesInflight_[idx] = true;
+  rulesDirty_[idx] = false;
+  rulesSentMs_[idx] = now;
+  stats_.rulesFrames++;
+}
+
+// ===================== TIMER =====================
+uint8_t PowerCmdQueue::service(uint64_t now) {
+  //nodo non agganciato: i retry aspettano il linkUp invece di consumarsi a vuoto
+  if (!linked_) return 0;
+
+  if (inflight_ && now - inSentMs_ >= cfg_.retryMs) {
+    if (inRetries_ >= cfg_.maxRetries) {
+      stats_.cmdDropped++;
+      inflight_ = false;
+    } else {
+      inRetries_++;
+      resendCmd(now);
+    }
+  }
+  flushCmd(now);
+
+  uint8_t gaveUp = 0;
+  for (int i = 0; i < 4; i++) {
+    if (!rulesInflight_[i] || now - rulesSentMs_[i] < cfg_.rulesRetryMs) continue;
+    if (rulesRetries_[i] >= cfg_.maxRetries) {
+      rulesInflight_[i] = false;
+      rulesRetries_[i] = 0;
+      gaveUp |= (uint8_t)(1u << i);
+    } else {
+      rulesRetries_[i]++;
+      sendRules(i, now, true);
+    }
+  }
+  return gaveUp;
+}
@@ -0,0 +1,102 @@
+#pragma once
+/*
+  EVE-POWER - coda dei comandi verso un nodo (lato master), senza socket e senza orologio
+  Il bridge Linux (tools/bridge) ne tiene una per nodo; il tempo arriva da fuori (now in ms),
+  i pacchetti escono dalla SendFn. Così la logica si prova nei test senza rete.
+  - CMD: al massimo uno in volo. I set che arrivano nella finestra batchMs o mentre il CMD
+    aspetta il suo STATE si fondono in un solo pacchetto (maskSet/maskVal, l'ultimo valore per
+    relè vince). TOGGLE parte dal valore che il nodo avrà dopo i comandi già accodati.
+    Senza STATE entro retryMs il CMD si ripete, con dentro i set arrivati nel frattempo.
+  - RULES per relè: una in volo, l'ultima schedulazione vince (parte all'ACK di quella prima).
+  - finché il nodo non è agganciato (linkUp) non parte niente: CMD e RULES restano in coda e
+    i retry sono fermi.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include "power_protocol.h"
+
+struct PowerCmdQueueConfig {
+  uint32_t batchMs = 2;
+  uint32_t retryMs = 150;
+  uint32_t rulesRetryMs = 1000; //RULES = scrittura NVS sul nodo, più lenta di un CMD
+  uint8_t maxRetries = 3;
+};
+
+struct PowerCmdQueueStats {
+  uint64_t cmdFrames = 0;     //CMD inviati (retry esclusi)
+  uint64_t cmdRetries = 0;
+  uint64_t cmdDropped = 0;    //CMD abbandonati dopo maxRetries
+  uint64_t rulesFrames = 0;
+};
+
+enum PowerSetOp : uint8_t { POWER_SET_OFF = 0, POWER_SET_ON = 1, POWER_SET_TOGGLE = 2 };
+
+class PowerCmdQueue {
+public:
+  typedef void (*SendFn)(void* ctx, const void* pkt, size_t len);
+
+  PowerCmdQueue();
+  void begin(const PowerCmdQueueConfig& cfg, SendFn fn, void* ctx);
+
+  // ===================== AGGANCIO =====================
+  //HELLO_ACK dal nodo: parte quello che era rimasto in coda. Dopo un linkDown il CMD e le
+  //RULES in volo si rimandano con i retry azzerati.
+  void linkUp(uint64_t now);
+  //nodo in scansione (reboot): si torna ad accodare, i retry si fermano
+  void linkDown() { linked_ = false; }
+  bool linked() const { return linked_; }
+
+  // ===================== CMD =====================
+  void set(uint8_t ch1to4, PowerSetOp op, uint64_t now);
+  //STATE (o EXECUTED) dal nodo: se conferma il CMD in volo parte il batch accumulato
+  void onState(uint8_t mask, uint64_t now);
+
+  // ===================== RULES =====================
+  //r.ch = relè 1..4
+  void setRules(const PowerRelayRulesPacket& r, uint64_t now);
+  //SCHED_ACK (ok o ko): libera il relè, parte la schedulazione arrivata nel frattempo
+  void onRulesAck(uint8_t ch1to4, uint64_t now);
+  //ERROR dal nodo (ch non valido o salvataggio NVS): la RULES in volo è persa
+  void rulesFailed(uint8_t ch1to4);
+  //c'è una schedulazione più nuova di quella in volo / confermata
+  bool rulesDirty(uint8_t ch1to4) const { return rulesDirty_[ch1to4 - 1]; }
+  bool rulesInflight(uint8_t ch1to4) const { return rulesInflight_[ch1to4 - 1]; }
+
+  //retry e batch scaduti. Ritorna i relè (bit 0..3) le cui RULES sono state abbandonate.
+  uint8_t service(uint64_t now);
+
+  // ===================== STATO =====================
+  uint8_t relayMask() const { return relayMask_; }
+  bool cmdInflight() const { return inflight_; }
+  uint8_t pendingSet() const { return pendSet_; }
+  uint8_t pendingVal() const { return pendVal_ & pendSet_; }
+  const PowerCmdQueueStats& stats() const { return stats_; }
+
+private:
+  void flushCmd(uint64_t now);
+  void sendCmd(uint64_t now);
+  void resendCmd(uint64_t now);
+  void sendRules(int idx, uint64_t now, bool retry = false);
+
+  PowerCmdQueueConfig cfg_;
+  SendFn send_;
+  void* sendCtx_;
+  bool linked_;
+  uint8_t relayMask_;
+
+  uint8_t pendSet_, pendVal_;
+  uint64_t pendSinceMs_;
+  bool inflight_;
+  uint8_t inSet_, inVal_;
+  uint64_t inSentMs_;
+  uint8_t inRetries_;
+
+  PowerRelayRulesPacket rules_[4];
+  bool rulesDirty_[4];
+  bool rulesInflight_[4];
+  uint64_t rulesSentMs_[4];
+  uint8_t rulesRetries_[4];
+
+  PowerCmdQueueStats stats_;
+};
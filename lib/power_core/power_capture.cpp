@@ -0,0 +1,143 @@
+#include "power_capture.h"
+
+#include <string.h>
+#include <stdio.h>
+
+static const uint32_t CAP_MAGIC = 0x31504143; //"CAP1"
+
+PowerCapture::PowerCapture(void* storage, size_t bytes)
+  : hdr_((Header*)storage), ring_((uint8_t*)storage + sizeof(Header)),
+    cap_(bytes > sizeof(Header) ? bytes - sizeof(Header) : 0), enabled_(true),
+    lockFn_(nullptr), lockCtx_(nullptr) {}
+
+void PowerCapture::begin(bool keep) {
+  bool valid = keep && hdr_->magic == CAP_MAGIC && hdr_->head < cap_ && hdr_->tail < cap_ && hdr_->used <= cap_;
+  if (!valid) clear();
+}
+
+void PowerCapture::clear() {
+  memset(hdr_, 0, sizeof(Header));
+  hdr_->magic = CAP_MAGIC;
+  hdr_->sinceSnap = 0xFFFFFFFFu; //nessuno SNAP ancora
+}
+
+size_t PowerCapture::used() const { return hdr_->used; }
+uint32_t PowerCapture::records() const { return hdr_->records; }
+uint32_t PowerCapture::dropped() const { return hdr_->dropped; }
+uint32_t PowerCapture::folded() const { return hdr_->folded; }
+
+void PowerCapture::countFolded() {
+  if (enabled_) hdr_->folded++;
+}
+
+bool PowerCapture::snapshotDue() const { return hdr_->sinceSnap > cap_ / 2; }
+
+void PowerCapture::put(const void* src, size_t n) {
+  const uint8_t* p = (const uint8_t*)src;
+  while (n) {
+    size_t chunk = cap_ - hdr_->head;
+    if (chunk > n) chunk = n;
+    memcpy(ring_ + hdr_->head, p, chunk);
+    hdr_->head = (uint32_t)((hdr_->head + chunk) % cap_);
+    p += chunk;
+    n -= chunk;
+  }
+}
+
+void PowerCapture::get(uint32_t at, void* dst, size_t n) const {
+  uint8_t* p = (uint8_t*)dst;
+  while (n) {
+    size_t chunk = cap_ - at;
+    if (chunk > n) chunk = n;
+    memcpy(p, ring_ + at, chunk);
+    at = (uint32_t)((at + chunk) % cap_);
+    p += chunk;
+    n -= chunk;
+  }
+}
+
+void PowerCapture::dropOldest() {
+  uint8_t h[2];
+  get(hdr_->tail, h, 2);
+  size_t sz = CAP_REC_HDR + h[1];
+  hdr_->tail = (uint32_t)((hdr_->tail + sz) % cap_);
+  hdr_->used -= (uint32_t)sz;
+  hdr_->records--;
+  hdr_->dropped++;
+}
+
+void PowerCapture::record(uint8_t kind, uint32_t ms, const void* a, size_t alen, const void* b, size_t blen) {
+  if (!enabled_ || cap_ == 0) return;
+  size_t len = alen + blen;
+  if (len > 255 || CAP_REC_HDR + len > cap_) return;
+
+  size_t sz = CAP_REC_HDR + len;
+  if (lockFn_) lockFn_(lockCtx_, true);
+  //ricontrollo sotto lock: "cap dump" spegne la cattura e poi legge il ring senza lock
+  if (!enabled_) {
+    if (lockFn_) lockFn_(lockCtx_, false);
+    return;
+  }
+  while (hdr_->used + sz > cap_) dropOldest();
+
+  uint8_t h[CAP_REC_HDR];
+  h[0] = kind;
+  h[1] = (uint8_t)len;
+  h[2] = (uint8_t)ms; h[3] = (uint8_t)(ms >> 8); h[4] = (uint8_t)(ms >> 16); h[5] = (uint8_t)(ms >> 24);
+  put(h, sizeof(h));
+  if (alen) put(a, alen);
+  if (blen) put(b, blen);
+
+  hdr_->used += (uint32_t)sz;
+  hdr_->records++;
+  if (kind == CAP_SNAP) hdr_->sinceSnap = 0;
+  else if (hdr_->sinceSnap != 0xFFFFFFFFu) hdr_->sinceSnap += (uint32_t)sz;
+  if (lockFn_) lockFn_(lockCtx_, false);
+}
+
+void PowerCapture::forEach(RecordFn fn, void* ctx) const {
+  uint32_t at = hdr_->tail;
+  uint32_t left = hdr_->used;
+  uint8_t buf[CAP_REC_HDR + 255];
+  while (left >= CAP_REC_HDR) {
+    get(at, buf, CAP_REC_HDR);
+    size_t sz = CAP_REC_HDR + buf[1];
+    if (sz > left) break;
+    get(at, buf, sz);
+    uint32_t ms = (uint32_t)buf[2] | (uint32_t)buf[3] << 8 | (uint32_t)buf[4] << 16 | (uint32_t)buf[5] << 24;
+    fn(ctx, buf[0], ms, buf + CAP_REC_HDR, buf[1]);
+    at = (uint32_t)((at + sz) % cap_);
+    left -= (uint32_t)sz;
+  }
+}
+
+namespace {
+struct DumpCtx {
+  PowerCapture::LineFn fn;
+  void* ctx;
+};
+
+void dumpRecord(void* c, uint8_t kind, uint32_t ms, const uint8_t* payload, uint8_t len) {
+  DumpCtx* d = (DumpCtx*)c;
+  char line[8 + 2 * (CAP_REC_HDR + 255)];
+  uint8_t h[CAP_REC_HDR] = { kind, len, (uint8_t)ms, (uint8_t)(ms >> 8), (uint8_t)(ms >> 16), (uint8_t)(ms >> 24) };
+  static const char HEXD[] = "0123456789ABCDEF";
+  size_t o = 4;
+  memcpy(line, "CAP ", 4);
+  for (size_t i = 0; i < CAP_REC_HDR; i++) { line[o++] = HEXD[h[i] >> 4]; line[o++] = HEXD[h[i] & 0x0F]; }
+  for (size_t i = 0; i < len; i++) { line[o++] = HEXD[payload[i] >> 4]; line[o++] = HEXD[payload[i] & 0x0F]; }
+  line[o] = 0;
+  d->fn(d->ctx, line);
+}
+}
+
+void PowerCapture::dump(LineFn fn, void* ctx) const {
+  char line[112];
+  snprintf(line, sizeof(line), "#CAP v1 records=%lu used=%lu cap=%lu dropped=%lu hello_folded=%lu",
+           (unsigned long)hdr_->records, (unsigned long)hdr_->used, (unsigned long)cap_,
+           (unsigned long)hdr_->dropped, (unsigned long)hdr_->folded);
+  fn(ctx, line);
+  DumpCtx d = { fn, ctx };
+  forEach(dumpRecord, &d);
+  fn(ctx, "#CAP END");
+}
@@ -0,0 +1,106 @@
+#pragma once
+/*
+  EVE-POWER - cattura binaria del traffico ESP-NOW del nodo
+  Ring di byte (RAM, o RTC RAM sull'ESP32 così sopravvive a un reset) con i frame
+  ricevuti/inviati e un timestamp millis(). Quando è pieno scarta i record più vecchi.
+
+  Record: [kind u8][len u8][ms u32 LE][payload len byte]
+    CAP_RX / CAP_TX : mac[6] (sorgente RX / destinatario TX) + status u8 (esito radioSend) + frame
+    CAP_SNAP        : PowerCaptureSnap, stato completo del nodo in quell'istante
+    CAP_BOOT        : resetReason u8 + canale RTC i8
+    CAP_TICK        : loopOnce() ha fatto avanzare il minuto (nessun payload): il replay
+                      chiama loopOnce() esattamente lì, senza indovinare la fase del loop
+  Gli HELLO ripetuti a canale già agganciato (e le loro risposte) non cambiano niente nel
+  nodo: vengono solo contati, altrimenti con un HELLO al secondo riempiono il ring in un minuto.
+  Il nodo scrive uno SNAP dopo ogni BOOT e ogni volta che dall'ultimo sono passati più di
+  metà ring di byte: nel ring resta sempre uno SNAP da cui ripartire con il replay.
+
+  Dump testuale (serial-safe): una riga "CAP <hex del record>" per record, tra
+  "#CAP v1 ..." e "#CAP END". tools/replay legge direttamente un log seriale che le contiene.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include "power_protocol.h"
+
+static const uint8_t CAP_RX   = 1;
+static const uint8_t CAP_TX   = 2;
+static const uint8_t CAP_SNAP = 3;
+static const uint8_t CAP_BOOT = 4;
+static const uint8_t CAP_TICK = 5;
+
+static const size_t CAP_REC_HDR   = 6;   //kind + len + ms
+static const size_t CAP_FRAME_HDR = 7;   //mac + status
+
+#pragma pack(push, 1)
+//stato del PowerNode per ripartire da metà cattura (4 = RELAY_COUNT)
+typedef struct {
+  uint8_t relayMask;
+  uint8_t timeValid;
+  uint16_t minuteOfDay;
+  uint8_t weekdayMon0;
+  uint32_t lastTimeSyncMs;
+  uint8_t channelReady;
+  uint8_t channel;
+  uint8_t masterMac[6];
+  uint8_t ruleCount[4];
+  RelayRuleBin rules[4][MAX_RULES];
+} PowerCaptureSnap;
+#pragma pack(pop)
+
+static_assert(sizeof(PowerCaptureSnap) == 181, "PowerCaptureSnap: formato della cattura cambiato");
+
+class PowerCapture {
+public:
+  typedef void (*RecordFn)(void* ctx, uint8_t kind, uint32_t ms, const uint8_t* payload, uint8_t len);
+  typedef void (*LineFn)(void* ctx, const char* line);
+  //sull'ESP32 RX (task WiFi) e TX (loop) scrivono da task diversi
+  typedef void (*LockFn)(void* ctx, bool lock);
+
+  //storage esterno allineato a 4 (anche RTC_NOINIT): in testa l'header di controllo, il resto è il ring
+  PowerCapture(void* storage, size_t bytes);
+
+  //keep=true: se lo storage contiene già una cattura valida la tiene (reset con RTC RAM)
+  void begin(bool keep);
+  void clear();
+  void setEnabled(bool on) { enabled_ = on; }
+  bool enabled() const { return enabled_; }
+  void setLock(LockFn fn, void* ctx) { lockFn_ = fn; lockCtx_ = ctx; }
+
+  void record(uint8_t kind, uint32_t ms, const void* a, size_t alen, const void* b = nullptr, size_t blen = 0);
+  bool snapshotDue() const;
+  void countFolded();
+
+  size_t capacity() const { return cap_; }
+  size_t used() const;
+  uint32_t records() const;
+  uint32_t dropped() const;
+  uint32_t folded() const;
+
+  //dal record più vecchio al più nuovo
+  void forEach(RecordFn fn, void* ctx) const;
+  void dump(LineFn fn, void* ctx) const;
+
+private:
+  struct Header {
+    uint32_t magic;
+    uint32_t head;       //prossimo byte da scrivere
+    uint32_t tail;       //primo byte del record più vecchio
+    uint32_t used;
+    uint32_t sinceSnap;  //byte scritti dall'ultimo SNAP
+    uint32_t records;
+    uint32_t dropped;
+    uint32_t folded;     //HELLO ripetuti solo contati
+  };
+
+  void put(const void* src, size_t n);
+  void get(uint32_t at, void* dst, size_t n) const;
+  void dropOldest();
+
+  Header* hdr_;
+  uint8_t* ring_;
+  size_t cap_;
+  bool enabled_;
+  LockFn lockFn_;
+  void* lockCtx_;
+};
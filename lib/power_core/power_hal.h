@@ -0,0 +1,72 @@
+#pragma once
+/*
+  EVE-POWER - HAL (hardware abstraction layer)
+  Tutto quello che la logica POWER usa dell'hardware passa da qui:
+  tempo, GPIO relè, NVS (stessa semantica di Preferences), radio ESP-NOW/WiFi.
+
+  Implementazioni:
+  - PowerHalEsp32 (lib/power_hal_esp32): firmware vero su ESP32-C3
+  - PowerHalHost  (lib/power_hal_host) : in memoria, per build native / test / tool Linux
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+
+class PowerHal {
+public:
+  //callback di ricezione ESP-NOW: mac sorgente + bytes del pacchetto
+  typedef void (*RecvFn)(void* ctx, const uint8_t* srcMac, const uint8_t* data, int len);
+
+  virtual ~PowerHal() {}
+
+  // ===================== TEMPO =====================
+  virtual uint32_t millis() = 0;
+  virtual void delayMs(uint32_t ms) = 0;
+
+  // ===================== GPIO =====================
+  virtual void pinOutput(uint8_t pin) = 0;
+  virtual void pinWrite(uint8_t pin, bool level) = 0;
+
+  // ===================== NVS =====================
+  //stessi valori di ritorno di Preferences: put* ritorna i byte scritti (0 = errore)
+  virtual bool    nvsBegin(const char* ns) = 0;
+  virtual uint8_t nvsGetUChar(const char* key, uint8_t def) = 0;
+  virtual size_t  nvsPutUChar(const char* key, uint8_t v) = 0;
+  virtual size_t  nvsGetBytes(const char* key, void* buf, size_t len) = 0;
+  virtual size_t  nvsPutBytes(const char* key, const void* buf, size_t len) = 0;
+
+  // ===================== RADIO =====================
+  //avvia WiFi STA + ESP-NOW sul canale ch e registra la callback di ricezione
+  virtual bool radioBegin(uint8_t ch, RecvFn fn, void* ctx) = 0;
+  virtual void radioEnd() = 0;
+  virtual void radioSetChannel(uint8_t ch) = 0;
+  //(ri)registra il peer: ritorna il codice esp_err_t (0 = ok)
+  virtual int  radioAddPeer(const uint8_t* mac) = 0;
+  //toglie il peer (la tabella ESP-NOW ne tiene al massimo 20): ritorna il codice esp_err_t
+  virtual int  radioDelPeer(const uint8_t* mac) = 0;
+  //ritorna il codice esp_err_t di esp_now_send (0 = ok)
+  virtual int  radioSend(const uint8_t* mac, const uint8_t* data, size_t len) = 0;
+  //RSSI (dBm) del frame che la callback di ricezione sta consegnando
+  virtual int8_t radioRssi() = 0;
+  //MAC STA di questo nodo
+  virtual void radioMac(uint8_t mac[6]) = 0;
+
+  // ===================== SISTEMA =====================
+  virtual uint8_t resetReason() = 0;
+  //canale agganciato che sopravvive al reset (RTC_DATA_ATTR su ESP32)
+  virtual int8_t rtcLockedChannel() = 0;
+  virtual void   rtcSetLockedChannel(int8_t ch) = 0;
+  //numero casuale diverso a ogni boot (esp_random su ESP32)
+  virtual uint32_t randomU32() = 0;
+
+  // ===================== LOG =====================
+  virtual void logv(const char* fmt, va_list ap) = 0;
+
+  void logf(const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    logv(fmt, ap);
+    va_end(ap);
+  }
+};
@@ -0,0 +1,377 @@
+#include "power_mesh.h"
+
+#include <string.h>
+
+static const uint8_t BROADCAST_MAC[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+static inline bool macEq(const uint8_t* a, const uint8_t* b) { return memcmp(a, b, 6) == 0; }
+
+// ===================== ROTTE =====================
+void PowerMeshRoutes::learn(const uint8_t* node, const uint8_t* via, uint8_t hops, uint32_t now) {
+  PowerMeshRoute* r = const_cast<PowerMeshRoute*>(find(node));
+  if (!r) {
+    if (n_ < MESH_MAX_ROUTES) {
+      r = &r_[n_++];
+    } else {
+      r = &r_[0];
+      for (uint8_t i = 1; i < n_; i++) if ((int32_t)(r_[i].lastSeenMs - r->lastSeenMs) < 0) r = &r_[i];
+    }
+    memcpy(r->node, node, 6);
+  }
+  memcpy(r->via, via, 6);
+  r->hops = hops;
+  r->lastSeenMs = now;
+}
+
+const PowerMeshRoute* PowerMeshRoutes::find(const uint8_t* node) const {
+  for (uint8_t i = 0; i < n_; i++) if (macEq(r_[i].node, node)) return &r_[i];
+  return nullptr;
+}
+
+// ===================== DUPLICATI =====================
+PowerMeshDedup::PowerMeshDedup() : next_(0) { memset(k_, 0, sizeof(k_)); }
+
+bool PowerMeshDedup::seen(const uint8_t* node, uint16_t seq, uint16_t tag) {
+  for (uint8_t i = 0; i < MESH_DEDUP; i++) {
+    const Key& k = k_[i];
+    if (k.used && k.seq == seq && k.tag == tag && macEq(k.node, node)) return true;
+  }
+  Key& k = k_[next_];
+  next_ = (uint8_t)((next_ + 1) % MESH_DEDUP);
+  memcpy(k.node, node, 6);
+  k.seq = seq;
+  k.tag = tag;
+  k.used = true;
+  return false;
+}
+
+size_t meshWrap(uint8_t* out, size_t cap, const PowerMeshHeader& h, const void* payload, size_t len) {
+  if (sizeof(h) + len > cap) return 0;
+  memcpy(out, &h, sizeof(h));
+  if (len) memcpy(out + sizeof(h), payload, len);
+  return sizeof(h) + len;
+}
+
+// ===================== NODO =====================
+PowerMesh::PowerMesh(PowerHal& hal, const uint8_t* masterMac)
+  : hal_(hal), masterMac_(masterMac), enabled_(false), deliver_(nullptr), deliverCtx_(nullptr),
+    lockFn_(nullptr), lockCtx_(nullptr),
+    nNeighbors_(0), hasParent_(false), hops_(MESH_NO_ROUTE),
+    seq_(0), nextBeaconMs_(0), nPeers_(0), peerTick_(0) {
+  memset(myMac_, 0, sizeof(myMac_));
+  memset(neighbors_, 0, sizeof(neighbors_));
+  memset(parent_, 0, sizeof(parent_));
+  memset(pending_, 0, sizeof(pending_));
+}
+
+void PowerMesh::enable(const PowerMeshConfig& cfg, DeliverFn fn, void* ctx) {
+  cfg_ = cfg;
+  deliver_ = fn;
+  deliverCtx_ = ctx;
+  enabled_ = true;
+  hal_.radioMac(myMac_);
+  //seq casuale a ogni boot: chi ha visto i DATA di prima del reset (dedup del master e dei
+  //relè) non deve scartare i primi DATA nuovi come duplicati
+  seq_ = (uint16_t)hal_.randomU32();
+}
+
+void PowerMesh::radioReset() {
+  Guard g(*this);
+  nPeers_ = 0;
+  hal_.radioMac(myMac_);
+}
+
+int8_t PowerMesh::parentRssi() const {
+  for (uint8_t i = 0; i < nNeighbors_; i++) if (hasParent_ && macEq(neighbors_[i].mac, parent_)) return neighbors_[i].rssi;
+  return 0;
+}
+
+//i peer restano registrati finché la radio non riparte. I prossimi hop sono vicini e figli, di solito
+//pochi: oltre MESH_MAX_PEERS (o con la tabella ESP-NOW piena) esce quello usato meno di recente,
+//tolto anche da ESP-NOW. Il master no: serve anche a PowerNode per i pacchetti diretti.
+bool PowerMesh::ensurePeer(const uint8_t* mac) {
+  for (uint8_t i = 0; i < nPeers_; i++) {
+    if (!macEq(peers_[i].mac, mac)) continue;
+    peers_[i].lastUse = ++peerTick_;
+    return true;
+  }
+  if (nPeers_ >= MESH_MAX_PEERS && !evictPeer()) return false;
+  if (hal_.radioAddPeer(mac) != 0 && (!evictPeer() || hal_.radioAddPeer(mac) != 0)) return false;
+  memcpy(peers_[nPeers_].mac, mac, 6);
+  peers_[nPeers_++].lastUse = ++peerTick_;
+  return true;
+}
+
+bool PowerMesh::evictPeer() {
+  int lru = -1;
+  for (uint8_t i = 0; i < nPeers_; i++) {
+    if (macEq(peers_[i].mac, masterMac_)) continue;
+    if (lru < 0 || (int32_t)(peers_[i].lastUse - peers_[lru].lastUse) < 0) lru = i;
+  }
+  if (lru < 0) return false;
+  hal_.radioDelPeer(peers_[lru].mac);
+  peers_[lru] = peers_[--nPeers_];
+  return true;
+}
+
+int PowerMesh::sendTo(const uint8_t* mac, const void* data, size_t len) {
+  int e = ensurePeer(mac) ? hal_.radioSend(mac, (const uint8_t*)data, len) : -1;
+  if (e != 0) stats_.sendFail++;
+  return e;
+}
+
+// ===================== VICINI =====================
+PowerMeshNeighbor* PowerMesh::findNeighbor(const uint8_t* mac) {
+  for (uint8_t i = 0; i < nNeighbors_; i++) if (macEq(neighbors_[i].mac, mac)) return &neighbors_[i];
+  return nullptr;
+}
+
+//RSSI: media mobile 3/4 vecchio + 1/4 nuovo, un frame sfortunato non sposta la rotta.
+//Tabella piena: esce il vicino sentito meno di recente (mai il padre).
+void PowerMesh::upsertNeighbor(const uint8_t* mac, uint8_t hops, int8_t rssi, uint32_t now) {
+  PowerMeshNeighbor* n = findNeighbor(mac);
+  if (n) {
+    n->rssi = (int8_t)((3 * (int)n->rssi + (int)rssi) / 4);
+  } else {
+    if (nNeighbors_ < MESH_MAX_NEIGHBORS) {
+      n = &neighbors_[nNeighbors_++];
+    } else {
+      for (uint8_t i = 0; i < nNeighbors_; i++) {
+        PowerMeshNeighbor& c = neighbors_[i];
+        if (hasParent_ && macEq(c.mac, parent_)) continue;
+        if (!n || (int32_t)(c.lastSeenMs - n->lastSeenMs) < 0) n = &c;
+      }
+    }
+    memcpy(n->mac, mac, 6);
+    n->rssi = rssi;
+  }
+  n->hops = hops;
+  n->lastSeenMs = now;
+  selectParent(now);
+}
+
+bool PowerMesh::usable(const PowerMeshNeighbor& n, uint32_t now) const {
+  return now - n.lastSeenMs < cfg_.neighborTimeoutMs && n.rssi >= cfg_.minRssi &&
+         n.hops < MESH_MAX_HOPS && !isChild(n.mac);
+}
+
+//un vicino da cui salgono i miei DATA a 1 hop è un figlio: sceglierlo come padre farebbe un anello
+bool PowerMesh::isChild(const uint8_t* mac) const {
+  const PowerMeshRoute* r = routes_.find(mac);
+  return r && r->hops == 1 && macEq(r->via, mac);
+}
+
+void PowerMesh::selectParent(uint32_t now) {
+  const PowerMeshNeighbor* best = nullptr;
+  const PowerMeshNeighbor* cur = nullptr;
+  for (uint8_t i = 0; i < nNeighbors_; i++) {
+    const PowerMeshNeighbor& n = neighbors_[i];
+    if (!usable(n, now)) continue;
+    if (hasParent_ && macEq(n.mac, parent_)) cur = &n;
+    if (!best || n.hops < best->hops || (n.hops == best->hops && n.rssi > best->rssi)) best = &n;
+  }
+
+  //isteresi: il padre attuale resta finché l'altro non ha un hop in meno o switchDb dB in più
+  if (cur && best != cur && best->hops >= cur->hops && best->rssi < cur->rssi + cfg_.switchDb) best = cur;
+
+  if (!best) {
+    if (hasParent_) stats_.parentChanges++;
+    hasParent_ = false;
+    hops_ = MESH_NO_ROUTE;
+    return;
+  }
+  if (!hasParent_ || !macEq(parent_, best->mac)) {
+    stats_.parentChanges++;
+    memcpy(parent_, best->mac, 6);
+    hasParent_ = true;
+  }
+  hops_ = (uint8_t)(best->hops + 1);
+}
+
+void PowerMesh::expireNeighbors(uint32_t now) {
+  bool removed = false;
+  for (uint8_t i = 0; i < nNeighbors_;) {
+    if (now - neighbors_[i].lastSeenMs >= cfg_.neighborTimeoutMs) {
+      neighbors_[i] = neighbors_[--nNeighbors_];
+      removed = true;
+    } else {
+      i++;
+    }
+  }
+  if (removed || hasParent_) selectParent(now);
+}
+
+void PowerMesh::heardMaster(int8_t rssi, uint32_t now) {
+  if (!enabled_) return;
+  Guard g(*this);
+  upsertNeighbor(masterMac_, 0, rssi, now);
+}
+
+void PowerMesh::heardBeacon(const uint8_t* src, uint8_t hops, int8_t rssi, uint32_t now) {
+  if (!enabled_ || macEq(src, myMac_) || hops == MESH_NO_ROUTE) return;
+  Guard g(*this);
+  upsertNeighbor(src, hops, rssi, now);
+}
+
+// ===================== BUSTE =====================
+void PowerMesh::onFrame(const uint8_t* src, const uint8_t* data, int len, uint32_t now) {
+  if (!enabled_ || len < (int)sizeof(PowerMeshHeader) || len > (int)MESH_MAX_FRAME) return;
+
+  PowerMeshHeader h;
+  memcpy(&h, data, sizeof(h));
+  const uint8_t* payload = data + sizeof(h);
+  int plen = len - (int)sizeof(h);
+  bool up = (h.flags & MESH_UP) != 0;
+
+  //sceso fino a me
+  if (!up && macEq(h.node, myMac_)) {
+    if (h.type == PWR_MESH_ACK_TYPE) {
+      Guard g(*this);
+      ackReceived(h.seq, (uint8_t)(h.hops + 1), now);
+      return;
+    }
+    if (h.type != PWR_MESH_DATA_TYPE) return;
+    {
+      Guard g(*this);
+      if (h.flags & MESH_WANT_ACK) sendAck(h); //anche sui duplicati: l'ACK di prima può essersi perso
+      if (dedup_.seen(h.node, h.seq, meshDeliverTag(h))) { stats_.dupDropped++; return; }
+      stats_.delivered++;
+    }
+    //fuori dal lock: la logica risponde con sendUp
+    if (deliver_ && plen > 0) deliver_(deliverCtx_, payload, plen);
+    return;
+  }
+
+  //da inoltrare
+  Guard g(*this);
+  if (dedup_.seen(h.node, h.seq, meshForwardTag(h))) { stats_.dupDropped++; return; }
+  if (h.ttl <= 1) { stats_.ttlDropped++; return; }
+  h.ttl--;
+  h.hops++;
+
+  const uint8_t* next;
+  if (up) {
+    if (macEq(h.node, myMac_)) return; //il mio DATA tornato indietro da un anello
+    routes_.learn(h.node, src, h.hops, now);
+    if (!hasParent_) { stats_.noRouteDropped++; return; }
+    next = parent_;
+  } else {
+    const PowerMeshRoute* r = routes_.find(h.node);
+    if (!r) { stats_.noRouteDropped++; return; }
+    next = r->via;
+  }
+
+  uint8_t buf[MESH_MAX_FRAME];
+  size_t n = meshWrap(buf, sizeof(buf), h, payload, (size_t)plen);
+  if (sendTo(next, buf, n) != 0) return;
+  if (up) stats_.forwardedUp++;
+  else stats_.forwardedDown++;
+}
+
+void PowerMesh::sendAck(const PowerMeshHeader& data) {
+  if (!hasParent_) { stats_.noRouteDropped++; return; }
+  PowerMeshHeader a;
+  a.type = PWR_MESH_ACK_TYPE;
+  //stesso tentativo del DATA: per i relè l'ACK di una ritrasmissione è un frame nuovo, non un duplicato
+  a.flags = (uint8_t)(MESH_UP | (data.flags & MESH_ATTEMPT_MASK));
+  a.ttl = MESH_MAX_HOPS;
+  a.hops = 0;
+  memcpy(a.node, myMac_, 6);
+  a.seq = data.seq;
+  if (sendTo(parent_, &a, sizeof(a)) == 0) stats_.acksSent++;
+}
+
+void PowerMesh::ackReceived(uint16_t seq, uint8_t hops, uint32_t now) {
+  for (uint8_t i = 0; i < MESH_PENDING; i++) {
+    Pending& p = pending_[i];
+    if (!p.used || p.seq != seq) continue;
+    uint32_t rtt = now - p.sentMs;
+    stats_.acked++;
+    stats_.rttCount++;
+    stats_.rttSumMs += rtt;
+    if (rtt > stats_.rttMaxMs) stats_.rttMaxMs = rtt;
+    stats_.rttHopSum += hops;
+    p.used = false;
+    return;
+  }
+  //ACK di un tentativo già abbandonato: niente da fare
+}
+
+// ===================== INVIO =====================
+void PowerMesh::sendPending(Pending& p) {
+  if (!hasParent_) { stats_.noRouteDropped++; return; }
+  PowerMeshHeader h;
+  h.type = PWR_MESH_DATA_TYPE;
+  h.flags = (uint8_t)(MESH_UP | MESH_WANT_ACK | (p.attempt << MESH_ATTEMPT_SHIFT));
+  h.ttl = MESH_MAX_HOPS;
+  h.hops = 0;
+  memcpy(h.node, myMac_, 6);
+  h.seq = p.seq;
+
+  uint8_t buf[MESH_MAX_FRAME];
+  size_t n = meshWrap(buf, sizeof(buf), h, p.data, p.len);
+  sendTo(parent_, buf, n);
+}
+
+//il tentativo parte subito; in coda resta una copia per le ritrasmissioni.
+//Coda piena: il DATA più vecchio si considera perso.
+int PowerMesh::sendUp(const void* pkt, size_t len, uint32_t now) {
+  if (len > MESH_MAX_PAYLOAD) return -1;
+  Guard g(*this);
+
+  Pending* p = nullptr;
+  for (uint8_t i = 0; i < MESH_PENDING && !p; i++) if (!pending_[i].used) p = &pending_[i];
+  if (!p) {
+    p = &pending_[0];
+    for (uint8_t i = 1; i < MESH_PENDING; i++) if ((int32_t)(pending_[i].sentMs - p->sentMs) < 0) p = &pending_[i];
+    stats_.timeouts++;
+  }
+
+  p->used = true;
+  p->seq = ++seq_;
+  p->attempt = 0;
+  p->sentMs = now;
+  p->len = (uint8_t)len;
+  memcpy(p->data, pkt, len);
+  stats_.originated++;
+
+  uint32_t fails = stats_.sendFail;
+  sendPending(*p);
+  return stats_.sendFail == fails && hasParent_ ? 0 : -1;
+}
+
+void PowerMesh::retryPending(uint32_t now) {
+  uint32_t timeout = cfg_.ackTimeoutMs * (hops_ == MESH_NO_ROUTE ? MESH_MAX_HOPS : hops_);
+  for (uint8_t i = 0; i < MESH_PENDING; i++) {
+    Pending& p = pending_[i];
+    if (!p.used || now - p.sentMs < timeout) continue;
+    if (p.attempt >= cfg_.maxRetries || p.attempt >= 0x0F) {
+      stats_.timeouts++;
+      p.used = false;
+      continue;
+    }
+    p.attempt++;
+    p.sentMs = now; //l'RTT conta dall'ultimo tentativo
+    stats_.retries++;
+    sendPending(p);
+  }
+}
+
+void PowerMesh::poll(uint8_t ch, uint32_t now) {
+  if (!enabled_) return;
+  Guard g(*this);
+  expireNeighbors(now);
+  retryPending(now);
+
+  //BEACON solo con una rotta; lo sfasamento per MAC evita che i nodi accesi insieme trasmettano insieme
+  if (hops_ == MESH_NO_ROUTE || (int32_t)(now - nextBeaconMs_) < 0) return;
+  nextBeaconMs_ = now + cfg_.beaconMs - cfg_.beaconMs / 8 + (myMac_[5] * 7u) % (cfg_.beaconMs / 4 + 1);
+
+  PowerMeshBeaconPacket b;
+  b.type = PWR_MESH_BEACON_TYPE;
+  b.ch = ch;
+  b.hops = hops_;
+  memcpy(b.master, masterMac_, 6);
+  b.ms = now;
+  sendTo(BROADCAST_MAC, &b, sizeof(b));
+}
@@ -0,0 +1,227 @@
+#pragma once
+/*
+  EVE-POWER - inoltro multi-hop (opzionale, PowerNode::enableMesh)
+  Per i nodi fuori portata dal master: i POWER alimentati inoltrano i frame dei vicini.
+  - vicini: HELLO del master (0 hop) e BEACON dei nodi che hanno già una rotta, con il loro RSSI
+  - rotta verso il master: il vicino con meno hop sopra minRssi, a parità il più forte. Si cambia
+    solo per un hop in meno o switchDb dB in più; mai verso un proprio figlio.
+    A 1 hop si parla al master come sempre (pacchetti normali). Dal 2° hop in su ogni pacchetto
+    viaggia in una busta PowerMeshHeader + pacchetto POWER.
+  - verso il basso: ogni busta che sale insegna "nodo X -> passa da Y" (PowerMeshRoutes, con hop)
+  - duplicati: (nodo, seq, tipo/flag) degli ultimi MESH_DEDUP frame. TTL scalato a ogni hop.
+  - ACK end-to-end: il master risponde a ogni DATA salito con un ACK che scende, il nodo a ogni
+    DATA sceso. Senza ACK il mittente ritrasmette (stesso seq, tentativo+1) fino a maxRetries.
+  - misure: contatori di inoltro e scarti, RTT end-to-end e hop dei pacchetti confermati
+    (latenza media per hop = rttSumMs / (2 * rttHopSum))
+  - sull'ESP32 ricezione (task WiFi) e poll/sendUp (loop) girano in task diversi: ogni ingresso
+    prende il lock di setLock. Dentro il lock si trasmette, quindi serve un mutex e non un portMUX.
+    La consegna alla logica del nodo avviene a lock rilasciato (la logica può chiamare sendUp).
+  Il master deve capire la busta: PowerMeshDedup e meshWrap servono anche a lui
+  (vedi tools/fleet_sim/sim_master.cpp).
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include "power_hal.h"
+#include "power_protocol.h"
+
+static const uint8_t MESH_UP            = 0x01; //verso il master
+static const uint8_t MESH_WANT_ACK      = 0x02;
+static const uint8_t MESH_ATTEMPT_SHIFT = 4;    //tentativo nei 4 bit alti dei flag
+static const uint8_t MESH_ATTEMPT_MASK  = 0xF0;
+
+static const uint8_t MESH_MAX_HOPS      = 8;    //TTL iniziale e hop massimi di una rotta
+static const uint8_t MESH_NO_ROUTE      = 0xFF;
+static const uint8_t MESH_MAX_NEIGHBORS = 8;
+static const uint8_t MESH_MAX_ROUTES    = 32;   //nodi raggiungibili passando da me
+static const uint8_t MESH_DEDUP         = 32;
+static const uint8_t MESH_PENDING       = 4;    //DATA in attesa di ACK end-to-end
+static const uint8_t MESH_MAX_PEERS     = 16;   //ESP-NOW ne tiene al massimo 20 in chiaro, master compreso
+static const size_t  MESH_MAX_PAYLOAD   = sizeof(PowerRelayRulesPacket);
+static const size_t  MESH_MAX_FRAME     = sizeof(PowerMeshHeader) + MESH_MAX_PAYLOAD;
+
+struct PowerMeshConfig {
+  uint32_t beaconMs = 1000;          //periodo del BEACON (più uno sfasamento fisso per MAC)
+  uint32_t neighborTimeoutMs = 5000; //vicino non più sentito da tanto: fuori
+  int8_t minRssi = -85;              //sotto questo il collegamento è troppo debole per una rotta
+  uint8_t switchDb = 6;              //isteresi sul cambio di padre a parità di hop
+  uint32_t ackTimeoutMs = 150;       //attesa dell'ACK end-to-end, per hop
+  uint8_t maxRetries = 2;
+};
+
+struct PowerMeshNeighbor {
+  uint8_t mac[6];
+  uint8_t hops;       //hop del vicino verso il master (0 = il master)
+  int8_t rssi;        //media mobile
+  uint32_t lastSeenMs;
+};
+
+struct PowerMeshRoute {
+  uint8_t node[6];
+  uint8_t via[6];     //prossimo hop verso node
+  uint8_t hops;       //hop da qui a node
+  uint32_t lastSeenMs;
+};
+
+struct PowerMeshStats {
+  uint32_t originated = 0;     //DATA partiti da questo nodo in busta
+  uint32_t forwardedUp = 0;    //inoltrati verso il master (carico da relè)
+  uint32_t forwardedDown = 0;  //inoltrati verso un nodo
+  uint32_t delivered = 0;      //DATA scesi fino a qui e passati alla logica
+  uint32_t acksSent = 0;
+  uint32_t dupDropped = 0;
+  uint32_t ttlDropped = 0;
+  uint32_t noRouteDropped = 0;
+  uint32_t sendFail = 0;       //esp_now_send / peer falliti
+  uint32_t acked = 0;          //DATA propri confermati dal master
+  uint32_t retries = 0;
+  uint32_t timeouts = 0;       //DATA propri abbandonati dopo tutti i tentativi
+  uint32_t parentChanges = 0;
+  uint32_t rttCount = 0;
+  uint32_t rttSumMs = 0;
+  uint32_t rttMaxMs = 0;
+  uint32_t rttHopSum = 0;      //somma degli hop dei DATA confermati
+};
+
+// ===================== TABELLE =====================
+class PowerMeshRoutes {
+public:
+  PowerMeshRoutes() : n_(0) {}
+
+  //node raggiungibile passando da via in hops hop (piena: esce quella sentita meno di recente)
+  void learn(const uint8_t* node, const uint8_t* via, uint8_t hops, uint32_t now);
+  const PowerMeshRoute* find(const uint8_t* node) const;
+  uint8_t size() const { return n_; }
+  const PowerMeshRoute& at(uint8_t i) const { return r_[i]; }
+
+private:
+  PowerMeshRoute r_[MESH_MAX_ROUTES];
+  uint8_t n_;
+};
+
+class PowerMeshDedup {
+public:
+  PowerMeshDedup();
+  //true se (node, seq, tag) è già passato, altrimenti lo ricorda
+  bool seen(const uint8_t* node, uint16_t seq, uint16_t tag);
+
+private:
+  struct Key {
+    uint8_t node[6];
+    uint16_t seq;
+    uint16_t tag;
+    bool used;
+  };
+  Key k_[MESH_DEDUP];
+  uint8_t next_;
+};
+
+//tag dei duplicati: chi inoltra distingue anche i tentativi, chi consegna no (stesso DATA = una volta sola)
+static inline uint16_t meshForwardTag(const PowerMeshHeader& h) { return (uint16_t)(h.type << 8 | h.flags); }
+static inline uint16_t meshDeliverTag(const PowerMeshHeader& h) { return (uint16_t)(0x8000 | h.type << 8 | (h.flags & 0x0F)); }
+
+//header + payload in out; ritorna la lunghezza (0 se non ci sta)
+size_t meshWrap(uint8_t* out, size_t cap, const PowerMeshHeader& h, const void* payload, size_t len);
+
+// ===================== NODO =====================
+class PowerMesh {
+public:
+  //consegna alla logica del nodo un pacchetto POWER sceso in busta
+  typedef void (*DeliverFn)(void* ctx, const uint8_t* data, int len);
+  typedef void (*LockFn)(void* ctx, bool lock);
+
+  PowerMesh(PowerHal& hal, const uint8_t* masterMac);
+
+  void enable(const PowerMeshConfig& cfg, DeliverFn fn, void* ctx);
+  bool enabled() const { return enabled_; }
+  void setLock(LockFn fn, void* ctx) { lockFn_ = fn; lockCtx_ = ctx; }
+  //per leggere uno stato coerente da un altro task (es. "mesh stat"); non annidabile
+  void lock(bool on) const { if (lockFn_) lockFn_(lockCtx_, on); }
+  //radio (ri)avviata: i peer ESP-NOW sono da rifare, il MAC ora si può leggere
+  void radioReset();
+
+  // ===================== RICEZIONE =====================
+  void heardMaster(int8_t rssi, uint32_t now);
+  void heardBeacon(const uint8_t* src, uint8_t hops, int8_t rssi, uint32_t now);
+  void onFrame(const uint8_t* src, const uint8_t* data, int len, uint32_t now);
+
+  // ===================== INVIO =====================
+  //true: il master è a 2+ hop, i pacchetti del nodo vanno in busta (sendUp)
+  bool routed() const { return enabled_ && hops_ != MESH_NO_ROUTE && hops_ >= 2; }
+  int sendUp(const void* pkt, size_t len, uint32_t now);
+  //BEACON, vicini scaduti, ritrasmissioni. Da loop() quando il canale è agganciato.
+  void poll(uint8_t ch, uint32_t now);
+
+  // ===================== STATO =====================
+  uint8_t hops() const { return hops_; }
+  const uint8_t* parent() const { return hasParent_ ? parent_ : nullptr; }
+  int8_t parentRssi() const;
+  uint8_t neighborCount() const { return nNeighbors_; }
+  const PowerMeshNeighbor& neighbor(uint8_t i) const { return neighbors_[i]; }
+  const PowerMeshRoutes& routes() const { return routes_; }
+  const PowerMeshStats& stats() const { return stats_; }
+
+private:
+  class Guard {
+  public:
+    explicit Guard(const PowerMesh& m) : m_(m) { m_.lock(true); }
+    ~Guard() { m_.lock(false); }
+  private:
+    const PowerMesh& m_;
+  };
+
+  struct Pending {
+    bool used;
+    uint16_t seq;
+    uint8_t attempt;
+    uint32_t sentMs;
+    uint8_t len;
+    uint8_t data[MESH_MAX_PAYLOAD];
+  };
+
+  PowerMeshNeighbor* findNeighbor(const uint8_t* mac);
+  void upsertNeighbor(const uint8_t* mac, uint8_t hops, int8_t rssi, uint32_t now);
+  bool usable(const PowerMeshNeighbor& n, uint32_t now) const;
+  bool isChild(const uint8_t* mac) const;
+  void selectParent(uint32_t now);
+  void expireNeighbors(uint32_t now);
+  void retryPending(uint32_t now);
+  void sendPending(Pending& p);
+  void sendAck(const PowerMeshHeader& data);
+  void ackReceived(uint16_t seq, uint8_t hops, uint32_t now);
+  int sendTo(const uint8_t* mac, const void* data, size_t len);
+  bool ensurePeer(const uint8_t* mac);
+  bool evictPeer();
+
+  PowerHal& hal_;
+  const uint8_t* masterMac_;
+  PowerMeshConfig cfg_;
+  bool enabled_;
+  DeliverFn deliver_;
+  void* deliverCtx_;
+  LockFn lockFn_;
+  void* lockCtx_;
+  uint8_t myMac_[6];
+
+  PowerMeshNeighbor neighbors_[MESH_MAX_NEIGHBORS];
+  uint8_t nNeighbors_;
+  bool hasParent_;
+  uint8_t parent_[6];
+  uint8_t hops_;
+
+  PowerMeshRoutes routes_;
+  PowerMeshDedup dedup_;
+  Pending pending_[MESH_PENDING];
+  uint16_t seq_;
+  uint32_t nextBeaconMs_;
+
+  struct Peer {
+    uint8_t mac[6];
+    uint32_t lastUse;
+  };
+  Peer peers_[MESH_MAX_PEERS];
+  uint8_t nPeers_;
+  uint32_t peerTick_;
+
+  PowerMeshStats stats_;
+};
@@ -0,0 +1,726 @@
+/*
+  EVE-POWER - logica del nodo POWER (vedi power_node.h)
+  - Handshake canale via HELLO (type=2)
+  - Schedulazioni: esecuzione SOLO all'istante esatto (minuteOfDay match).
+    (Niente "normalize" che può cambiare subito lo stato quando arriva una regola.)
+  - Prima di accettare QUALSIASI messaggio ESP-NOW, POWER deve ricevere HELLO e agganciarsi al canale del master
+  - Dopo HELLO -> invia ACK "ok ho ricevuto il canale" (HELLO_ACK)
+  - Poi accetta RULES e le salva. Se ok -> ACK ok=1, se KO -> ACK ok=0 + ERROR packet
+*/
+
+#include "power_node.h"
+
+#include <string.h>
+#include <stdio.h>
+
+#if DBG_ENABLED
+  #define DBG(...)   do { hal_.logf(__VA_ARGS__); } while(0)
+  #define DBGLN(...) do { hal_.logf(__VA_ARGS__); hal_.logf("\r\n"); } while(0)
+#else
+  #define DBG(...)   do { } while (0)
+  #define DBGLN(...) do { } while (0)
+#endif
+
+// ===================== NVS =====================
+static const char* NVS_NS        = "evepower";
+static const char* KEY_RELAYMASK = "relayMask"; //quali relè sono ON/OFF (bitmask)
+static const char* KEY_RC[RELAY_COUNT] = {"rc1","rc2","rc3","rc4"};//quanti schedule ci sono (0..10)
+static const char* KEY_RB[RELAY_COUNT] = {"rb1","rb2","rb3","rb4"}; //il blocco binario con le regole (array da 10)
+#if !USE_FIXED_MASTER_MAC
+static const char* KEY_MMAC = "masterMac"; //MAC master (solo se NON fisso)
+#endif
+
+//tempi della ricerca canale (come il firmware originale)
+static const uint32_t SCAN_DWELL_MS = 260; //quanto resto su ogni canale aspettando HELLO
+static const uint32_t SCAN_POLL_MS  = 5;
+//multi-hop: senza aggancio si continua a cercare, i vicini possono avere una rotta solo dopo
+static const uint32_t MESH_RESCAN_MS = 7000;
+
+static inline const char* onOff(bool on) { return on ? "ON" : "OFF"; }
+//Utility per stampare "ON" o "OFF" nei log.
+
+//prende un MAC in formato byte e lo trasforma in testo tipo "AA:BB:CC:DD:EE:FF"
+static void macToStr(const uint8_t* mac, char* out, size_t n) {
+  snprintf(out, n, "%02X:%02X:%02X:%02X:%02X:%02X",
+           mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+/*“oggi questa regola è attiva oggi?”*/
+static inline bool dayEnabled(uint8_t daysMask, uint8_t wdMon0) {
+  return ((daysMask >> (wdMon0 % 7)) & 0x01) != 0;
+}
+
+PowerNode::PowerNode(PowerHal& hal)
+  : hal_(hal),
+    gotHello_(false), helloCh_(1), channelReady_(false), curChannel_(1),
+    relayMask_(0),
+    timeValid_(false), curMinOfDay_(0), curWeekday_(0), lastTimeSyncMs_(0),
+    scanStartMs_(0), scanMaxMs_(0), scanDwellMs_(0), scanCh_(1),
+    cap_(nullptr), mesh_(hal, masterMac_) {
+#if USE_FIXED_MASTER_MAC
+  memcpy(masterMac_, DEFAULT_MASTER_MAC, 6);
+#else
+  memset(masterMac_, 0, 6);
+#endif
+  memset(rules_, 0, sizeof(rules_));
+  memset(ruleCount_, 0, sizeof(ruleCount_));
+}
+
+// ===================== RELAY =====================
+//funziuone che scrive ON o OFF sul rele
+//chqto4 è il numero del rele,
+//on è lo stato True = acceso, false = spento
+void PowerNode::relayWrite(uint8_t ch1to4, bool on) {
+  if (ch1to4 < 1 || ch1to4 > RELAY_COUNT) return; //controllo che il rele sia compreso tra 0 e RELAY_COUNT=4
+  uint8_t pin = RELAY_PINS[ch1to4 - 1]; //perche l'arrey parte da 0
+  bool level = on;
+  if (RELAY_ACTIVE_LOW) level = !on; //inverte da ON a OFF e viceversa
+  hal_.pinWrite(pin, level);
+}
+
+void PowerNode::relayMaskSet(uint8_t ch, bool on) {
+  if (on) relayMask_ |= (1 << (ch - 1));
+  else    relayMask_ &= ~(1 << (ch - 1));
+}
+
+void PowerNode::relaysInitAndRestore() {
+  for (uint8_t i = 0; i < RELAY_COUNT; i++) {
+    hal_.pinOutput(RELAY_PINS[i]);
+    relayWrite(i + 1, false);
+  }
+  hal_.delayMs(150);
+
+  relayMask_ = hal_.nvsGetUChar(KEY_RELAYMASK, 0);
+  DBGLN("[RELAY] restore mask=%u", (unsigned)relayMask_);
+  for (uint8_t ch = 1; ch <= RELAY_COUNT; ch++) relayWrite(ch, relayMaskGet(ch));
+}
+
+// ===================== NVS =====================
+/*“scrivi su disco quali relè sono ON/OFF”*/
+void PowerNode::saveRelayMask() { hal_.nvsPutUChar(KEY_RELAYMASK, relayMask_); }
+
+/*Salva in memoria permanente (NVS) tutte le regole di un relè specifico
+e ritorna true se il salvataggio è riuscito, false se no.*/
+bool PowerNode::saveRules(uint8_t ch1to4) {
+  int i = ch1to4 - 1; //numero di rele normalizzato per array
+
+  // Salvataggio count + blocco regole
+  size_t w1 = hal_.nvsPutUChar(KEY_RC[i], ruleCount_[i]); //ad esempio in flash salva: rc2 =3
+  size_t w2 = hal_.nvsPutBytes(KEY_RB[i], rules_[i], sizeof(rules_[i]));//salva/scrive tutte le regole de rele struct RelayRuleBin
+
+  //controllo se il salvataggio è riuscito w1 == 1 - scrittura del count riuscita w2 == dimensione completa ||| scrittura del blocco riuscita.
+  bool ok = (w1 == 1) && (w2 == sizeof(rules_[i]));
+  DBGLN("[SCHEDULAZIONE] REGOLE SALVATE RELE=%u N_REGOLE=%u REGOLA=%u byte scritti=%u ok=%u",
+        ch1to4, ruleCount_[i], (unsigned)w1, (unsigned)w2, (unsigned)ok);
+
+  return ok; //ritorna ok per inviare ACK ok al master
+}
+
+//ricarica tutte le regole all'avvio (boot)
+//Legge dalla memoria permanente (NVS) tutte le schedulazioni dei relè e le rimette in RAM.
+void PowerNode::loadRulesAll() {
+  for (int i = 0; i < RELAY_COUNT; i++) {
+    uint8_t c = hal_.nvsGetUChar(KEY_RC[i], 0);
+    if (c > MAX_RULES) c = MAX_RULES;
+    ruleCount_[i] = c;
+
+    size_t n = hal_.nvsGetBytes(KEY_RB[i], rules_[i], sizeof(rules_[i]));
+    if (n != sizeof(rules_[i])) {
+      memset(rules_[i], 0, sizeof(rules_[i]));
+      ruleCount_[i] = 0;
+    }
+    DBGLN("[SCHEDULAZIONE] CARICO REGOLE RELE=%d NREGOLE=%u bytes scritti=%u", i+1, ruleCount_[i], (unsigned)n);
+  }
+}
+
+//impara il mac del master, se lo trova torna vero
+bool PowerNode::masterMacValid() const {
+  for (int i = 0; i < 6; i++) if (masterMac_[i] != 0) return true;
+  return false;
+}
+
+//salva il mac del master
+//1 Copia il MAC ricevuto nella variabile masterMac_
+//2. e lo salva nella memoria flash (NVS)
+void PowerNode::storeMasterMac(const uint8_t* mac) {
+#if !USE_FIXED_MASTER_MAC                         //se non stai usando un MAC fisso per il master
+  memcpy(masterMac_, mac, 6);
+  hal_.nvsPutBytes(KEY_MMAC, masterMac_, 6);
+#else
+  (void)mac;
+#endif
+}
+
+//nel caso di reboot va a recuperare il mac del master dalla memoria
+void PowerNode::loadMasterMac() {
+#if !USE_FIXED_MASTER_MAC
+  uint8_t tmp[6] = {0,0,0,0,0,0};
+  size_t n = hal_.nvsGetBytes(KEY_MMAC, tmp, 6);
+  if (n == 6) memcpy(masterMac_, tmp, 6);
+#endif
+}
+
+// ===================== CATTURA =====================
+static_assert(RELAY_COUNT == 4, "PowerCaptureSnap ha 4 relè");
+
+//prima del record uno SNAP se dall'ultimo è passato mezzo ring
+void PowerNode::captureRecord(uint8_t kind, const void* a, size_t alen, const void* b, size_t blen) {
+  uint32_t now = hal_.millis();
+  if (cap_->snapshotDue()) {
+    PowerCaptureSnap s;
+    snapshot(s);
+    cap_->record(CAP_SNAP, now, &s, sizeof(s));
+  }
+  cap_->record(kind, now, a, alen, b, blen);
+}
+
+void PowerNode::captureFrame(uint8_t kind, const uint8_t* mac, const void* data, size_t len, int status) {
+  uint8_t fh[CAP_FRAME_HDR];
+  memcpy(fh, mac, 6);
+  fh[6] = (uint8_t)status;
+  captureRecord(kind, fh, sizeof(fh), data, len);
+}
+
+void PowerNode::snapshot(PowerCaptureSnap& s) const {
+  memset(&s, 0, sizeof(s));
+  s.relayMask = relayMask_;
+  s.timeValid = timeValid_ ? 1 : 0;
+  s.minuteOfDay = curMinOfDay_;
+  s.weekdayMon0 = curWeekday_;
+  s.lastTimeSyncMs = lastTimeSyncMs_;
+  s.channelReady = channelReady_ ? 1 : 0;
+  s.channel = curChannel_;
+  memcpy(s.masterMac, masterMac_, 6);
+  memcpy(s.ruleCount, ruleCount_, sizeof(s.ruleCount));
+  memcpy(s.rules, rules_, sizeof(s.rules));
+}
+
+void PowerNode::restore(const PowerCaptureSnap& s) {
+  hal_.nvsBegin(NVS_NS); //le prossime saveRules/saveRelayMask devono poter scrivere
+  relayMask_ = s.relayMask;
+  timeValid_ = s.timeValid != 0;
+  curMinOfDay_ = s.minuteOfDay;
+  curWeekday_ = s.weekdayMon0;
+  lastTimeSyncMs_ = s.lastTimeSyncMs;
+  channelReady_ = s.channelReady != 0;
+  curChannel_ = s.channel;
+  memcpy(masterMac_, s.masterMac, 6);
+  for (int i = 0; i < RELAY_COUNT; i++) ruleCount_[i] = s.ruleCount[i] > MAX_RULES ? MAX_RULES : s.ruleCount[i];
+  memcpy(rules_, s.rules, sizeof(rules_));
+
+  for (uint8_t ch = 1; ch <= RELAY_COUNT; ch++) {
+    hal_.pinOutput(RELAY_PINS[ch - 1]);
+    relayWrite(ch, relayMaskGet(ch));
+  }
+}
+
+// ===================== ESPNOW peers =====================
+//Assicura che il MASTER sia registrato come “peer” ESP-NOW, così POWER può inviargli pacchetti.
+void PowerNode::ensureMasterPeer(uint8_t /*ch*/) {
+  if (!masterMacValid()) {
+    DBGLN("[ESPNOW] MAC MASTER NON VALIDO");
+    return;
+  }
+
+  int e = hal_.radioAddPeer(masterMac_);
+
+  char macs[24]; macToStr(masterMac_, macs, sizeof(macs));
+  DBGLN("[ESPNOW -POWER] PEER AGGIUNGTO con mac=%s PEER=%d", macs, e);
+  (void)e; //solo per il log
+}
+
+//tutti i pacchetti verso il master passano da qui (così finiscono anche nella cattura).
+//Master a 2+ hop: il pacchetto parte in busta verso il padre, in cattura resta com'è
+int PowerNode::sendToMaster(const void* pkt, size_t len, bool capture) {
+  int e = mesh_.routed() ? mesh_.sendUp(pkt, len, hal_.millis())
+                         : hal_.radioSend(masterMac_, (const uint8_t*)pkt, len);
+  if (cap_ && capture) captureFrame(CAP_TX, masterMac_, pkt, len, e);
+  return e;
+}
+
+//invia ack di aggangio del canale da parte del peer al master se lo trova
+void PowerNode::sendHelloAckToMaster(uint8_t ch, bool ok, bool capture) {
+  if (!masterMacValid()) { DBGLN("[ESPNOW - POWER] Non posso inviare HelloAck skipped (non conosco il MAC del MASTER)"); return; }
+
+  HelloAckPacket a;
+  a.type = PWR_HELLO_ACK_TYPE; //tipo messaggio
+  a.ch   = ch;  //canale sintonizzato
+  a.ok   = ok ? 1 : 0;
+  a.ms   = hal_.millis(); //timestamp
+
+  int e = sendToMaster(&a, sizeof(a), capture);
+  DBGLN("[ESPNOW - PORWER]  HELLO_ACK OK! ho mandato ACK sul CANALE=%u TUTTO BENE=%u -> %d", (unsigned)a.ch, (unsigned)a.ok, e);
+  (void)e; //solo per il log
+}
+
+//Invia errore al master
+void PowerNode::sendErrorToMaster(uint8_t code, uint8_t ch, uint8_t extra) {
+  if (!masterMacValid()) {     DBGLN("[ESPNOW] MAC MASTER NON VALIDO"); return; }
+
+  PowerErrorPacket er;
+  er.type  = PWR_ERROR_TYPE; //tipo messaggio
+  er.code  = code;
+  er.ch    = ch;
+  er.extra = extra;
+  er.ms    = hal_.millis();
+
+  int e = sendToMaster(&er, sizeof(er));
+  DBGLN("[ESPNOW] TX ERROR CODICE=%u CANALE=%u extra=%u -> %d",
+        (unsigned)code, (unsigned)ch, (unsigned)extra, e);
+  (void)e; //solo per il log
+}
+
+//invio stato rele al master: quali relè sono ON/OFF, se l’orario è valido, perché si è riavviato, timestamp
+void PowerNode::sendStateToMaster(bool capture) {
+  if (!masterMacValid()) { DBGLN("[ESPNOW] MAC MASTER NON VALIDO"); return; }
+
+  PowerStatePacket st;
+  st.type = PWR_STATE_TYPE; //tipo_messaggio
+  st.relayMask = relayMask_; //è il numero che contiene lo stato attuale dei relè.
+  st.timeValid = timeValid_ ? 1 : 0; //ho l'orario sincronizzato oppure no?
+  st.resetReason = hal_.resetReason(); //Inserisce motivo reset
+  st.ms = hal_.millis(); //timestamp
+
+  int e = sendToMaster(&st, sizeof(st), capture);
+  DBGLN("[ESPNOW - INVIO STATO]  stato_relay=%u timeValid=%u -> %d",
+        (unsigned)st.relayMask, (unsigned)st.timeValid, e);
+  (void)e; //solo per il log
+}
+
+//Dice al Master: Ho ricevuto le schedulazioni per il relè X. Le ho salvate (oppure no).
+void PowerNode::sendScheduleAckToMaster(uint8_t ch1to4, uint8_t count, bool ok) {
+  if (!masterMacValid()) { DBGLN("[ESPNOW] MAC MASTER NON VALIDO)"); return; }
+  if (ch1to4 < 1 || ch1to4 > RELAY_COUNT) return;
+
+  PowerScheduleAckPacket ack;
+  ack.type = PWR_SCHED_ACK_TYPE;  //tipo
+  ack.ch = ch1to4;                //quale rele 1 ... 4
+  ack.ok = ok ? 1 : 0;          // successo o fallimento
+  ack.count = (count > MAX_RULES) ? MAX_RULES : count;  //quante regole
+  ack.ms = hal_.millis();  //timestamp
+
+  int e = sendToMaster(&ack, sizeof(ack));
+  DBGLN("[ESPNOW] HO SALVATO LA SCHEDULAZIONE CANALE=%u ok=%u count=%u -> %d",
+        (unsigned)ack.ch, (unsigned)ack.ok, (unsigned)ack.count, e);
+  (void)e; //solo per il log
+}
+
+//avvisa il MASTER che una schedulazione è stata davvero eseguita
+void PowerNode::sendExecutedToMaster(uint8_t ch1to4, bool on) {
+  if (!masterMacValid()) return;
+  if (ch1to4 < 1 || ch1to4 > RELAY_COUNT) return;
+
+  PowerExecutedPacket ex;
+  ex.type = PWR_EXECUTED_TYPE;
+  ex.ch = ch1to4;
+  ex.state = on ? 1 : 0;
+  ex.minuteOfDay = curMinOfDay_;
+  ex.weekdayMon0 = curWeekday_;
+  ex.ms = hal_.millis();
+
+  int e = sendToMaster(&ex, sizeof(ex));
+  DBGLN("[ESPNOW] ESEGUITO canale=%u %s min=%u wd=%u -> %d",
+        (unsigned)ex.ch, onOff(on), (unsigned)ex.minuteOfDay, (unsigned)ex.weekdayMon0, e);
+  (void)e; //solo per il log
+}
+
+// ===================== SCHEDULE ENGINE =====================
+// Esegue SOLO se minuteOfDay == curMinOfDay (quindi NON cambia stato "subito" quando arriva una regola)
+bool PowerNode::applyRulesExactNow(bool notifyExecuted) {
+  if (!timeValid_) return false;
+
+  bool changed = false;
+
+  for (uint8_t ch = 1; ch <= RELAY_COUNT; ch++) {
+    int idx = ch - 1;
+
+    for (uint8_t k = 0; k < ruleCount_[idx]; k++) {
+      const RelayRuleBin& r = rules_[idx][k];
+      if (r.minuteOfDay > 1439) continue;
+      if (!dayEnabled(r.daysMask, curWeekday_)) continue;
+
+      if (r.minuteOfDay == curMinOfDay_) {
+        bool desired = (r.on == 1);
+        if (relayMaskGet(ch) != desired) {
+          DBGLN("[SCHED] FIRE ch=%u at=%u wd=%u -> %s",
+                (unsigned)ch, (unsigned)curMinOfDay_, (unsigned)curWeekday_, onOff(desired));
+          relayWrite(ch, desired);
+          relayMaskSet(ch, desired);
+          if (notifyExecuted) sendExecutedToMaster(ch, desired);
+          changed = true;
+        } else {
+          DBGLN("[SCHED] FIRE ch=%u at=%u wd=%u -> already %s",
+                (unsigned)ch, (unsigned)curMinOfDay_, (unsigned)curWeekday_, onOff(desired));
+        }
+      }
+    }
+  }
+
+  if (changed) saveRelayMask();
+  return changed;
+}
+
+// ===================== ESPNOW CALLBACK =====================
+void PowerNode::recvTrampoline(void* ctx, const uint8_t* srcMac, const uint8_t* data, int len) {
+  static_cast<PowerNode*>(ctx)->onEspNowRecv(srcMac, data, len);
+}
+
+void PowerNode::onEspNowRecv(const uint8_t* srcMac, const uint8_t* data, int len) {
+  if (!srcMac || !data || len <= 0) return;
+  //BEACON e buste restano fuori dalla cattura: ci finisce solo il pacchetto che contengono
+  if (mesh_.enabled() && meshRecv(srcMac, data, len)) return;
+  //in cattura anche quello che poi viene ignorato (es. prima di channelReady).
+  //HELLO ripetuto sul canale già agganciato: non cambia niente, solo contato (risposte comprese)
+  bool capture = true;
+  if (cap_) {
+    capture = !(channelReady_ && data[0] == HELLO_TYPE && len == (int)sizeof(HelloPacket) && data[1] == curChannel_);
+    if (capture) captureFrame(CAP_RX, srcMac, data, (size_t)len, 0);
+    else cap_->countFolded();
+  }
+
+  char macs[24]; macToStr(srcMac, macs, sizeof(macs));
+  uint8_t ptype = (uint8_t)data[0];
+  DBGLN("[ESPNOW] RX len=%d type=%u from %s", len, (unsigned)ptype, macs);
+
+#if !USE_FIXED_MASTER_MAC
+  if (!masterMacValid()) {
+    storeMasterMac(srcMac);
+    DBGLN("[ESPNOW] Learned MASTER_MAC=%s", macs);
+  }
+#endif
+
+  // ===================== BLOCCO: prima di HELLO ignoro tutto =====================
+  // esp32 power prima di ricevere qualsiasi messaggio EP32-NOW deve prima agganciarsi sul canalee del master.
+  if (!channelReady_ && ptype != HELLO_TYPE) {
+    DBGLN("[POWER] Ignoro il memssaggio di tipo=%u (io spetto come prima cosa un messaggio di HELLO)", (unsigned)ptype);
+    return;
+  }
+
+  // HELLO
+  if (len == (int)sizeof(HelloPacket)) {
+    HelloPacket h;
+    memcpy(&h, data, sizeof(h));
+    if (h.type != HELLO_TYPE) return;
+
+    gotHello_ = true;
+    helloCh_ = h.ch;
+
+    DBGLN("[HELLO] ch=%u ms=%lu", (unsigned)h.ch, (unsigned long)h.ms);
+
+    // Aggancia canale WiFi locale
+    if (h.ch >= 1 && h.ch <= 13 && h.ch != curChannel_) {
+      curChannel_ = h.ch;
+      hal_.radioSetChannel(curChannel_);
+      DBGLN("[WIFI] set_channel=%u", (unsigned)curChannel_);
+    }
+
+    // Ora il canale è pronto: da qui in poi accetto gli altri pacchetti
+    channelReady_ = true;
+
+    ensureMasterPeer(curChannel_);
+
+    // ACK "ok ho ricevuto il canale"
+    sendHelloAckToMaster(curChannel_, true, capture);
+
+    // Stato (utile al master dopo handshake)
+    sendStateToMaster(capture);
+    return;
+  }
+
+  // CMD
+  if (len == (int)sizeof(PowerCmdPacket)) {
+    PowerCmdPacket c;
+    memcpy(&c, data, sizeof(c));
+    if (c.type != PWR_CMD_TYPE) return;
+
+    DBGLN("[CMD] maskSet=%u maskVal=%u", (unsigned)c.maskSet, (unsigned)c.maskVal);
+
+    bool changed = false;
+    for (uint8_t ch = 1; ch <= RELAY_COUNT; ch++) {
+      uint8_t bit = 1 << (ch - 1);
+      if (c.maskSet & bit) {
+        bool on = (c.maskVal & bit) != 0;
+        if (relayMaskGet(ch) != on) {
+          relayWrite(ch, on);
+          relayMaskSet(ch, on);
+          DBGLN("[RELAY] ch=%u -> %s (manual)", (unsigned)ch, onOff(on));
+          changed = true;
+        }
+      }
+    }
+
+    if (changed) saveRelayMask();
+    sendStateToMaster();
+    return;
+  }
+
+  // RULES
+  if (len == (int)sizeof(PowerRelayRulesPacket)) {
+    PowerRelayRulesPacket rp;
+    memcpy(&rp, data, sizeof(rp));
+    if (rp.type != PWR_RELAYRULE_TYPE) return;
+    if (rp.ch < 1 || rp.ch > RELAY_COUNT) {
+      DBGLN("[RULES] invalid ch=%u", (unsigned)rp.ch);
+      sendScheduleAckToMaster(rp.ch, 0, false);
+      sendErrorToMaster(PWR_ERR_INVALID_CH, rp.ch, 0);
+      return;
+    }
+
+    uint8_t c = rp.count;
+    if (c > MAX_RULES) c = MAX_RULES;
+
+    int idx = rp.ch - 1;
+    memcpy(rules_[idx], rp.rules, sizeof(rules_[idx]));
+    ruleCount_[idx] = c;
+
+    DBGLN("[RULES] ch=%u count=%u (saved, no immediate normalize)", (unsigned)rp.ch, (unsigned)ruleCount_[idx]);
+#if DBG_ENABLED
+    for (uint8_t k = 0; k < ruleCount_[idx]; k++) {
+      const RelayRuleBin& r = rules_[idx][k];
+      DBGLN("  - #%u at=%u on=%u daysMask=0x%02X", (unsigned)k, (unsigned)r.minuteOfDay, (unsigned)r.on, (unsigned)r.daysMask);
+    }
+#endif
+
+    // lo memorizza in memoria
+    bool ok = saveRules(rp.ch);
+
+    // Se e andato tutto bene manda un ACK di convalida, altrimenti manda un messaggiio di errore dicendo che non è riuscito a salvare.
+    if (ok) {
+      sendScheduleAckToMaster(rp.ch, ruleCount_[idx], true);
+    } else {
+      sendScheduleAckToMaster(rp.ch, ruleCount_[idx], false);
+      sendErrorToMaster(PWR_ERR_NVS_SAVE_FAIL, rp.ch, ruleCount_[idx]);
+    }
+
+    sendStateToMaster();
+    return;
+  }
+
+  // TIME
+  if (len == (int)sizeof(PowerTimePacket)) {
+    PowerTimePacket tp;
+    memcpy(&tp, data, sizeof(tp));
+    if (tp.type != PWR_TIME_TYPE) return;
+
+    timeValid_ = (tp.valid == 1);
+    if (timeValid_) {
+      curMinOfDay_ = tp.minuteOfDay % 1440;
+      curWeekday_  = tp.weekdayMon0 % 7;
+      lastTimeSyncMs_ = hal_.millis();
+
+      DBGLN("[TIME] valid=1 min=%u wd=%u", (unsigned)curMinOfDay_, (unsigned)curWeekday_);
+
+      bool changed = applyRulesExactNow(false);
+      if (changed) DBGLN("[TIME] applied rules at this minute");
+    } else {
+      DBGLN("[TIME] valid=0 (waiting NTP on master)");
+    }
+
+    sendStateToMaster();
+    return;
+  }
+
+  DBGLN("[ESPNOW] RX unknown (type=%u len=%d)", (unsigned)ptype, len);
+}
+
+// ===================== MULTI-HOP =====================
+void PowerNode::enableMesh(const PowerMeshConfig& cfg) {
+  mesh_.enable(cfg, meshDeliver, this);
+}
+
+//pacchetto POWER sceso in busta: per la logica arriva dal master
+void PowerNode::meshDeliver(void* ctx, const uint8_t* data, int len) {
+  PowerNode* n = static_cast<PowerNode*>(ctx);
+  n->onEspNowRecv(n->masterMac_, data, len);
+}
+
+//true se il frame era del multi-hop (BEACON, busta): la logica normale non lo vede
+bool PowerNode::meshRecv(const uint8_t* srcMac, const uint8_t* data, int len) {
+  uint32_t now = hal_.millis();
+  uint8_t ptype = data[0];
+
+  //HELLO del master: un vicino a 0 hop, poi prosegue come sempre.
+  //Già agganciato e con la rotta su un relè (master sentito debole): HELLO_ACK + STATE a ogni
+  //HELLO finirebbero in busta attraverso i relè, quindi il HELLO ripetuto si ferma qui
+  if (ptype == HELLO_TYPE && len == (int)sizeof(HelloPacket)) {
+    if (memcmp(srcMac, masterMac_, 6) != 0) return false;
+    mesh_.heardMaster(hal_.radioRssi(), now);
+    return channelReady_ && mesh_.routed() && data[1] == curChannel_;
+  }
+
+  if (ptype == PWR_MESH_BEACON_TYPE && len == (int)sizeof(PowerMeshBeaconPacket)) {
+    PowerMeshBeaconPacket b;
+    memcpy(&b, data, sizeof(b));
+
+    //come un HELLO ferma la scansione: su questo canale c'è una strada verso il master
+    gotHello_ = true;
+    helloCh_ = b.ch;
+#if !USE_FIXED_MASTER_MAC
+    if (!masterMacValid()) storeMasterMac(b.master);
+#endif
+    mesh_.heardBeacon(srcMac, b.hops, hal_.radioRssi(), now);
+
+    //il master non si sente: il primo BEACON che dà una rotta vale come HELLO
+    if (!channelReady_ && mesh_.routed()) {
+      if (b.ch >= 1 && b.ch <= 13 && b.ch != curChannel_) {
+        curChannel_ = b.ch;
+        hal_.radioSetChannel(curChannel_);
+      }
+      channelReady_ = true;
+      hal_.rtcSetLockedChannel((int8_t)curChannel_);
+      DBGLN("[MESH] canale %u agganciato da BEACON, master a %u hop", (unsigned)curChannel_, (unsigned)mesh_.hops());
+      sendHelloAckToMaster(curChannel_);
+      sendStateToMaster();
+    }
+    return true;
+  }
+
+  if (ptype == PWR_MESH_DATA_TYPE || ptype == PWR_MESH_ACK_TYPE) {
+    if (channelReady_) mesh_.onFrame(srcMac, data, len, now);
+    return true;
+  }
+  return false;
+}
+
+// ===================== ESPNOW INIT =====================
+bool PowerNode::initEspNowOnChannel(uint8_t ch) {
+  if (!hal_.radioBegin(ch, recvTrampoline, this)) return false;
+  curChannel_ = ch;
+  mesh_.radioReset();
+
+  ensureMasterPeer(ch);
+  return true;
+}
+
+//ricerca canale non bloccante: 13 canali x 260ms, ripetuti finché non scade maxMs
+//(il controllo sul tempo massimo si fa solo a fine giro, come nel firmware originale)
+void PowerNode::scanStart(uint32_t maxMs) {
+  gotHello_ = false;
+  scanMaxMs_ = maxMs;
+  scanStartMs_ = hal_.millis();
+  scanDwellMs_ = scanStartMs_;
+  scanCh_ = 1;
+
+  DBGLN("[SCAN] searching HELLO up to %lu ms", (unsigned long)maxMs);
+  hal_.radioSetChannel(scanCh_);
+}
+
+PowerNode::ScanResult PowerNode::scanPoll() {
+  if (gotHello_) {
+    hal_.rtcSetLockedChannel((int8_t)helloCh_);
+    DBGLN("[SCAN] HELLO found on ch=%u", (unsigned)helloCh_);
+    return SCAN_FOUND;
+  }
+
+  uint32_t now = hal_.millis();
+  if (now - scanDwellMs_ < SCAN_DWELL_MS) return SCAN_RUNNING;
+
+  if (scanCh_ >= 13) {
+    if (now - scanStartMs_ >= scanMaxMs_) {
+      DBGLN("[SCAN] HELLO not found");
+      return SCAN_NOT_FOUND;
+    }
+    scanCh_ = 0;
+  }
+
+  scanCh_++;
+  scanDwellMs_ = now;
+  hal_.radioSetChannel(scanCh_);
+  return SCAN_RUNNING;
+}
+
+bool PowerNode::findChannelFromHello(uint32_t maxMs) {
+  scanStart(maxMs);
+
+  ScanResult r;
+  while ((r = scanPoll()) == SCAN_RUNNING) hal_.delayMs(SCAN_POLL_MS);
+  return r == SCAN_FOUND;
+}
+
+// ===================== SETUP / LOOP =====================
+void PowerNode::begin() {
+  hal_.nvsBegin(NVS_NS);
+  loadMasterMac();
+  loadRulesAll();
+  relaysInitAndRestore();
+
+  if (cap_) {
+    uint8_t b[2] = { hal_.resetReason(), (uint8_t)hal_.rtcLockedChannel() };
+    uint32_t now = hal_.millis();
+    cap_->record(CAP_BOOT, now, b, sizeof(b));
+    PowerCaptureSnap s;
+    snapshot(s);
+    cap_->record(CAP_SNAP, now, &s, sizeof(s));
+  }
+}
+
+void PowerNode::setup() {
+  DBGLN("=== EVE-POWER SLAVE START ===");
+  DBGLN("RELAY pins: %u,%u,%u,%u (activeLow=%u)",
+        RELAY_PINS[0], RELAY_PINS[1], RELAY_PINS[2], RELAY_PINS[3],
+        (unsigned)RELAY_ACTIVE_LOW);
+
+  begin();
+
+  char macs[24]; macToStr(masterMac_, macs, sizeof(macs));
+  DBGLN("MASTER_MAC=%s (fixed=%u)", macs, (unsigned)USE_FIXED_MASTER_MAC);
+
+  // Finché non arriva HELLO, non consideriamo il canale "pronto"
+  channelReady_ = false;
+
+  if (!initEspNowOnChannel(1)) DBGLN("ESP-NOW init FAIL (ch=1)");
+  else DBGLN("ESP-NOW init OK (ch=1)");
+
+  int8_t lockedChannel = hal_.rtcLockedChannel();
+  if (lockedChannel < 1 || lockedChannel > 13) {
+    DBGLN("AUTO CH: scanning (waiting HELLO)...");
+    if (!findChannelFromHello(7000)) {
+      DBGLN("AUTO CH: not found -> fallback ch=1");
+      hal_.rtcSetLockedChannel(1);
+    } else {
+      DBGLN("AUTO CH: locked=%d", (int)hal_.rtcLockedChannel());
+    }
+    lockedChannel = hal_.rtcLockedChannel();
+  } else {
+    DBGLN("AUTO CH: using locked=%d", (int)lockedChannel);
+  }
+
+  hal_.radioEnd();
+  hal_.delayMs(30);
+
+  if (!initEspNowOnChannel((uint8_t)lockedChannel)) DBGLN("ESP-NOW init FAIL (locked)");
+  else DBGLN("ESP-NOW init OK (locked ch=%d)", (int)lockedChannel);
+
+  // NON mando state qui: deve avvenire dopo HELLO (così rispettiamo "prima agganciati al canale")
+  DBGLN("[BOOT] waiting HELLO to become channelReady...");
+}
+
+void PowerNode::loopOnce() {
+  if (mesh_.enabled()) {
+    //acceso prima dei vicini: la scansione del boot non ha trovato niente, si riprova di continuo
+    if (!channelReady_ && scanPoll() != SCAN_RUNNING) scanStart(MESH_RESCAN_MS);
+    if (channelReady_) mesh_.poll(curChannel_, hal_.millis());
+  }
+
+  // Avanza il tempo "a spanne" se non arrivano sync (per non perdere le regole nel tempo)
+  if (timeValid_) {
+    uint32_t now = hal_.millis();
+    uint32_t elapsed = now - lastTimeSyncMs_;
+
+    if (elapsed >= 60000UL) {
+      uint32_t addMin = elapsed / 60000UL;
+      lastTimeSyncMs_ += addMin * 60000UL;
+      if (cap_) captureRecord(CAP_TICK, nullptr, 0);
+
+      uint32_t total = (uint32_t)curMinOfDay_ + addMin;
+      curWeekday_  = (curWeekday_ + (total / 1440UL)) % 7;
+      curMinOfDay_ = total % 1440UL;
+
+      DBGLN("[TICK] +%lu min -> min=%u wd=%u",
+            (unsigned long)addMin, (unsigned)curMinOfDay_, (unsigned)curWeekday_);
+
+      bool changed = applyRulesExactNow(true);
+      if (changed) sendStateToMaster();
+    }
+  }
+}
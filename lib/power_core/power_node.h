@@ -0,0 +1,148 @@
+#pragma once
+/*
+  EVE-POWER - logica del nodo POWER (relè slave)
+  Stato, protocollo, schedulazioni e persistenza, senza dipendenze dall'hardware:
+  tutto passa dalla PowerHal. Ogni istanza è un nodo completo (il simulatore
+  ne fa girare tante nello stesso processo).
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include "power_capture.h"
+#include "power_hal.h"
+#include "power_mesh.h"
+#include "power_protocol.h"
+
+// ===================== DEBUG =====================
+//attivare i messaggi di debug quando testi   DBG_ENABLED 1
+//disattivarli quando il sistema gira normalmente DBG_ENABLED 0 //quando è disabilitato il compilatore rimuove il codice di stampa
+#ifndef DBG_ENABLED
+#define DBG_ENABLED 1       //ABILITA LOG
+#endif
+
+// ===================== MASTER MAC =====================
+// Se vuoi fissare il MAC del master (consigliato per debug), metti 1 e compila con il MAC corretto.
+#ifndef USE_FIXED_MASTER_MAC
+#define USE_FIXED_MASTER_MAC 1 //se 1 accetta solo dal mac master inserito se 0 impara il MAC e lo impara con masterMacValid
+#endif
+
+// ===================== RELAY =====================
+static const uint8_t RELAY_COUNT = 4;               //numero di rele
+static const uint8_t RELAY_PINS[RELAY_COUNT] = {2, 4, 5, 6};  //pin rele
+static const bool RELAY_ACTIVE_LOW = true;
+/* RELAY_ACTIVE_LOW indica lo stato di funzionamennto del rele
+se il pin = ON → LOW → il modulo relè si ATTIVA
+se il pin = OFF → HIGT(3.5/5V) → il modulo relè si SPEGNE
+*/
+
+static const uint8_t DEFAULT_MASTER_MAC[6] = { 0x0C,0x4E,0xA0,0x30,0x37,0x20 }; // MAC MASTER
+
+class PowerNode {
+public:
+  //esito della scansione canali non bloccante (scanPoll)
+  enum ScanResult { SCAN_RUNNING = 0, SCAN_FOUND, SCAN_NOT_FOUND };
+
+  explicit PowerNode(PowerHal& hal);
+
+  // ===================== SETUP / LOOP =====================
+  //boot completo (NVS, relè, ricerca canale, ESP-NOW). Bloccante come il setup() originale.
+  void setup();
+  //un giro di loop() senza il delay finale
+  void loopOnce();
+
+  //parti del boot, usate anche da test e simulatore
+  void begin();                          //NVS + MAC master + regole + relè
+  bool initEspNowOnChannel(uint8_t ch);
+  bool findChannelFromHello(uint32_t maxMs = 7000);
+  void scanStart(uint32_t maxMs);
+  ScanResult scanPoll();
+
+  // ===================== PROTOCOLLO =====================
+  void onEspNowRecv(const uint8_t* srcMac, const uint8_t* data, int len);
+  bool applyRulesExactNow(bool notifyExecuted);
+
+  // ===================== STATO (sola lettura) =====================
+  uint8_t relayMask() const { return relayMask_; }
+  bool relayMaskGet(uint8_t ch) const { return (relayMask_ >> (ch - 1)) & 0x01; }
+  bool timeValid() const { return timeValid_; }
+  uint16_t minuteOfDay() const { return curMinOfDay_; }
+  uint8_t weekday() const { return curWeekday_; }
+  bool channelReady() const { return channelReady_; }
+  uint8_t channel() const { return curChannel_; }
+  uint8_t ruleCount(uint8_t ch1to4) const { return ruleCount_[ch1to4 - 1]; }
+  const RelayRuleBin& rule(uint8_t ch1to4, uint8_t k) const { return rules_[ch1to4 - 1][k]; }
+  const uint8_t* masterMac() const { return masterMac_; }
+
+  // ===================== CATTURA =====================
+  //registra RX/TX nel ring (nullptr = spenta). begin() scrive BOOT + SNAP.
+  void attachCapture(PowerCapture* cap) { cap_ = cap; }
+  void snapshot(PowerCaptureSnap& s) const;
+  //solo replay: rimette stato e relè come nello SNAP (niente NVS)
+  void restore(const PowerCaptureSnap& s);
+
+  // ===================== MULTI-HOP =====================
+  //inoltro per i vicini fuori portata dal master (vedi power_mesh.h). Spento di default:
+  //senza enableMesh BEACON e buste arrivano alla logica come pacchetti sconosciuti e vengono ignorati.
+  void enableMesh(const PowerMeshConfig& cfg = PowerMeshConfig());
+  const PowerMesh& mesh() const { return mesh_; }
+  //sull'ESP32 ricezione e loop sono task diversi: il lock protegge le tabelle del multi-hop
+  void setMeshLock(PowerMesh::LockFn fn, void* ctx) { mesh_.setLock(fn, ctx); }
+
+private:
+  static void recvTrampoline(void* ctx, const uint8_t* srcMac, const uint8_t* data, int len);
+  static void meshDeliver(void* ctx, const uint8_t* data, int len);
+  bool meshRecv(const uint8_t* srcMac, const uint8_t* data, int len);
+
+  // relè
+  void relayWrite(uint8_t ch1to4, bool on);
+  void relayMaskSet(uint8_t ch, bool on);
+  void relaysInitAndRestore();
+
+  // NVS
+  void saveRelayMask();
+  bool saveRules(uint8_t ch1to4);
+  void loadRulesAll();
+  void storeMasterMac(const uint8_t* mac);
+  void loadMasterMac();
+  bool masterMacValid() const;
+
+  // invio verso il master
+  int sendToMaster(const void* pkt, size_t len, bool capture = true);
+  void captureRecord(uint8_t kind, const void* a, size_t alen, const void* b = nullptr, size_t blen = 0);
+  void captureFrame(uint8_t kind, const uint8_t* mac, const void* data, size_t len, int status);
+  void ensureMasterPeer(uint8_t ch);
+  void sendHelloAckToMaster(uint8_t ch, bool ok = true, bool capture = true);
+  void sendErrorToMaster(uint8_t code, uint8_t ch = 0, uint8_t extra = 0);
+  void sendStateToMaster(bool capture = true);
+  void sendScheduleAckToMaster(uint8_t ch1to4, uint8_t count, bool ok = true);
+  void sendExecutedToMaster(uint8_t ch1to4, bool on);
+
+  PowerHal& hal_;
+
+  uint8_t masterMac_[6];
+
+  volatile bool gotHello_;      //“ho ricevuto un pacchetto HELLO?”
+  volatile uint8_t helloCh_;    //“che canale mi ha detto il master nel HELLO?”
+  volatile bool channelReady_;  // finché non ricevo HELLO, ignoro tutto
+  uint8_t curChannel_;
+
+  uint8_t relayMask_;           //bit0 = relè1 ... bit3 = relè4
+
+  //Tempo ricevuto dal master
+  bool timeValid_;
+  uint16_t curMinOfDay_;        //minuto del giorno (0..1439)
+  uint8_t curWeekday_;          //giorno della settimana (0..6)
+  uint32_t lastTimeSyncMs_;     //quando è arrivata l’ultima sincronizzazione, in millis()
+
+  RelayRuleBin rules_[RELAY_COUNT][MAX_RULES];
+  uint8_t ruleCount_[RELAY_COUNT];
+
+  //stato della scansione canali
+  uint32_t scanStartMs_;
+  uint32_t scanMaxMs_;
+  uint32_t scanDwellMs_;
+  uint8_t scanCh_;
+
+  PowerCapture* cap_;
+  PowerMesh mesh_;
+};
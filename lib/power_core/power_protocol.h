@@ -0,0 +1,154 @@
+#pragma once
+/*
+  EVE-POWER - protocollo ESP-NOW POWER <-> MASTER
+  Tipi di pacchetto e strutture binarie (packed) scambiate sul filo.
+  Header condiviso tra firmware, build host (native) e tool Linux:
+  NON deve includere niente di Arduino/ESP-IDF.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ===================== Tipi di pacchetto POWER =====================
+//Mappa che ESP-NOW usa il primo byte del pacchetto per dire che tipo di messaggio è.
+static const uint8_t HELLO_TYPE         = 2;
+static const uint8_t PWR_HELLO_ACK_TYPE = 3;  // ACK "canale ricevuto e agganciato"
+static const uint8_t PWR_CMD_TYPE       = 10; //CMD : comandi manuali ai relè (bitmask)
+static const uint8_t PWR_STATE_TYPE     = 12; //STATE: lo slave invia stato al master
+static const uint8_t PWR_TIME_TYPE      = 13; //TIME: il master invia ora (minuto del giorno + weekday)
+static const uint8_t PWR_RELAYRULE_TYPE = 14; //RULES: il master invia schedulazioni per un relè
+static const uint8_t PWR_SCHED_ACK_TYPE = 15; //ACK: lo slave conferma “schedulazioni salvate”
+static const uint8_t PWR_EXECUTED_TYPE  = 16; //EXECUTED: lo slave avvisa “ho eseguito una regole
+static const uint8_t PWR_ERROR_TYPE     = 17; //errore (es. NVS save fallita)
+//multi-hop (power_mesh.h): solo i nodi con l'inoltro attivo li guardano, gli altri li ignorano
+static const uint8_t PWR_MESH_BEACON_TYPE = 20; //BEACON: "ho una rotta verso il master a N hop"
+static const uint8_t PWR_MESH_DATA_TYPE   = 21; //busta multi-hop: header + pacchetto POWER
+static const uint8_t PWR_MESH_ACK_TYPE    = 22; //ACK end-to-end di una busta (solo header)
+
+//codici del pacchetto ERROR
+static const uint8_t PWR_ERR_NVS_SAVE_FAIL = 1;
+static const uint8_t PWR_ERR_INVALID_CH    = 2;
+
+static const uint8_t MAX_RULES = 10; //numero massimo di schedulazioni per relè
+
+// ===================== PACKETS =====================
+#pragma pack(push, 1)
+
+//struttura del messggio HELLO aggancia” il canale WiFi del master
+typedef struct {
+  uint8_t type;   // 2 = hello
+  uint8_t ch;     // canale wifi dove orpera il master
+  uint32_t ms;    //millis del master (solo debug)
+} HelloPacket;
+
+//ACK a HELLO ("ok ho ricevuto il canale")
+typedef struct {
+  uint8_t type;   // 3 = hello_ack
+  uint8_t ch;     // canale agganciato
+  uint8_t ok;     // 1 ok
+  uint32_t ms;    // debug
+} HelloAckPacket;
+
+//CMD: comandi manuali rele
+typedef struct {
+  uint8_t type;
+  uint8_t maskSet;          //: quali relè devo toccare (bit 0..3) maskSet=0b0011 vuol dire “aggiorna relè 1 e 2”  maskVal=0b0001 vuol dire “relè1 ON, relè2 OFF”
+  uint8_t maskVal;          //: a che valore metterli (bit 0..3)
+  uint8_t applyNow;         //non usato al momento
+  uint32_t ms;              // debug
+} PowerCmdPacket;
+
+//Struttura schedulazione
+typedef struct {
+  uint16_t minuteOfDay; // 0..1439  ora * 60 + minuti --- Esempio se impostiamo 07:00 === 7*60 +0 = 420 oppure  23:59 === 23*60 + 59 = 1439
+  uint8_t  on;          // 1=ON 0=OFF
+  uint8_t  daysMask;    // bit0..6 lun..dom (lun=0, mar=1,......,dom=6)
+} RelayRuleBin;
+
+//RULES: regole per un singolo relè (ch)
+typedef struct {
+  uint8_t type;
+  uint8_t ch;     // 1..4 //numero del rele
+  uint8_t count;  // 0..10    //numero di schedulazioni (regole RULES)
+  RelayRuleBin rules[MAX_RULES]; //è sempre presente ma usiamo solo le prime count
+  uint32_t ms;
+} PowerRelayRulesPacket;
+
+//STATE: lo slave invia stato al master
+typedef struct {
+  uint8_t type;
+  uint8_t relayMask;
+  uint8_t timeValid;
+  uint8_t resetReason;
+  uint32_t ms;
+} PowerStatePacket; //manda mask relè, se ora è valida, reset reason
+
+//TIME: il master invia ora (minuto del giorno + weekday)
+typedef struct {
+  uint8_t type;
+  uint16_t minuteOfDay;
+  uint8_t weekdayMon0;
+  uint8_t valid;
+  uint32_t ms;
+} PowerTimePacket; // master → slave: minuto del giorno + weekday
+
+//ACK: lo slave conferma “schedulazioni salvate”
+typedef struct {
+  uint8_t type;
+  uint8_t ch;
+  uint8_t ok;
+  uint8_t count;
+  uint32_t ms;
+} PowerScheduleAckPacket; //slave → master: “regole salvate ok”
+
+//EXECUTED: lo slave avvisa “ho eseguito una regola”
+typedef struct {
+  uint8_t type;
+  uint8_t ch;
+  uint8_t state;
+  uint16_t minuteOfDay;
+  uint8_t weekdayMon0;
+  uint32_t ms;
+} PowerExecutedPacket;    //slave → master: “ho eseguito regola X”
+
+//messaggio di errore (compact)
+typedef struct {
+  uint8_t type;     // 17
+  uint8_t code;     // 1=NVS_SAVE_FAIL, 2=INVALID_CH, ecc...
+  uint8_t ch;       // rele coinvolto (1..4) o 0
+  uint8_t extra;    // info extra (opzionale)
+  uint32_t ms;
+} PowerErrorPacket;
+
+//BEACON multi-hop (broadcast): come HELLO aggancia il canale, in più dice quanti hop mancano al master
+typedef struct {
+  uint8_t type;       // 20
+  uint8_t ch;         // canale del master
+  uint8_t hops;       // hop del mittente verso il master (1 = lo sente direttamente)
+  uint8_t master[6];  // MAC del master (per chi non lo sente mai)
+  uint32_t ms;
+} PowerMeshBeaconPacket;
+
+//header della busta multi-hop: DATA (seguito dal pacchetto POWER) o ACK (nient'altro)
+typedef struct {
+  uint8_t type;       // 21 DATA / 22 ACK
+  uint8_t flags;      // MESH_UP, MESH_WANT_ACK, tentativo nei 4 bit alti
+  uint8_t ttl;        // hop che restano, chi lo riceve a 1 non inoltra
+  uint8_t hops;       // hop già fatti
+  uint8_t node[6];    // il nodo POWER: mittente se va verso il master, destinatario se scende
+  uint16_t seq;       // per nodo e direzione: duplicati e ACK
+} PowerMeshHeader;
+#pragma pack(pop)
+
+// Il POWER riconosce i pacchetti dalla lunghezza: se cambia una struct cambia il protocollo.
+static_assert(sizeof(HelloPacket) == 6, "HelloPacket: dimensione sul filo cambiata");
+static_assert(sizeof(HelloAckPacket) == 7, "HelloAckPacket: dimensione sul filo cambiata");
+static_assert(sizeof(PowerCmdPacket) == 8, "PowerCmdPacket: dimensione sul filo cambiata");
+static_assert(sizeof(PowerRelayRulesPacket) == 47, "PowerRelayRulesPacket: dimensione sul filo cambiata");
+static_assert(sizeof(PowerStatePacket) == 8, "PowerStatePacket: dimensione sul filo cambiata");
+static_assert(sizeof(PowerTimePacket) == 9, "PowerTimePacket: dimensione sul filo cambiata");
+static_assert(sizeof(PowerScheduleAckPacket) == 8, "PowerScheduleAckPacket: dimensione sul filo cambiata");
+static_assert(sizeof(PowerExecutedPacket) == 10, "PowerExecutedPacket: dimensione sul filo cambiata");
+static_assert(sizeof(PowerErrorPacket) == 8, "PowerErrorPacket: dimensione sul filo cambiata");
+static_assert(sizeof(PowerMeshBeaconPacket) == 13, "PowerMeshBeaconPacket: dimensione sul filo cambiata");
+static_assert(sizeof(PowerMeshHeader) == 12, "PowerMeshHeader: dimensione sul filo cambiata");
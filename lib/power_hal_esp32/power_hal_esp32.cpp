@@ -0,0 +1,100 @@
+#include "power_hal_esp32.h"
+
+#include <WiFi.h>
+#include <esp_now.h>
+#include <esp_random.h>
+#include <esp_wifi.h>
+
+RTC_DATA_ATTR int8_t lockedChannel = -1; //lockedChannel è il canale del master, che rimane sbloccato con -1 perche ancora lo deve imparare
+//il tipo RTC_DATA_ATTR dice all'esp32 questa variabile deve sopravvivere anche dopo il deep sleep
+
+//la callback di esp_now non ha un contesto: teniamo qui il destinatario (un solo nodo per chip)
+static PowerHal::RecvFn recvFn = nullptr;
+static void* recvCtx = nullptr;
+static int8_t lastRssi = 0; //RSSI del frame in consegna (radioRssi)
+
+static void onEspNowRecv(const esp_now_recv_info_t* info, const uint8_t* data, int len) {
+  if (!info || !recvFn) return;
+  lastRssi = info->rx_ctrl ? (int8_t)info->rx_ctrl->rssi : 0;
+  recvFn(recvCtx, info->src_addr, data, len);
+}
+
+//cambia canale radio (serve il passaggio in promiscuous per forzarlo)
+static void setWifiChannel(uint8_t ch) {
+  esp_wifi_set_promiscuous(true);
+  esp_wifi_set_channel(ch, WIFI_SECOND_CHAN_NONE);
+  esp_wifi_set_promiscuous(false);
+}
+
+// ===================== TEMPO =====================
+uint32_t PowerHalEsp32::millis() { return ::millis(); }
+void PowerHalEsp32::delayMs(uint32_t ms) { ::delay(ms); }
+
+// ===================== GPIO =====================
+void PowerHalEsp32::pinOutput(uint8_t pin) { pinMode(pin, OUTPUT); }
+void PowerHalEsp32::pinWrite(uint8_t pin, bool level) { digitalWrite(pin, level); }
+
+// ===================== NVS =====================
+bool PowerHalEsp32::nvsBegin(const char* ns) { return prefs_.begin(ns, false); }
+uint8_t PowerHalEsp32::nvsGetUChar(const char* key, uint8_t def) { return prefs_.getUChar(key, def); }
+size_t PowerHalEsp32::nvsPutUChar(const char* key, uint8_t v) { return prefs_.putUChar(key, v); }
+size_t PowerHalEsp32::nvsGetBytes(const char* key, void* buf, size_t len) { return prefs_.getBytes(key, buf, len); }
+size_t PowerHalEsp32::nvsPutBytes(const char* key, const void* buf, size_t len) { return prefs_.putBytes(key, buf, len); }
+
+// ===================== RADIO =====================
+bool PowerHalEsp32::radioBegin(uint8_t ch, RecvFn fn, void* ctx) {
+  WiFi.mode(WIFI_STA);
+  delay(20);
+
+  esp_wifi_set_ps(WIFI_PS_NONE);
+  setWifiChannel(ch);
+
+  if (esp_now_init() != ESP_OK) return false;
+  recvFn = fn;
+  recvCtx = ctx;
+  esp_now_register_recv_cb(onEspNowRecv);
+  return true;
+}
+
+void PowerHalEsp32::radioEnd() { esp_now_deinit(); }
+
+void PowerHalEsp32::radioSetChannel(uint8_t ch) { setWifiChannel(ch); }
+
+int PowerHalEsp32::radioAddPeer(const uint8_t* mac) {
+  //Crea la struttura peer ESP-NOW
+  esp_now_peer_info_t peer = {};
+  memcpy(peer.peer_addr, mac, 6);
+  peer.channel = 0; //0 dice: usa il canale corrente non forzarne uno fisso
+  peer.encrypt = false;// non usare cifratura per ESP-NOW
+
+  //Rimuove il peer se esiste già perche ESP-NOW non accetta duplicati e lo riaggiunge
+  esp_now_del_peer(mac);
+  return (int)esp_now_add_peer(&peer);
+}
+
+int PowerHalEsp32::radioDelPeer(const uint8_t* mac) { return (int)esp_now_del_peer(mac); }
+
+int PowerHalEsp32::radioSend(const uint8_t* mac, const uint8_t* data, size_t len) {
+  return (int)esp_now_send(mac, data, len);
+}
+
+int8_t PowerHalEsp32::radioRssi() { return lastRssi; }
+
+void PowerHalEsp32::radioMac(uint8_t mac[6]) { esp_wifi_get_mac(WIFI_IF_STA, mac); }
+
+// ===================== SISTEMA =====================
+//“ dico al master perché mi sono riavviato?”: se si è riavviato, se è crashato, se ha perso corrente
+uint8_t PowerHalEsp32::resetReason() { return (uint8_t)esp_reset_reason(); }
+
+int8_t PowerHalEsp32::rtcLockedChannel() { return lockedChannel; }
+void PowerHalEsp32::rtcSetLockedChannel(int8_t ch) { lockedChannel = ch; }
+
+//RNG hardware: con la radio accesa è rumore vero
+uint32_t PowerHalEsp32::randomU32() { return esp_random(); }
+
+// ===================== LOG =====================
+void PowerHalEsp32::logv(const char* fmt, va_list ap) {
+  char buf[256];
+  vsnprintf(buf, sizeof(buf), fmt, ap);
+  log_.print(buf);
+}
@@ -0,0 +1,47 @@
+#pragma once
+/*
+  EVE-POWER - HAL per ESP32 (Arduino + ESP-IDF)
+  digitalWrite, Preferences, esp_now_*, esp_wifi_*, millis(): tutto quello che
+  prima stava direttamente in main.cpp.
+*/
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include "power_hal.h"
+
+class PowerHalEsp32 : public PowerHal {
+public:
+  explicit PowerHalEsp32(Print& log) : log_(log) {}
+
+  uint32_t millis() override;
+  void delayMs(uint32_t ms) override;
+
+  void pinOutput(uint8_t pin) override;
+  void pinWrite(uint8_t pin, bool level) override;
+
+  bool    nvsBegin(const char* ns) override;
+  uint8_t nvsGetUChar(const char* key, uint8_t def) override;
+  size_t  nvsPutUChar(const char* key, uint8_t v) override;
+  size_t  nvsGetBytes(const char* key, void* buf, size_t len) override;
+  size_t  nvsPutBytes(const char* key, const void* buf, size_t len) override;
+
+  bool radioBegin(uint8_t ch, RecvFn fn, void* ctx) override;
+  void radioEnd() override;
+  void radioSetChannel(uint8_t ch) override;
+  int  radioAddPeer(const uint8_t* mac) override;
+  int  radioDelPeer(const uint8_t* mac) override;
+  int  radioSend(const uint8_t* mac, const uint8_t* data, size_t len) override;
+  int8_t radioRssi() override;
+  void radioMac(uint8_t mac[6]) override;
+
+  uint8_t resetReason() override;
+  int8_t rtcLockedChannel() override;
+  void   rtcSetLockedChannel(int8_t ch) override;
+  uint32_t randomU32() override;
+
+  void logv(const char* fmt, va_list ap) override;
+
+private:
+  Print& log_;
+  Preferences prefs_;
+};
@@ -0,0 +1,155 @@
+#include "power_hal_host.h"
+
+#include <stdio.h>
+#include <string.h>
+
+//codici esp_err_t usati dal firmware (valori di ESP-IDF)
+static const int HOST_ESP_OK = 0;
+static const int HOST_ESP_ERR_ESPNOW_NOT_INIT = 0x3065;
+static const int HOST_ESP_ERR_ESPNOW_NO_MEM = 0x3067;
+static const int HOST_ESP_ERR_ESPNOW_FULL = 0x3068;
+static const int HOST_ESP_ERR_ESPNOW_NOT_FOUND = 0x3069;
+
+//seme diverso per ogni HAL creata (stessa sequenza a ogni esecuzione del processo)
+static uint32_t nextSeed() {
+  static uint32_t n = 0;
+  return 0x9E3779B9u * ++n;
+}
+
+PowerHalHost::PowerHalHost()
+  : nowMs_(0), pinWrites_(0),
+    nvsWriteFail_(false), nvsWrites_(0),
+    recvFn_(nullptr), recvCtx_(nullptr), radioUp_(false), channel_(1), sendResult_(HOST_ESP_OK), rssi_(0),
+    resetReason_(1 /*ESP_RST_POWERON*/), rtcChannel_(-1), rng_(nextSeed()), verbose_(false) {
+  memset(pinLevel_, 0, sizeof(pinLevel_));
+  memset(pinOutput_, 0, sizeof(pinOutput_));
+  static const uint8_t DEFAULT_MAC[6] = { 0x24, 0x0A, 0xC4, 0xFF, 0xFF, 0x01 };
+  memcpy(mac_, DEFAULT_MAC, 6);
+}
+
+// ===================== GPIO =====================
+void PowerHalHost::pinOutput(uint8_t pin) { pinOutput_[pin & 0x3F] = true; }
+
+void PowerHalHost::pinWrite(uint8_t pin, bool level) {
+  pinLevel_[pin & 0x3F] = level;
+  pinWrites_++;
+}
+
+// ===================== NVS =====================
+bool PowerHalHost::nvsBegin(const char* ns) {
+  ns_ = ns;
+  return true;
+}
+
+uint8_t PowerHalHost::nvsGetUChar(const char* key, uint8_t def) {
+  std::map<std::string, std::vector<uint8_t> >::const_iterator it = nvs_.find(nvsKey(key));
+  if (it == nvs_.end() || it->second.size() != 1) return def;
+  return it->second[0];
+}
+
+size_t PowerHalHost::nvsPutUChar(const char* key, uint8_t v) {
+  return nvsPutBytes(key, &v, 1);
+}
+
+//come Preferences::getBytes: 0 se la chiave manca o il buffer è troppo piccolo
+size_t PowerHalHost::nvsGetBytes(const char* key, void* buf, size_t len) {
+  std::map<std::string, std::vector<uint8_t> >::const_iterator it = nvs_.find(nvsKey(key));
+  if (it == nvs_.end()) return 0;
+  const std::vector<uint8_t>& v = it->second;
+  if (!buf) return v.size();
+  if (len < v.size()) return 0;
+  memcpy(buf, v.data(), v.size());
+  return v.size();
+}
+
+size_t PowerHalHost::nvsPutBytes(const char* key, const void* buf, size_t len) {
+  if (nvsWriteFail_ || ns_.empty() || !buf || len == 0) return 0;
+  const uint8_t* p = (const uint8_t*)buf;
+  nvs_[nvsKey(key)] = std::vector<uint8_t>(p, p + len);
+  nvsWrites_++;
+  return len;
+}
+
+bool PowerHalHost::nvsHas(const char* key) const {
+  return nvs_.find(nvsKey(key)) != nvs_.end();
+}
+
+// ===================== RADIO =====================
+bool PowerHalHost::radioBegin(uint8_t ch, RecvFn fn, void* ctx) {
+  channel_ = ch;
+  recvFn_ = fn;
+  recvCtx_ = ctx;
+  radioUp_ = true;
+  peers_.clear();
+  return true;
+}
+
+void PowerHalHost::radioEnd() {
+  radioUp_ = false;
+  recvFn_ = nullptr;
+  recvCtx_ = nullptr;
+  peers_.clear();
+}
+
+int PowerHalHost::radioAddPeer(const uint8_t* mac) {
+  if (!radioUp_) return HOST_ESP_ERR_ESPNOW_NOT_INIT;
+  for (size_t i = 0; i < peers_.size(); i++) {
+    if (memcmp(peers_[i].data(), mac, 6) == 0) return HOST_ESP_OK;
+  }
+  if (peers_.size() >= HOST_ESP_NOW_MAX_PEERS) return HOST_ESP_ERR_ESPNOW_FULL;
+  peers_.push_back(std::vector<uint8_t>(mac, mac + 6));
+  return HOST_ESP_OK;
+}
+
+int PowerHalHost::radioDelPeer(const uint8_t* mac) {
+  if (!radioUp_) return HOST_ESP_ERR_ESPNOW_NOT_INIT;
+  for (size_t i = 0; i < peers_.size(); i++) {
+    if (memcmp(peers_[i].data(), mac, 6) != 0) continue;
+    peers_.erase(peers_.begin() + i);
+    return HOST_ESP_OK;
+  }
+  return HOST_ESP_ERR_ESPNOW_NOT_FOUND;
+}
+
+int PowerHalHost::radioSend(const uint8_t* mac, const uint8_t* data, size_t len) {
+  if (!radioUp_) return HOST_ESP_ERR_ESPNOW_NOT_INIT;
+
+  bool known = false;
+  for (size_t i = 0; i < peers_.size() && !known; i++) {
+    known = memcmp(peers_[i].data(), mac, 6) == 0;
+  }
+  if (!known) return HOST_ESP_ERR_ESPNOW_NOT_FOUND;
+  if (sendResult_ != HOST_ESP_OK) return sendResult_;
+
+  Frame f;
+  memcpy(f.mac, mac, 6);
+  f.data.assign(data, data + len);
+  f.ms = nowMs_;
+  f.ch = channel_;
+  return transmit(f) ? HOST_ESP_OK : HOST_ESP_ERR_ESPNOW_NO_MEM;
+}
+
+void PowerHalHost::radioMac(uint8_t mac[6]) { memcpy(mac, mac_, 6); }
+
+void PowerHalHost::setMac(const uint8_t* mac) { memcpy(mac_, mac, 6); }
+
+bool PowerHalHost::deliver(const uint8_t* srcMac, const void* data, size_t len, int8_t rssi) {
+  if (!radioUp_ || !recvFn_) return false;
+  rssi_ = rssi;
+  recvFn_(recvCtx_, srcMac, (const uint8_t*)data, (int)len);
+  return true;
+}
+
+// ===================== SISTEMA =====================
+uint32_t PowerHalHost::randomU32() {
+  rng_ ^= rng_ << 13;
+  rng_ ^= rng_ >> 17;
+  rng_ ^= rng_ << 5;
+  return rng_;
+}
+
+// ===================== LOG =====================
+void PowerHalHost::logv(const char* fmt, va_list ap) {
+  if (!verbose_) return;
+  vprintf(fmt, ap);
+}
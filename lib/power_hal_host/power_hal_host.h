@@ -0,0 +1,128 @@
+#pragma once
+/*
+  EVE-POWER - HAL in memoria per Linux (build native)
+  - tempo virtuale: millis() parte da 0 e avanza solo con delayMs()/advance()
+  - GPIO: registra il livello di ogni pin
+  - NVS: mappa chiave -> bytes, con possibilità di far fallire le scritture
+  - radio: i pacchetti inviati finiscono in sent(), quelli ricevuti si iniettano con deliver();
+    la tabella peer ha lo stesso limite di ESP-NOW (HOST_ESP_NOW_MAX_PEERS)
+  Nessun hardware necessario: la usano i test, il simulatore e i tool host.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "power_hal.h"
+
+//ESP_NOW_MAX_TOTAL_PEER_NUM di ESP-IDF
+static const size_t HOST_ESP_NOW_MAX_PEERS = 20;
+
+class PowerHalHost : public PowerHal {
+public:
+  struct Frame {
+    uint8_t mac[6];              //destinatario (TX) o sorgente (RX)
+    std::vector<uint8_t> data;
+    uint32_t ms;                 //millis() al momento dell'invio
+    uint8_t ch;                  //canale radio al momento dell'invio
+
+    uint8_t type() const { return data.empty() ? 0 : data[0]; }
+  };
+
+  PowerHalHost();
+
+  uint32_t millis() override { return nowMs_; }
+  void delayMs(uint32_t ms) override { nowMs_ += ms; }
+
+  void pinOutput(uint8_t pin) override;
+  void pinWrite(uint8_t pin, bool level) override;
+
+  bool    nvsBegin(const char* ns) override;
+  uint8_t nvsGetUChar(const char* key, uint8_t def) override;
+  size_t  nvsPutUChar(const char* key, uint8_t v) override;
+  size_t  nvsGetBytes(const char* key, void* buf, size_t len) override;
+  size_t  nvsPutBytes(const char* key, const void* buf, size_t len) override;
+
+  bool radioBegin(uint8_t ch, RecvFn fn, void* ctx) override;
+  void radioEnd() override;
+  void radioSetChannel(uint8_t ch) override { channel_ = ch; }
+  int  radioAddPeer(const uint8_t* mac) override;
+  int  radioDelPeer(const uint8_t* mac) override;
+  int  radioSend(const uint8_t* mac, const uint8_t* data, size_t len) override;
+  int8_t radioRssi() override { return rssi_; }
+  void radioMac(uint8_t mac[6]) override;
+
+  uint8_t resetReason() override { return resetReason_; }
+  int8_t rtcLockedChannel() override { return rtcChannel_; }
+  void   rtcSetLockedChannel(int8_t ch) override { rtcChannel_ = ch; }
+  uint32_t randomU32() override;
+
+  void logv(const char* fmt, va_list ap) override;
+
+  // ===================== CONTROLLO DAL TEST / TOOL =====================
+  void advance(uint32_t ms) { nowMs_ += ms; }
+  void setMillis(uint32_t ms) { nowMs_ = ms; }
+
+  //consegna un pacchetto alla callback ESP-NOW (solo se la radio è avviata), con l'RSSI visto dal nodo
+  bool deliver(const uint8_t* srcMac, const void* data, size_t len, int8_t rssi = -50);
+  template <typename T> bool deliver(const uint8_t* srcMac, const T& pkt) { return deliver(srcMac, &pkt, sizeof(pkt)); }
+
+  const std::vector<Frame>& sent() const { return sent_; }
+  void clearSent() { sent_.clear(); }
+
+  bool pinLevel(uint8_t pin) const { return pinLevel_[pin & 0x3F]; }
+  bool pinIsOutput(uint8_t pin) const { return pinOutput_[pin & 0x3F]; }
+  uint32_t pinWrites() const { return pinWrites_; }
+
+  bool radioUp() const { return radioUp_; }
+  size_t peerCount() const { return peers_.size(); }
+  uint8_t radioChannel() const { return channel_; }
+  void setMac(const uint8_t* mac);
+
+  //NVS: simula flash piena / guasta (put* ritornano 0)
+  void setNvsWriteFail(bool fail) { nvsWriteFail_ = fail; }
+  void nvsErase() { nvs_.clear(); }
+  bool nvsHas(const char* key) const;
+  uint32_t nvsWrites() const { return nvsWrites_; }
+
+  void setResetReason(uint8_t r) { resetReason_ = r; }
+  //randomU32 è uno xorshift: ogni chiamata (e ogni HAL) dà un valore nuovo, ma ripetibile
+  void setRandomSeed(uint32_t seed) { rng_ = seed ? seed : 1; }
+  void setSendResult(int e) { sendResult_ = e; }
+  void setVerbose(bool v) { verbose_ = v; }
+
+protected:
+  //destinazione dei pacchetti accettati da radioSend: di default finiscono in sent(),
+  //il simulatore la ridefinisce per metterli "in aria". false = coda TX piena (radioSend -> NO_MEM)
+  virtual bool transmit(const Frame& f) { sent_.push_back(f); return true; }
+
+private:
+  std::string nvsKey(const char* key) const { return ns_ + "/" + key; }
+
+  uint32_t nowMs_;
+
+  bool pinLevel_[64];
+  bool pinOutput_[64];
+  uint32_t pinWrites_;
+
+  std::string ns_;
+  std::map<std::string, std::vector<uint8_t> > nvs_;
+  bool nvsWriteFail_;
+  uint32_t nvsWrites_;
+
+  RecvFn recvFn_;
+  void* recvCtx_;
+  bool radioUp_;
+  uint8_t channel_;
+  std::vector<std::vector<uint8_t> > peers_;
+  std::vector<Frame> sent_;
+  int sendResult_;
+  int8_t rssi_;
+  uint8_t mac_[6];
+
+  uint8_t resetReason_;
+  int8_t rtcChannel_;
+  uint32_t rng_;
+  bool verbose_;
+};
@@ -0,0 +1,231 @@
+#include "power_replay.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+
+#include "power_hal_host.h"
+#include "power_node.h"
+
+// ===================== LETTURA =====================
+static int hexNibble(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+bool parseCaptureLine(const char* line, CaptureRecord& out) {
+  //la riga può avere davanti il timestamp del monitor seriale
+  const char* p = strstr(line, "CAP ");
+  if (!p) return false;
+  p += 4;
+
+  std::vector<uint8_t> b;
+  while (*p && *p != '\r' && *p != '\n') {
+    int hi = hexNibble(p[0]);
+    int lo = hexNibble(p[1]);
+    if (hi < 0 || lo < 0) return false;
+    b.push_back((uint8_t)(hi << 4 | lo));
+    p += 2;
+  }
+  if (b.size() < CAP_REC_HDR || b.size() != CAP_REC_HDR + b[1]) return false;
+
+  out.kind = b[0];
+  out.ms = (uint32_t)b[2] | (uint32_t)b[3] << 8 | (uint32_t)b[4] << 16 | (uint32_t)b[5] << 24;
+  out.payload.assign(b.begin() + CAP_REC_HDR, b.end());
+  return true;
+}
+
+bool loadCapture(const char* path, std::vector<CaptureRecord>& out, std::string& err) {
+  FILE* f = fopen(path, "r");
+  if (!f) { err = std::string("non riesco ad aprire ") + path; return false; }
+  out.clear();
+  char line[1024];
+  CaptureRecord r;
+  while (fgets(line, sizeof(line), f)) {
+    if (parseCaptureLine(line, r)) out.push_back(r);
+  }
+  fclose(f);
+  if (out.empty()) { err = "nessuna riga CAP nel file"; return false; }
+  return true;
+}
+
+static void collect(void* ctx, uint8_t kind, uint32_t ms, const uint8_t* payload, uint8_t len) {
+  CaptureRecord r;
+  r.kind = kind;
+  r.ms = ms;
+  r.payload.assign(payload, payload + len);
+  ((std::vector<CaptureRecord>*)ctx)->push_back(r);
+}
+
+void captureRecords(const PowerCapture& cap, std::vector<CaptureRecord>& out) {
+  out.clear();
+  cap.forEach(collect, &out);
+}
+
+// ===================== REPLAY =====================
+namespace {
+
+struct TxFrame {
+  uint32_t ms;
+  uint8_t mac[6];
+  std::vector<uint8_t> data;
+};
+
+std::string hexOf(const std::vector<uint8_t>& v) {
+  std::string s;
+  char b[4];
+  for (uint8_t x : v) { snprintf(b, sizeof(b), "%02X", x); s += b; }
+  return s;
+}
+
+//ogni pacchetto finisce con il campo ms (millis del nodo): non entra nel confronto
+bool sameFrame(const TxFrame& a, const TxFrame& b) {
+  if (memcmp(a.mac, b.mac, 6) != 0 || a.data.size() != b.data.size()) return false;
+  size_t n = a.data.size() >= 4 ? a.data.size() - 4 : a.data.size();
+  return memcmp(a.data.data(), b.data.data(), n) == 0;
+}
+
+class Segment {
+public:
+  Segment(const ReplayOptions& opt, ReplayResult& res) : res_(res), node_(hal_) { hal_.setVerbose(opt.verbose); }
+
+  void start(const CaptureRecord* boot, const CaptureRecord& snap) {
+    if (boot && boot->payload.size() >= 2) {
+      hal_.setResetReason(boot->payload[0]);
+      hal_.rtcSetLockedChannel((int8_t)boot->payload[1]);
+    }
+    PowerCaptureSnap s;
+    memcpy(&s, snap.payload.data(), sizeof(s));
+    hal_.setMillis(snap.ms);
+    node_.restore(s);
+    node_.initEspNowOnChannel(s.channel >= 1 && s.channel <= 13 ? s.channel : 1);
+    hal_.clearSent();
+  }
+
+  void step(const CaptureRecord& r) {
+    hal_.setMillis(r.ms);
+    switch (r.kind) {
+      case CAP_RX:
+        if (r.payload.size() > CAP_FRAME_HDR) {
+          res_.rx++;
+          hal_.deliver(r.payload.data(), r.payload.data() + CAP_FRAME_HDR, r.payload.size() - CAP_FRAME_HDR);
+        }
+        break;
+      case CAP_TX:
+        if (r.payload.size() > CAP_FRAME_HDR) {
+          TxFrame f;
+          f.ms = r.ms;
+          memcpy(f.mac, r.payload.data(), 6);
+          f.data.assign(r.payload.begin() + CAP_FRAME_HDR, r.payload.end());
+          expected_.push_back(f);
+          res_.txExpected++;
+        }
+        break;
+      case CAP_TICK:
+        node_.loopOnce();
+        break;
+      case CAP_SNAP:
+        if (r.payload.size() == sizeof(PowerCaptureSnap)) checkSnap(r);
+        break;
+      default:
+        break;
+    }
+    match();
+  }
+
+  void finish() {
+    match();
+    for (auto& e : expected_) diverge(e.ms, "TX atteso ma non prodotto: " + hexOf(e.data));
+    for (auto& p : produced_) diverge(p.ms, "TX prodotto ma non catturato: " + hexOf(p.data));
+  }
+
+private:
+  void match() {
+    const auto& sent = hal_.sent();
+    for (; sentSeen_ < sent.size(); sentSeen_++) {
+      TxFrame f;
+      f.ms = sent[sentSeen_].ms;
+      memcpy(f.mac, sent[sentSeen_].mac, 6);
+      f.data = sent[sentSeen_].data;
+      produced_.push_back(f);
+      res_.txProduced++;
+    }
+    while (!expected_.empty() && !produced_.empty()) {
+      TxFrame& e = expected_.front();
+      TxFrame& p = produced_.front();
+      if (!sameFrame(e, p)) {
+        diverge(e.ms, "TX diverso: atteso " + hexOf(e.data) + " prodotto " + hexOf(p.data));
+      } else {
+        int32_t skew = (int32_t)(p.ms - e.ms);
+        if (skew < 0) skew = -skew;
+        if (skew > res_.txMsMaxSkew) res_.txMsMaxSkew = skew;
+      }
+      expected_.pop_front();
+      produced_.pop_front();
+    }
+  }
+
+  void checkSnap(const CaptureRecord& r) {
+    PowerCaptureSnap want, got;
+    memcpy(&want, r.payload.data(), sizeof(want));
+    node_.snapshot(got);
+    res_.snapChecked++;
+
+    //lastTimeSyncMs: sul nodo millis() può scattare tra il record RX e il TIME applicato
+    int32_t d = (int32_t)(got.lastTimeSyncMs - want.lastTimeSyncMs);
+    bool timeOk = d >= -2 && d <= 2;
+    want.lastTimeSyncMs = got.lastTimeSyncMs = 0;
+    if (!timeOk || memcmp(&want, &got, sizeof(want)) != 0) {
+      res_.snapMismatch++;
+      char b[160];
+      snprintf(b, sizeof(b), "SNAP diverso: mask %u/%u time %u/%u min %u/%u wd %u/%u ready %u/%u",
+               want.relayMask, got.relayMask, want.timeValid, got.timeValid, want.minuteOfDay, got.minuteOfDay,
+               want.weekdayMon0, got.weekdayMon0, want.channelReady, got.channelReady);
+      if (res_.firstDivergence.empty()) res_.firstDivergence = "ms=" + std::to_string(r.ms) + " " + b;
+    }
+  }
+
+  void diverge(uint32_t ms, const std::string& what) {
+    res_.txMismatch++;
+    if (res_.firstDivergence.empty()) res_.firstDivergence = "ms=" + std::to_string(ms) + " " + what;
+  }
+
+  ReplayResult& res_;
+  PowerHalHost hal_;
+  PowerNode node_;
+  std::deque<TxFrame> expected_;
+  std::deque<TxFrame> produced_;
+  size_t sentSeen_ = 0;
+};
+
+}
+
+ReplayResult replayCapture(const std::vector<CaptureRecord>& recs, const ReplayOptions& opt) {
+  ReplayResult res;
+  size_t i = 0;
+  while (i < recs.size()) {
+    //segmento = da un BOOT (o dall'inizio) al BOOT successivo
+    size_t end = i + 1;
+    while (end < recs.size() && recs[end].kind != CAP_BOOT) end++;
+
+    const CaptureRecord* boot = recs[i].kind == CAP_BOOT ? &recs[i] : nullptr;
+    size_t k = boot ? i + 1 : i;
+    while (k < end && !(recs[k].kind == CAP_SNAP && recs[k].payload.size() == sizeof(PowerCaptureSnap))) {
+      res.skipped++;
+      k++;
+    }
+
+    if (k < end) {
+      res.segments++;
+      Segment seg(opt, res);
+      seg.start(boot, recs[k]);
+      for (size_t j = k + 1; j < end; j++) seg.step(recs[j]);
+      seg.finish();
+    }
+    i = end;
+  }
+  return res;
+}
@@ -0,0 +1,50 @@
+#pragma once
+/*
+  EVE-POWER - replay deterministico di una cattura (power_capture.h) sulla logica vera
+  Per ogni segmento (da un BOOT al successivo): riparte dal primo SNAP con un PowerNode
+  nuovo su PowerHalHost a tempo virtuale, consegna i frame RX agli stessi millis() della
+  cattura e chiama loopOnce() sui record TICK. I TX prodotti si confrontano con quelli
+  catturati (campo ms finale escluso), gli SNAP successivi con lo stato del nodo.
+  I guasti della HAL (NVS piena, esp_now_send fallita) non si rigiocano: se sul campo
+  sono successi, il replay li mostra come divergenza (es. SCHED_ACK ok=0 atteso, ok=1 prodotto).
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "power_capture.h"
+
+struct CaptureRecord {
+  uint8_t kind;
+  uint32_t ms;
+  std::vector<uint8_t> payload;
+};
+
+//riga "CAP <hex>" -> record (false per qualsiasi altra riga)
+bool parseCaptureLine(const char* line, CaptureRecord& out);
+//file di testo (dump o log seriale completo): prende solo le righe "CAP "
+bool loadCapture(const char* path, std::vector<CaptureRecord>& out, std::string& err);
+//dall'oggetto PowerCapture in memoria (test, node_host)
+void captureRecords(const PowerCapture& cap, std::vector<CaptureRecord>& out);
+
+struct ReplayOptions {
+  bool verbose = false;       //log del PowerNode su stdout
+};
+
+struct ReplayResult {
+  uint32_t segments = 0;
+  uint32_t skipped = 0;       //record prima del primo SNAP del segmento
+  uint32_t rx = 0;
+  uint32_t txExpected = 0;
+  uint32_t txProduced = 0;
+  uint32_t txMismatch = 0;
+  uint32_t snapChecked = 0;
+  uint32_t snapMismatch = 0;
+  int32_t txMsMaxSkew = 0;    //max |ms replay - ms catturato| sui TX uguali
+  std::string firstDivergence;
+
+  bool ok() const { return txMismatch == 0 && snapMismatch == 0; }
+};
+
+ReplayResult replayCapture(const std::vector<CaptureRecord>& recs, const ReplayOptions& opt = ReplayOptions());
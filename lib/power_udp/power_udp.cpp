@@ -0,0 +1,125 @@
+#include "power_udp.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+bool PowerUdpLink::open(uint16_t port) {
+  close();
+  fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd_ < 0) return false;
+
+  int one = 1;
+  setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  sockaddr_in a;
+  memset(&a, 0, sizeof(a));
+  a.sin_family = AF_INET;
+  a.sin_addr.s_addr = htonl(INADDR_ANY);
+  a.sin_port = htons(port);
+  if (bind(fd_, (const sockaddr*)&a, sizeof(a)) != 0) {
+    close();
+    return false;
+  }
+  fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL, 0) | O_NONBLOCK);
+  return true;
+}
+
+void PowerUdpLink::close() {
+  if (fd_ >= 0) ::close(fd_);
+  fd_ = -1;
+}
+
+uint16_t PowerUdpLink::localPort() const {
+  sockaddr_in a;
+  socklen_t l = sizeof(a);
+  if (fd_ < 0 || getsockname(fd_, (sockaddr*)&a, &l) != 0) return 0;
+  return ntohs(a.sin_port);
+}
+
+bool PowerUdpLink::send(const sockaddr_in& to, uint8_t kind, uint8_t ch,
+                        const uint8_t* src, const uint8_t* dst, const uint8_t* data, size_t len) {
+  if (fd_ < 0 || len > POWER_UDP_MAX_PAYLOAD) return false;
+
+  uint8_t buf[sizeof(PowerUdpHeader) + POWER_UDP_MAX_PAYLOAD];
+  PowerUdpHeader* h = (PowerUdpHeader*)buf;
+  h->magic[0] = POWER_UDP_MAGIC0;
+  h->magic[1] = POWER_UDP_MAGIC1;
+  h->version = POWER_UDP_VERSION;
+  h->kind = kind;
+  h->ch = ch;
+  memcpy(h->src, src, 6);
+  memcpy(h->dst, dst, 6);
+  h->len = (uint8_t)len;
+  if (len) memcpy(buf + sizeof(PowerUdpHeader), data, len);
+
+  ssize_t w = sendto(fd_, buf, sizeof(PowerUdpHeader) + len, 0, (const sockaddr*)&to, sizeof(to));
+  return w == (ssize_t)(sizeof(PowerUdpHeader) + len);
+}
+
+bool PowerUdpLink::recv(PowerUdpFrame& out) {
+  if (fd_ < 0) return false;
+
+  uint8_t buf[sizeof(PowerUdpHeader) + POWER_UDP_MAX_PAYLOAD + 1];
+  for (;;) {
+    socklen_t fl = sizeof(out.from);
+    ssize_t r = recvfrom(fd_, buf, sizeof(buf), 0, (sockaddr*)&out.from, &fl);
+    if (r < 0) return false; //EAGAIN: niente in coda
+
+    if (r < (ssize_t)sizeof(PowerUdpHeader)) continue;
+    memcpy(&out.hdr, buf, sizeof(PowerUdpHeader));
+    if (out.hdr.magic[0] != POWER_UDP_MAGIC0 || out.hdr.magic[1] != POWER_UDP_MAGIC1) continue;
+    if (out.hdr.version != POWER_UDP_VERSION) continue;
+    if ((size_t)r != sizeof(PowerUdpHeader) + out.hdr.len) continue;
+    memcpy(out.data, buf + sizeof(PowerUdpHeader), out.hdr.len);
+    return true;
+  }
+}
+
+bool PowerUdpLink::parseEndpoint(const char* s, sockaddr_in& out) {
+  const char* colon = strrchr(s, ':');
+  if (!colon) return false;
+  char host[128];
+  size_t hl = (size_t)(colon - s);
+  if (hl == 0 || hl >= sizeof(host)) return false;
+  memcpy(host, s, hl);
+  host[hl] = 0;
+  long port = strtol(colon + 1, nullptr, 10);
+  if (port <= 0 || port > 65535) return false;
+
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  struct addrinfo* res = nullptr;
+  if (getaddrinfo(host, nullptr, &hints, &res) != 0 || !res) return false;
+  memcpy(&out, res->ai_addr, sizeof(out));
+  out.sin_port = htons((uint16_t)port);
+  freeaddrinfo(res);
+  return true;
+}
+
+bool PowerUdpLink::isBroadcast(const uint8_t* mac) {
+  for (int i = 0; i < 6; i++) if (mac[i] != 0xFF) return false;
+  return true;
+}
+
+bool parseMac(const char* s, uint8_t* mac) {
+  unsigned v[6];
+  if (sscanf(s, "%x:%x:%x:%x:%x:%x", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) != 6) return false;
+  for (int i = 0; i < 6; i++) {
+    if (v[i] > 0xFF) return false;
+    mac[i] = (uint8_t)v[i];
+  }
+  return true;
+}
+
+void formatMac(const uint8_t* mac, char* out, size_t n) {
+  snprintf(out, n, "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
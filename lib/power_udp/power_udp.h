@@ -0,0 +1,70 @@
+#pragma once
+/*
+  EVE-POWER - trasporto UDP per le build host
+  Porta gli stessi frame ESP-NOW (i pacchetti di power_protocol.h) tra processi Linux:
+  bridge/master da una parte, nodi host (PowerNode + HAL UDP) dall'altra.
+
+  Datagramma = PowerUdpHeader + payload ESP-NOW.
+  - kind DATA  : frame ESP-NOW src -> dst sul canale ch (dst FF:..:FF = broadcast)
+  - kind BEACON: "sono in aria su ch" (nessun payload). I nodi lo mandano periodicamente
+                 così il master impara a quale endpoint UDP corrisponde ogni MAC,
+                 come se fossero nel raggio radio.
+  Il ricevitore scarta i DATA su un canale diverso dal suo: la scansione HELLO funziona come in aria.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+static const uint8_t POWER_UDP_MAGIC0 = 'E';
+static const uint8_t POWER_UDP_MAGIC1 = 'P';
+static const uint8_t POWER_UDP_VERSION = 1;
+static const uint8_t POWER_UDP_DATA = 0;
+static const uint8_t POWER_UDP_BEACON = 1;
+static const size_t POWER_UDP_MAX_PAYLOAD = 250; //limite di esp_now_send
+
+#pragma pack(push, 1)
+typedef struct {
+  uint8_t magic[2];
+  uint8_t version;
+  uint8_t kind;
+  uint8_t ch;
+  uint8_t src[6];
+  uint8_t dst[6];
+  uint8_t len;
+} PowerUdpHeader;
+#pragma pack(pop)
+
+struct PowerUdpFrame {
+  PowerUdpHeader hdr;
+  uint8_t data[POWER_UDP_MAX_PAYLOAD];
+  sockaddr_in from;
+};
+
+class PowerUdpLink {
+public:
+  PowerUdpLink() : fd_(-1) {}
+  ~PowerUdpLink() { close(); }
+
+  //bind su 0.0.0.0:port (0 = porta effimera), socket non bloccante
+  bool open(uint16_t port);
+  void close();
+  int fd() const { return fd_; }
+  uint16_t localPort() const;
+
+  bool send(const sockaddr_in& to, uint8_t kind, uint8_t ch,
+            const uint8_t* src, const uint8_t* dst, const uint8_t* data, size_t len);
+  //false se non c'è niente da leggere; i datagrammi malformati vengono scartati
+  bool recv(PowerUdpFrame& out);
+
+  //"host:porta" -> sockaddr_in (IPv4)
+  static bool parseEndpoint(const char* s, sockaddr_in& out);
+  static bool isBroadcast(const uint8_t* mac);
+
+private:
+  int fd_;
+};
+
+//"AA:BB:CC:DD:EE:FF" <-> 6 byte
+bool parseMac(const char* s, uint8_t* mac);
+void formatMac(const uint8_t* mac, char* out, size_t n);
@@ -0,0 +1,122 @@
+// Test host della suite di benchmark (lib/power_bench): casi, righe JSON, confronto.
+//   pio test -e native -f test_bench
+
+#include <unity.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "power_bench.h"
+#include "power_hal_host.h"
+#include "power_node.h"
+
+//contatore finto: ogni lettura avanza di 100, quindi ogni campione vale 100 / batch
+static uint32_t fakeNow;
+static uint32_t fakeCounter() { return fakeNow += 100; }
+
+static void collectLine(void* ctx, const char* line) { ((std::vector<std::string>*)ctx)->push_back(line); }
+
+static PowerHalHost* hal;
+static PowerNode* node;
+static std::vector<std::string> lines;
+
+static PowerBenchConfig fakeConfig() {
+  PowerBenchConfig cfg;
+  cfg.counter = fakeCounter;
+  cfg.unit = "cycles";
+  cfg.unitsPerUs = 100.0f;
+  cfg.samples = 5;
+  cfg.nvsSamples = 3;
+  cfg.batch = 4;
+  return cfg;
+}
+
+void setUp() {
+  fakeNow = 0;
+  lines.clear();
+  hal = new PowerHalHost();
+  node = new PowerNode(*hal);
+}
+
+void tearDown() {
+  delete node;
+  delete hal;
+}
+
+void test_every_case_emits_one_json_line() {
+  PowerBench bench(*hal, *node, fakeConfig(), collectLine, &lines);
+  bench.runAll();
+
+  static const char* NAMES[] = {
+    "rx_hello", "rx_cmd_toggle", "rx_cmd_nochange", "rx_rules", "rx_time", "rx_unknown", "loop_idle",
+    "apply_rules_0", "apply_rules_4", "apply_rules_8", "apply_rules_20", "apply_rules_40",
+    "nvs_save_relay_mask", "nvs_save_rules", "radio_send", "gpio_write",
+  };
+  const size_t n = sizeof(NAMES) / sizeof(NAMES[0]);
+  TEST_ASSERT_EQUAL_UINT32(n, lines.size());
+  TEST_ASSERT_EQUAL_UINT32(n, bench.cases());
+
+  char name[32], unit[16];
+  double p50 = 0;
+  for (size_t i = 0; i < n; i++) {
+    TEST_ASSERT_TRUE(parseBenchLine(lines[i].c_str(), "p50", name, sizeof(name), unit, sizeof(unit), p50));
+    TEST_ASSERT_EQUAL_STRING(NAMES[i], name);
+    TEST_ASSERT_EQUAL_STRING("cycles", unit);
+    TEST_ASSERT_TRUE(p50 == 25.0); //100 per campione / 4 chiamate
+  }
+  TEST_ASSERT_TRUE(lines[1].find("\"samples\":3") != std::string::npos);   //NVS: nvsSamples
+  TEST_ASSERT_TRUE(lines[11].find("\"rules\":40") != std::string::npos);
+  TEST_ASSERT_TRUE(lines[14].find("\"errors\":0") != std::string::npos);
+}
+
+void test_handlers_really_run_on_the_node() {
+  PowerBench bench(*hal, *node, fakeConfig(), collectLine, &lines);
+  bench.prepare();
+  TEST_ASSERT_TRUE(node->channelReady());
+  TEST_ASSERT_TRUE(node->timeValid());
+
+  uint32_t nvs = hal->nvsWrites();
+  bench.runHandlers();
+  //rx_cmd_toggle: 3 campioni x 4 chiamate, il relè 1 cambia sempre -> una scrittura relayMask ciascuna
+  //rx_rules: 12 chiamate x (rc1 + rb1)
+  TEST_ASSERT_EQUAL_UINT32(nvs + 12 + 24, hal->nvsWrites());
+  TEST_ASSERT_EQUAL_UINT8(MAX_RULES, node->ruleCount(1));
+  TEST_ASSERT_TRUE(hal->sent().size() > 0);
+}
+
+void test_rules_scaling_never_fires_a_rule() {
+  PowerBench bench(*hal, *node, fakeConfig(), collectLine, &lines);
+  bench.prepare();
+  uint8_t mask = node->relayMask();
+  bench.runRulesScaling();
+
+  //caso peggiore: tutte le regole scorse, nessuna eseguita
+  TEST_ASSERT_EQUAL_UINT8(mask, node->relayMask());
+  for (uint8_t ch = 1; ch <= RELAY_COUNT; ch++) TEST_ASSERT_EQUAL_UINT8(MAX_RULES, node->ruleCount(ch));
+  for (auto& f : hal->sent()) TEST_ASSERT_TRUE(f.type() != PWR_EXECUTED_TYPE);
+}
+
+void test_parse_bench_line() {
+  char name[32], unit[16];
+  double v = 0;
+  const char* line = "12:00:01.123 -> {\"bench\":\"rx_time\",\"samples\":50,\"batch\":1,\"unit\":\"cycles\","
+                     "\"min\":1200,\"p50\":1350,\"max\":9000,\"us\":8.438}";
+  TEST_ASSERT_TRUE(parseBenchLine(line, "p50", name, sizeof(name), unit, sizeof(unit), v));
+  TEST_ASSERT_EQUAL_STRING("rx_time", name);
+  TEST_ASSERT_TRUE(v == 1350.0);
+  TEST_ASSERT_TRUE(parseBenchLine(line, "min", name, sizeof(name), unit, sizeof(unit), v));
+  TEST_ASSERT_TRUE(v == 1200.0);
+
+  TEST_ASSERT_FALSE(parseBenchLine(line, "p99", name, sizeof(name), unit, sizeof(unit), v));
+  TEST_ASSERT_FALSE(parseBenchLine("{\"meta\":\"power_bench\",\"unit\":\"ns\"}", "p50", name, sizeof(name), unit, sizeof(unit), v));
+  TEST_ASSERT_FALSE(parseBenchLine("#BENCH END cases=16", "p50", name, sizeof(name), unit, sizeof(unit), v));
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST(test_every_case_emits_one_json_line);
+  RUN_TEST(test_handlers_really_run_on_the_node);
+  RUN_TEST(test_rules_scaling_never_fires_a_rule);
+  RUN_TEST(test_parse_bench_line);
+  return UNITY_END();
+}
@@ -0,0 +1,240 @@
+// Test host della cattura ESP-NOW (ring, dump testuale) e del replay deterministico.
+//   pio test -e native -f test_capture
+
+#include <unity.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "power_capture.h"
+#include "power_hal_host.h"
+#include "power_node.h"
+#include "power_replay.h"
+
+static uint32_t store[4096 / 4];
+static PowerCapture* cap;
+static PowerHalHost* hal;
+static PowerNode* node;
+
+void setUp() {
+  memset(store, 0xA5, sizeof(store)); //come la RTC RAM dopo l'accensione
+  cap = new PowerCapture(store, sizeof(store));
+  cap->begin(true);
+  hal = new PowerHalHost();
+  node = new PowerNode(*hal);
+  node->attachCapture(cap);
+  node->begin();
+  node->initEspNowOnChannel(1);
+}
+
+void tearDown() {
+  delete node;
+  delete hal;
+  delete cap;
+}
+
+static void collectLine(void* ctx, const char* line) { ((std::vector<std::string>*)ctx)->push_back(line); }
+
+//sessione tipica: HELLO, TIME, RULES, CMD, la regola scatta al minuto dopo
+static void runSession() {
+  HelloPacket h = { HELLO_TYPE, 1, 0 };
+  hal->deliver(DEFAULT_MASTER_MAC, h);
+  hal->advance(500);
+
+  PowerTimePacket t = { PWR_TIME_TYPE, 7 * 60 + 59, 0, 1, 0 };
+  hal->deliver(DEFAULT_MASTER_MAC, t);
+  hal->advance(300);
+
+  PowerRelayRulesPacket rp;
+  memset(&rp, 0, sizeof(rp));
+  rp.type = PWR_RELAYRULE_TYPE;
+  rp.ch = 2;
+  rp.count = 1;
+  rp.rules[0].minuteOfDay = 8 * 60;
+  rp.rules[0].on = 1;
+  rp.rules[0].daysMask = 0x7F;
+  hal->deliver(DEFAULT_MASTER_MAC, rp);
+
+  PowerCmdPacket c = { PWR_CMD_TYPE, 0x01, 0x01, 1, 0 };
+  hal->deliver(DEFAULT_MASTER_MAC, c);
+
+  for (int i = 0; i < 4000; i++) { //80 s di loop() ogni 20 ms
+    hal->advance(20);
+    node->loopOnce();
+    if (i % 50 == 0) hal->deliver(DEFAULT_MASTER_MAC, h); //HELLO ripetuti
+  }
+}
+
+// ===================== RING =====================
+void test_ring_drops_oldest_records() {
+  PowerCapture small(store, 128);
+  small.begin(false);
+  uint8_t p[20];
+  for (uint32_t i = 0; i < 20; i++) {
+    memset(p, (int)i, sizeof(p));
+    small.record(CAP_RX, i, p, sizeof(p));
+  }
+  TEST_ASSERT_TRUE(small.dropped() > 0);
+  TEST_ASSERT_TRUE(small.used() <= small.capacity());
+
+  std::vector<CaptureRecord> recs;
+  captureRecords(small, recs);
+  TEST_ASSERT_EQUAL_UINT32(small.records(), recs.size());
+  TEST_ASSERT_EQUAL_UINT32(19, recs.back().ms);
+  for (size_t i = 1; i < recs.size(); i++) TEST_ASSERT_EQUAL_UINT32(recs[i - 1].ms + 1, recs[i].ms);
+  TEST_ASSERT_EQUAL_UINT8(recs.back().ms, recs.back().payload[0]);
+}
+
+//"cap dump" spegne la cattura sotto lock mentre un RX aveva già passato il controllo fuori dal
+//lock: il record non deve finire nel ring che si sta stampando
+static void disableWhileLocked(void* ctx, bool lock) {
+  if (lock) static_cast<PowerCapture*>(ctx)->setEnabled(false);
+}
+
+void test_record_rechecks_enabled_under_lock() {
+  PowerCapture c(store, 256);
+  c.begin(false);
+  uint8_t p[8] = {0};
+  c.record(CAP_RX, 1, p, sizeof(p));
+  TEST_ASSERT_EQUAL_UINT32(1, c.records());
+
+  c.setLock(disableWhileLocked, &c);
+  c.record(CAP_RX, 2, p, sizeof(p));
+  TEST_ASSERT_FALSE(c.enabled());
+  TEST_ASSERT_EQUAL_UINT32(1, c.records());
+}
+
+void test_dump_roundtrip() {
+  runSession();
+  std::vector<std::string> lines;
+  cap->dump(collectLine, &lines);
+  TEST_ASSERT_EQUAL_STRING("#CAP END", lines.back().c_str());
+  TEST_ASSERT_EQUAL_INT(0, lines.front().find("#CAP v1"));
+
+  std::vector<CaptureRecord> direct, parsed;
+  captureRecords(*cap, direct);
+  CaptureRecord r;
+  for (auto& l : lines) if (parseCaptureLine(("12:00:01.123 -> " + l).c_str(), r)) parsed.push_back(r);
+
+  TEST_ASSERT_EQUAL_UINT32(direct.size(), parsed.size());
+  for (size_t i = 0; i < direct.size(); i++) {
+    TEST_ASSERT_EQUAL_UINT8(direct[i].kind, parsed[i].kind);
+    TEST_ASSERT_EQUAL_UINT32(direct[i].ms, parsed[i].ms);
+    TEST_ASSERT_TRUE(direct[i].payload == parsed[i].payload);
+  }
+}
+
+void test_capture_survives_reset_only_if_valid() {
+  runSession();
+  uint32_t n = cap->records();
+
+  PowerCapture again(store, sizeof(store));
+  again.begin(true);
+  TEST_ASSERT_EQUAL_UINT32(n, again.records());
+
+  store[0] ^= 0xFFFFFFFFu; //magic rovinato
+  PowerCapture broken(store, sizeof(store));
+  broken.begin(true);
+  TEST_ASSERT_EQUAL_UINT32(0, broken.records());
+}
+
+// ===================== NODO =====================
+void test_node_records_boot_snapshot_and_ignored_packets() {
+  PowerCmdPacket c = { PWR_CMD_TYPE, 0x01, 0x01, 1, 0 };
+  hal->deliver(DEFAULT_MASTER_MAC, c); //prima di HELLO: ignorato ma registrato
+
+  std::vector<CaptureRecord> recs;
+  captureRecords(*cap, recs);
+  TEST_ASSERT_EQUAL_UINT32(3, recs.size());
+  TEST_ASSERT_EQUAL_UINT8(CAP_BOOT, recs[0].kind);
+  TEST_ASSERT_EQUAL_UINT8(CAP_SNAP, recs[1].kind);
+  TEST_ASSERT_EQUAL_UINT32(sizeof(PowerCaptureSnap), recs[1].payload.size());
+  TEST_ASSERT_EQUAL_UINT8(CAP_RX, recs[2].kind);
+  TEST_ASSERT_EQUAL_UINT32(CAP_FRAME_HDR + sizeof(c), recs[2].payload.size());
+  TEST_ASSERT_EQUAL_MEMORY(DEFAULT_MASTER_MAC, recs[2].payload.data(), 6);
+}
+
+void test_repeated_hello_is_only_counted() {
+  HelloPacket h = { HELLO_TYPE, 1, 0 };
+  hal->deliver(DEFAULT_MASTER_MAC, h);
+  uint32_t n = cap->records();
+  for (int i = 0; i < 10; i++) hal->deliver(DEFAULT_MASTER_MAC, h);
+
+  TEST_ASSERT_EQUAL_UINT32(n, cap->records());
+  TEST_ASSERT_EQUAL_UINT32(10, cap->folded());
+  TEST_ASSERT_EQUAL_UINT32(2 * 11, hal->sent().size()); //le risposte partono comunque
+}
+
+// ===================== REPLAY =====================
+void test_replay_reproduces_session() {
+  runSession();
+  std::vector<CaptureRecord> recs;
+  captureRecords(*cap, recs);
+
+  ReplayResult r = replayCapture(recs);
+  TEST_ASSERT_TRUE_MESSAGE(r.ok(), r.firstDivergence.c_str());
+  TEST_ASSERT_EQUAL_UINT32(1, r.segments);
+  TEST_ASSERT_TRUE(r.txExpected > 0);
+  TEST_ASSERT_EQUAL_UINT32(r.txExpected, r.txProduced);
+  TEST_ASSERT_EQUAL_INT32(0, r.txMsMaxSkew);
+
+  //EXECUTED della regola delle 08:00 compreso
+  bool executed = false;
+  for (auto& rec : recs) {
+    if (rec.kind == CAP_TX && rec.payload[CAP_FRAME_HDR] == PWR_EXECUTED_TYPE) executed = true;
+  }
+  TEST_ASSERT_TRUE(executed);
+}
+
+void test_replay_detects_divergence() {
+  runSession();
+  std::vector<CaptureRecord> recs;
+  captureRecords(*cap, recs);
+
+  for (auto& rec : recs) {
+    if (rec.kind == CAP_TX && rec.payload[CAP_FRAME_HDR] == PWR_STATE_TYPE) {
+      rec.payload[CAP_FRAME_HDR + 1] ^= 0x08; //relayMask diverso
+      break;
+    }
+  }
+  ReplayResult r = replayCapture(recs);
+  TEST_ASSERT_FALSE(r.ok());
+  TEST_ASSERT_TRUE(r.firstDivergence.find("TX diverso") != std::string::npos);
+}
+
+void test_replay_from_mid_capture_snapshot() {
+  //ring piccolo: BOOT e primi record persi, si riparte da uno SNAP intermedio
+  PowerCapture small(store, 600);
+  small.begin(false);
+  node->attachCapture(&small);
+  runSession();
+  for (int i = 0; i < 3; i++) {
+    PowerCmdPacket c = { PWR_CMD_TYPE, 0x0F, (uint8_t)(i & 1 ? 0x0F : 0x00), 1, 0 };
+    hal->deliver(DEFAULT_MASTER_MAC, c);
+    hal->advance(100);
+  }
+  TEST_ASSERT_TRUE(small.dropped() > 0);
+
+  std::vector<CaptureRecord> recs;
+  captureRecords(small, recs);
+  TEST_ASSERT_TRUE(recs[0].kind != CAP_BOOT);
+
+  ReplayResult r = replayCapture(recs);
+  TEST_ASSERT_TRUE_MESSAGE(r.ok(), r.firstDivergence.c_str());
+  TEST_ASSERT_EQUAL_UINT32(1, r.segments);
+  TEST_ASSERT_TRUE(r.txExpected > 0);
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST(test_ring_drops_oldest_records);
+  RUN_TEST(test_record_rechecks_enabled_under_lock);
+  RUN_TEST(test_dump_roundtrip);
+  RUN_TEST(test_capture_survives_reset_only_if_valid);
+  RUN_TEST(test_node_records_boot_snapshot_and_ignored_packets);
+  RUN_TEST(test_repeated_hello_is_only_counted);
+  RUN_TEST(test_replay_reproduces_session);
+  RUN_TEST(test_replay_detects_divergence);
+  RUN_TEST(test_replay_from_mid_capture_snapshot);
+  return UNITY_END();
+}
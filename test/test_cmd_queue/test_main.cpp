@@ -0,0 +1,259 @@
+// Test host della coda CMD/RULES del bridge (batching, TOGGLE, l'ultima vince, retry)
+//   pio test -e native -f test_cmd_queue
+
+#include <unity.h>
+#include <string.h>
+#include <vector>
+
+#include "power_cmd_queue.h"
+
+static std::vector<std::vector<uint8_t>> sent;
+static PowerCmdQueue* q;
+
+static void capture(void*, const void* pkt, size_t len) {
+  const uint8_t* p = (const uint8_t*)pkt;
+  sent.push_back(std::vector<uint8_t>(p, p + len));
+}
+
+static size_t countType(uint8_t type) {
+  size_t n = 0;
+  for (const auto& s : sent) if (!s.empty() && s[0] == type) n++;
+  return n;
+}
+
+static PowerCmdPacket lastCmd() {
+  PowerCmdPacket c;
+  memset(&c, 0, sizeof(c));
+  for (const auto& s : sent)
+    if (s.size() == sizeof(c) && s[0] == PWR_CMD_TYPE) memcpy(&c, s.data(), sizeof(c));
+  return c;
+}
+
+static PowerRelayRulesPacket lastRules() {
+  PowerRelayRulesPacket r;
+  memset(&r, 0, sizeof(r));
+  for (const auto& s : sent)
+    if (s.size() == sizeof(r) && s[0] == PWR_RELAYRULE_TYPE) memcpy(&r, s.data(), sizeof(r));
+  return r;
+}
+
+static PowerRelayRulesPacket rules(uint8_t ch, uint16_t at) {
+  PowerRelayRulesPacket r;
+  memset(&r, 0, sizeof(r));
+  r.type = PWR_RELAYRULE_TYPE;
+  r.ch = ch;
+  r.count = 1;
+  r.rules[0].minuteOfDay = at;
+  r.rules[0].on = 1;
+  r.rules[0].daysMask = 0x7F;
+  return r;
+}
+
+void setUp(void) {
+  sent.clear();
+  q = new PowerCmdQueue();
+  PowerCmdQueueConfig cfg; //batch 2 ms, retry 150 ms, rules 1000 ms, 3 retry
+  q->begin(cfg, capture, nullptr);
+}
+
+void tearDown(void) {
+  delete q;
+}
+
+void test_set_then_toggle_same_bit_before_flush(void) {
+  q->linkUp(0);
+  q->set(1, POWER_SET_ON, 100);
+  q->set(1, POWER_SET_TOGGLE, 101); //parte da ON accodato, non da relayMask (OFF)
+  q->service(102);
+  TEST_ASSERT_EQUAL(1, (int)countType(PWR_CMD_TYPE));
+  PowerCmdPacket c = lastCmd();
+  TEST_ASSERT_EQUAL_UINT8(0x01, c.maskSet);
+  TEST_ASSERT_EQUAL_UINT8(0x00, c.maskVal);
+}
+
+void test_toggle_resolves_against_inflight_then_relay_mask(void) {
+  q->linkUp(0);
+  q->onState(0x02, 0);
+  //relè 2 acceso sul nodo: TOGGLE -> OFF
+  q->set(2, POWER_SET_TOGGLE, 10);
+  q->service(12);
+  TEST_ASSERT_EQUAL_UINT8(0x00, lastCmd().maskVal);
+  TEST_ASSERT_TRUE(q->cmdInflight());
+  //il CMD in volo porta il relè 2 a OFF: un altro TOGGLE -> ON
+  q->set(2, POWER_SET_TOGGLE, 20);
+  TEST_ASSERT_EQUAL_UINT8(0x02, q->pendingSet());
+  TEST_ASSERT_EQUAL_UINT8(0x02, q->pendingVal());
+  //STATE che conferma: il batch parte subito
+  q->onState(0x00, 30);
+  TEST_ASSERT_EQUAL(2, (int)countType(PWR_CMD_TYPE));
+  TEST_ASSERT_EQUAL_UINT8(0x02, lastCmd().maskSet);
+  TEST_ASSERT_EQUAL_UINT8(0x02, lastCmd().maskVal);
+}
+
+void test_sets_in_batch_window_merge(void) {
+  q->linkUp(0);
+  q->set(1, POWER_SET_ON, 100);
+  q->set(3, POWER_SET_ON, 101);
+  q->set(1, POWER_SET_OFF, 101);
+  q->service(101);
+  TEST_ASSERT_EQUAL(0, (int)countType(PWR_CMD_TYPE)); //finestra non ancora scaduta
+  q->service(102);
+  TEST_ASSERT_EQUAL(1, (int)countType(PWR_CMD_TYPE));
+  TEST_ASSERT_EQUAL_UINT8(0x05, lastCmd().maskSet);
+  TEST_ASSERT_EQUAL_UINT8(0x04, lastCmd().maskVal);
+}
+
+void test_cmd_before_link_waits_and_merges(void) {
+  //nodo non ancora agganciato (endpoint sconosciuto): niente sul filo
+  q->set(1, POWER_SET_ON, 0);
+  q->set(4, POWER_SET_ON, 50);
+  q->service(500);
+  TEST_ASSERT_TRUE(sent.empty());
+  TEST_ASSERT_FALSE(q->cmdInflight());
+  q->linkUp(600);
+  TEST_ASSERT_EQUAL(1, (int)countType(PWR_CMD_TYPE));
+  TEST_ASSERT_EQUAL_UINT8(0x09, lastCmd().maskSet);
+  TEST_ASSERT_EQUAL_UINT8(0x09, lastCmd().maskVal);
+}
+
+void test_link_down_stops_sending(void) {
+  q->linkUp(0);
+  q->linkDown();
+  q->set(2, POWER_SET_ON, 10);
+  q->service(20);
+  TEST_ASSERT_TRUE(sent.empty());
+  q->linkUp(30);
+  TEST_ASSERT_EQUAL(1, (int)countType(PWR_CMD_TYPE));
+}
+
+void test_retry_merges_pending_sets(void) {
+  q->linkUp(0);
+  q->set(1, POWER_SET_ON, 0);
+  q->service(2);
+  q->set(1, POWER_SET_OFF, 50);
+  q->set(2, POWER_SET_ON, 60);
+  q->service(152); //nessuno STATE: retry con dentro i set nuovi
+  TEST_ASSERT_EQUAL(2, (int)countType(PWR_CMD_TYPE));
+  TEST_ASSERT_EQUAL_UINT8(0x03, lastCmd().maskSet);
+  TEST_ASSERT_EQUAL_UINT8(0x02, lastCmd().maskVal);
+  TEST_ASSERT_EQUAL_UINT8(0, q->pendingSet());
+  TEST_ASSERT_EQUAL(1, (int)q->stats().cmdFrames);
+  TEST_ASSERT_EQUAL(1, (int)q->stats().cmdRetries);
+}
+
+void test_cmd_dropped_after_max_retries(void) {
+  q->linkUp(0);
+  q->set(1, POWER_SET_ON, 0);
+  q->service(2);
+  for (uint64_t t = 152; t <= 152 + 150 * 3; t += 150) q->service(t);
+  TEST_ASSERT_FALSE(q->cmdInflight());
+  TEST_ASSERT_EQUAL(4, (int)countType(PWR_CMD_TYPE));
+  TEST_ASSERT_EQUAL(1, (int)q->stats().cmdDropped);
+}
+
+void test_rules_replaced_before_flush(void) {
+  //prima dell'aggancio: due schedulazioni, parte solo l'ultima
+  q->setRules(rules(2, 480), 0);
+  q->setRules(rules(2, 600), 10);
+  TEST_ASSERT_TRUE(sent.empty());
+  TEST_ASSERT_TRUE(q->rulesDirty(2));
+  q->linkUp(20);
+  TEST_ASSERT_EQUAL(1, (int)countType(PWR_RELAYRULE_TYPE));
+  TEST_ASSERT_EQUAL_UINT16(600, lastRules().rules[0].minuteOfDay);
+  TEST_ASSERT_TRUE(q->rulesInflight(2));
+
+  //in volo: altre due, all'ACK parte solo l'ultima
+  q->setRules(rules(2, 700), 30);
+  q->setRules(rules(2, 720), 40);
+  TEST_ASSERT_EQUAL(1, (int)countType(PWR_RELAYRULE_TYPE));
+  q->onRulesAck(2, 50);
+  TEST_ASSERT_EQUAL(2, (int)countType(PWR_RELAYRULE_TYPE));
+  TEST_ASSERT_EQUAL_UINT16(720, lastRules().rules[0].minuteOfDay);
+  TEST_ASSERT_FALSE(q->rulesDirty(2));
+}
+
+void test_rules_give_up_reports_channel(void) {
+  q->linkUp(0);
+  q->setRules(rules(3, 480), 0);
+  uint8_t gaveUp = 0;
+  for (uint64_t t = 1000; t <= 4000; t += 1000) gaveUp |= q->service(t);
+  TEST_ASSERT_EQUAL(4, (int)countType(PWR_RELAYRULE_TYPE)); //1 + 3 retry
+  TEST_ASSERT_EQUAL_UINT8(0x04, gaveUp);
+  TEST_ASSERT_FALSE(q->rulesInflight(3));
+}
+
+void test_rules_rejected_while_cmd_inflight(void) {
+  q->linkUp(0);
+  q->set(1, POWER_SET_ON, 0);
+  q->service(2);
+  q->setRules(rules(2, 480), 3);
+  TEST_ASSERT_TRUE(q->cmdInflight());
+  TEST_ASSERT_TRUE(q->rulesInflight(2));
+  //ERROR (ch non valido / NVS) per le RULES del relè 2: il CMD resta in volo
+  q->rulesFailed(2);
+  TEST_ASSERT_FALSE(q->rulesInflight(2));
+  TEST_ASSERT_TRUE(q->cmdInflight());
+  q->service(152);
+  TEST_ASSERT_EQUAL(2, (int)countType(PWR_CMD_TYPE)); //retry del CMD
+  q->onState(0x01, 160);
+  TEST_ASSERT_FALSE(q->cmdInflight());
+  //il relè 2 accetta subito una nuova schedulazione
+  q->setRules(rules(2, 500), 170);
+  TEST_ASSERT_EQUAL(2, (int)countType(PWR_RELAYRULE_TYPE));
+}
+
+void test_link_down_pauses_retries_and_relink_resets_budget(void) {
+  q->linkUp(0);
+  q->set(1, POWER_SET_ON, 0);
+  q->service(2);
+  q->setRules(rules(3, 480), 2);
+  q->service(152); //un retry prima del reboot
+  TEST_ASSERT_EQUAL(2, (int)countType(PWR_CMD_TYPE));
+  q->linkDown();
+  //nodo in reboot per molto più di maxRetries * retryMs: niente sul filo, niente abbandonato
+  for (uint64_t t = 200; t <= 5000; t += 50) TEST_ASSERT_EQUAL_UINT8(0, q->service(t));
+  TEST_ASSERT_EQUAL(2, (int)countType(PWR_CMD_TYPE));
+  TEST_ASSERT_EQUAL(1, (int)countType(PWR_RELAYRULE_TYPE));
+  TEST_ASSERT_TRUE(q->cmdInflight());
+  TEST_ASSERT_TRUE(q->rulesInflight(3));
+  TEST_ASSERT_EQUAL(0, (int)q->stats().cmdDropped);
+
+  q->set(2, POWER_SET_ON, 5000);
+  q->linkUp(5010); //riaggancio: CMD (con il set nuovo) e RULES ripartono subito
+  TEST_ASSERT_EQUAL(3, (int)countType(PWR_CMD_TYPE));
+  TEST_ASSERT_EQUAL_UINT8(0x03, lastCmd().maskSet);
+  TEST_ASSERT_EQUAL_UINT8(0x03, lastCmd().maskVal);
+  TEST_ASSERT_EQUAL(2, (int)countType(PWR_RELAYRULE_TYPE));
+  //budget pieno: altri 3 retry prima di abbandonare
+  for (uint64_t t = 5160; t <= 5160 + 150 * 2; t += 150) q->service(t);
+  TEST_ASSERT_TRUE(q->cmdInflight());
+  TEST_ASSERT_EQUAL(6, (int)countType(PWR_CMD_TYPE));
+  q->service(5610);
+  TEST_ASSERT_FALSE(q->cmdInflight());
+  TEST_ASSERT_EQUAL(1, (int)q->stats().cmdDropped);
+}
+
+void test_keepalive_link_up_does_not_resend(void) {
+  q->linkUp(0);
+  q->set(1, POWER_SET_ON, 0);
+  q->service(2);
+  q->linkUp(50); //HELLO_ACK del keepalive
+  TEST_ASSERT_EQUAL(1, (int)countType(PWR_CMD_TYPE));
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST(test_set_then_toggle_same_bit_before_flush);
+  RUN_TEST(test_toggle_resolves_against_inflight_then_relay_mask);
+  RUN_TEST(test_sets_in_batch_window_merge);
+  RUN_TEST(test_cmd_before_link_waits_and_merges);
+  RUN_TEST(test_link_down_stops_sending);
+  RUN_TEST(test_retry_merges_pending_sets);
+  RUN_TEST(test_cmd_dropped_after_max_retries);
+  RUN_TEST(test_rules_replaced_before_flush);
+  RUN_TEST(test_rules_give_up_reports_channel);
+  RUN_TEST(test_rules_rejected_while_cmd_inflight);
+  RUN_TEST(test_link_down_pauses_retries_and_relink_resets_budget);
+  RUN_TEST(test_keepalive_link_up_does_not_resend);
+  return UNITY_END();
+}
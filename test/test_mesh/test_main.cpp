@@ -0,0 +1,535 @@
+// Test host dell'inoltro multi-hop (lib/power_core/power_mesh.*): rotte, buste, duplicati, TTL, ACK end-to-end.
+//   pio test -e native -f test_mesh
+
+#include <unity.h>
+#include <string.h>
+#include <vector>
+
+#include "power_hal_host.h"
+#include "power_node.h"
+
+static const uint8_t MY_MAC[6]  = {0x24, 0x0A, 0xC4, 0xFF, 0xFF, 0x01}; //MAC di default di PowerHalHost
+static const uint8_t RELAY_A[6] = {0x24, 0x0A, 0xC4, 0x00, 0x00, 0x0A};
+static const uint8_t RELAY_B[6] = {0x24, 0x0A, 0xC4, 0x00, 0x00, 0x0B};
+static const uint8_t CHILD[6]   = {0x24, 0x0A, 0xC4, 0x00, 0x00, 0x0C};
+static const uint8_t BCAST[6]   = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+static PowerHalHost* hal;
+static PowerNode* node;
+
+static void sendHello(uint8_t ch, int8_t rssi) {
+  HelloPacket h = { HELLO_TYPE, ch, 1234 };
+  hal->deliver(DEFAULT_MASTER_MAC, &h, sizeof(h), rssi);
+}
+
+static void sendBeacon(const uint8_t* src, uint8_t hops, int8_t rssi, uint8_t ch = 6) {
+  PowerMeshBeaconPacket b;
+  b.type = PWR_MESH_BEACON_TYPE;
+  b.ch = ch;
+  b.hops = hops;
+  memcpy(b.master, DEFAULT_MASTER_MAC, 6);
+  b.ms = 0;
+  hal->deliver(src, &b, sizeof(b), rssi);
+}
+
+static std::vector<uint8_t> envelope(uint8_t type, uint8_t flags, uint8_t ttl, uint8_t hops, const uint8_t* who,
+                                     uint16_t seq, const void* payload = nullptr, size_t len = 0) {
+  PowerMeshHeader h;
+  h.type = type;
+  h.flags = flags;
+  h.ttl = ttl;
+  h.hops = hops;
+  memcpy(h.node, who, 6);
+  h.seq = seq;
+  std::vector<uint8_t> out(MESH_MAX_FRAME);
+  out.resize(meshWrap(out.data(), out.size(), h, payload, len));
+  return out;
+}
+
+static void deliverFrame(const uint8_t* src, const std::vector<uint8_t>& f) { hal->deliver(src, f.data(), f.size()); }
+
+static PowerMeshHeader headerOf(const PowerHalHost::Frame& f) {
+  PowerMeshHeader h;
+  TEST_ASSERT_TRUE(f.data.size() >= sizeof(h));
+  memcpy(&h, f.data.data(), sizeof(h));
+  return h;
+}
+
+//frame inviati di un tipo (BEACON e buste si mescolano ai pacchetti normali)
+static std::vector<PowerHalHost::Frame> sentOfType(uint8_t type) {
+  std::vector<PowerHalHost::Frame> out;
+  for (auto& f : hal->sent()) if (f.type() == type) out.push_back(f);
+  return out;
+}
+
+void setUp() {
+  hal = new PowerHalHost();
+  node = new PowerNode(*hal);
+  node->enableMesh();
+  node->begin();
+  node->initEspNowOnChannel(1);
+}
+
+void tearDown() {
+  delete node;
+  delete hal;
+}
+
+void test_mesh_wire_sizes() {
+  TEST_ASSERT_EQUAL(13, sizeof(PowerMeshBeaconPacket));
+  TEST_ASSERT_EQUAL(12, sizeof(PowerMeshHeader));
+  TEST_ASSERT_EQUAL(59, MESH_MAX_FRAME);
+}
+
+void test_master_in_range_stays_plain() {
+  sendHello(6, -50);
+
+  TEST_ASSERT_EQUAL_UINT8(1, node->mesh().hops());
+  TEST_ASSERT_EQUAL_MEMORY(DEFAULT_MASTER_MAC, node->mesh().parent(), 6);
+  TEST_ASSERT_FALSE(node->mesh().routed());
+  TEST_ASSERT_EQUAL(2, hal->sent().size());
+  TEST_ASSERT_EQUAL_UINT8(PWR_HELLO_ACK_TYPE, hal->sent()[0].type());
+  TEST_ASSERT_EQUAL_MEMORY(DEFAULT_MASTER_MAC, hal->sent()[0].mac, 6);
+}
+
+void test_beacon_locks_channel_and_wraps_traffic_to_parent() {
+  sendBeacon(RELAY_A, 1, -60);
+
+  TEST_ASSERT_TRUE(node->channelReady());
+  TEST_ASSERT_EQUAL_UINT8(6, node->channel());
+  TEST_ASSERT_EQUAL_INT8(6, hal->rtcLockedChannel());
+  TEST_ASSERT_EQUAL_UINT8(2, node->mesh().hops());
+  TEST_ASSERT_TRUE(node->mesh().routed());
+
+  //HELLO_ACK + STATE in busta verso il relè
+  TEST_ASSERT_EQUAL(2, hal->sent().size());
+  static const uint8_t INNER[2] = { PWR_HELLO_ACK_TYPE, PWR_STATE_TYPE };
+  uint16_t seq0 = headerOf(hal->sent()[0]).seq; //casuale a ogni boot, poi consecutivo
+  for (int i = 0; i < 2; i++) {
+    const PowerHalHost::Frame& f = hal->sent()[i];
+    TEST_ASSERT_EQUAL_MEMORY(RELAY_A, f.mac, 6);
+    PowerMeshHeader h = headerOf(f);
+    TEST_ASSERT_EQUAL_UINT8(PWR_MESH_DATA_TYPE, h.type);
+    TEST_ASSERT_EQUAL_UINT8(MESH_UP | MESH_WANT_ACK, h.flags);
+    TEST_ASSERT_EQUAL_UINT8(MESH_MAX_HOPS, h.ttl);
+    TEST_ASSERT_EQUAL_UINT8(0, h.hops);
+    TEST_ASSERT_EQUAL_MEMORY(MY_MAC, h.node, 6);
+    TEST_ASSERT_EQUAL_UINT16((uint16_t)(seq0 + i), h.seq);
+    TEST_ASSERT_EQUAL_UINT8(INNER[i], f.data[sizeof(h)]);
+  }
+  TEST_ASSERT_EQUAL_UINT32(2, node->mesh().stats().originated);
+}
+
+void test_weak_neighbor_is_not_a_route() {
+  sendBeacon(RELAY_A, 1, -90);
+
+  TEST_ASSERT_FALSE(node->channelReady());
+  TEST_ASSERT_EQUAL_UINT8(MESH_NO_ROUTE, node->mesh().hops());
+  TEST_ASSERT_EQUAL(0, hal->sent().size());
+}
+
+void test_parent_prefers_fewer_hops_with_hysteresis() {
+  sendBeacon(RELAY_A, 1, -70);
+  TEST_ASSERT_EQUAL_MEMORY(RELAY_A, node->mesh().parent(), 6);
+
+  //più forte ma più lontano dal master: resta A
+  sendBeacon(RELAY_B, 2, -40);
+  TEST_ASSERT_EQUAL_MEMORY(RELAY_A, node->mesh().parent(), 6);
+  TEST_ASSERT_EQUAL_UINT8(2, node->mesh().hops());
+
+  //ora B ha gli stessi hop di A: media (3 * -40 - 66) / 4 = -46, 24 dB meglio di A -> cambio
+  sendBeacon(RELAY_B, 1, -66);
+  TEST_ASSERT_EQUAL_MEMORY(RELAY_B, node->mesh().parent(), 6);
+  TEST_ASSERT_EQUAL_UINT32(2, node->mesh().stats().parentChanges);
+
+  //A torna appena sopra B ma sotto l'isteresi: resta B
+  for (int i = 0; i < 8; i++) sendBeacon(RELAY_A, 1, -43);
+  TEST_ASSERT_EQUAL_MEMORY(RELAY_B, node->mesh().parent(), 6);
+  TEST_ASSERT_EQUAL_UINT32(2, node->mesh().stats().parentChanges);
+
+  //un hop in meno vince sempre
+  sendHello(6, -80);
+  TEST_ASSERT_EQUAL_MEMORY(DEFAULT_MASTER_MAC, node->mesh().parent(), 6);
+  TEST_ASSERT_EQUAL_UINT8(1, node->mesh().hops());
+}
+
+void test_relay_forwards_up_learns_route_and_forwards_down() {
+  sendHello(6, -50);
+  hal->clearSent();
+
+  PowerStatePacket st = { PWR_STATE_TYPE, 0x05, 1, 1, 777 };
+  deliverFrame(CHILD, envelope(PWR_MESH_DATA_TYPE, MESH_UP | MESH_WANT_ACK, MESH_MAX_HOPS, 0, CHILD, 7, &st, sizeof(st)));
+
+  TEST_ASSERT_EQUAL(1, hal->sent().size());
+  const PowerHalHost::Frame& up = hal->sent()[0];
+  TEST_ASSERT_EQUAL_MEMORY(DEFAULT_MASTER_MAC, up.mac, 6);
+  PowerMeshHeader h = headerOf(up);
+  TEST_ASSERT_EQUAL_UINT8(MESH_MAX_HOPS - 1, h.ttl);
+  TEST_ASSERT_EQUAL_UINT8(1, h.hops);
+  TEST_ASSERT_EQUAL_MEMORY(CHILD, h.node, 6);
+  TEST_ASSERT_EQUAL_UINT16(7, h.seq);
+  TEST_ASSERT_EQUAL_MEMORY(&st, up.data.data() + sizeof(h), sizeof(st));
+
+  const PowerMeshRoute* r = node->mesh().routes().find(CHILD);
+  TEST_ASSERT_NOT_NULL(r);
+  TEST_ASSERT_EQUAL_MEMORY(CHILD, r->via, 6);
+  TEST_ASSERT_EQUAL_UINT8(1, r->hops);
+
+  //ACK end-to-end del master: scende verso il figlio
+  hal->clearSent();
+  deliverFrame(DEFAULT_MASTER_MAC, envelope(PWR_MESH_ACK_TYPE, 0, MESH_MAX_HOPS, 0, CHILD, 7));
+  TEST_ASSERT_EQUAL(1, hal->sent().size());
+  TEST_ASSERT_EQUAL_MEMORY(CHILD, hal->sent()[0].mac, 6);
+  TEST_ASSERT_EQUAL_UINT8(PWR_MESH_ACK_TYPE, hal->sent()[0].type());
+
+  //nodo mai sentito: niente rotta verso il basso
+  hal->clearSent();
+  deliverFrame(DEFAULT_MASTER_MAC, envelope(PWR_MESH_DATA_TYPE, MESH_WANT_ACK, MESH_MAX_HOPS, 0, RELAY_B, 1, &st, sizeof(st)));
+  TEST_ASSERT_EQUAL(0, hal->sent().size());
+
+  const PowerMeshStats& s = node->mesh().stats();
+  TEST_ASSERT_EQUAL_UINT32(1, s.forwardedUp);
+  TEST_ASSERT_EQUAL_UINT32(1, s.forwardedDown);
+  TEST_ASSERT_EQUAL_UINT32(1, s.noRouteDropped);
+  //il relè non apre le buste degli altri
+  TEST_ASSERT_EQUAL_UINT8(0, node->relayMask());
+}
+
+void test_duplicates_and_ttl_are_dropped() {
+  sendHello(6, -50);
+  hal->clearSent();
+
+  PowerStatePacket st = { PWR_STATE_TYPE, 0, 1, 1, 0 };
+  std::vector<uint8_t> f = envelope(PWR_MESH_DATA_TYPE, MESH_UP | MESH_WANT_ACK, MESH_MAX_HOPS, 0, CHILD, 9, &st, sizeof(st));
+  deliverFrame(CHILD, f);
+  deliverFrame(CHILD, f);
+  TEST_ASSERT_EQUAL(1, hal->sent().size());
+
+  //ritrasmissione end-to-end (tentativo 1): per il relè è un frame nuovo
+  uint8_t retry = MESH_UP | MESH_WANT_ACK | (1 << MESH_ATTEMPT_SHIFT);
+  deliverFrame(CHILD, envelope(PWR_MESH_DATA_TYPE, retry, MESH_MAX_HOPS, 0, CHILD, 9, &st, sizeof(st)));
+  TEST_ASSERT_EQUAL(2, hal->sent().size());
+
+  //ultimo hop consentito esaurito
+  deliverFrame(CHILD, envelope(PWR_MESH_DATA_TYPE, MESH_UP, 1, MESH_MAX_HOPS - 1, RELAY_B, 3, &st, sizeof(st)));
+  TEST_ASSERT_EQUAL(2, hal->sent().size());
+
+  const PowerMeshStats& s = node->mesh().stats();
+  TEST_ASSERT_EQUAL_UINT32(1, s.dupDropped);
+  TEST_ASSERT_EQUAL_UINT32(1, s.ttlDropped);
+  TEST_ASSERT_EQUAL_UINT32(2, s.forwardedUp);
+}
+
+//l'ACK del master passa da questo relè e si perde più in basso: il figlio ritrasmette e l'ACK
+//del nuovo tentativo deve passare di nuovo, non essere scartato come duplicato del primo
+void test_ack_of_retry_is_forwarded_after_lost_ack() {
+  sendHello(6, -50);
+  hal->clearSent();
+
+  PowerStatePacket st = { PWR_STATE_TYPE, 0, 1, 1, 0 };
+  deliverFrame(CHILD, envelope(PWR_MESH_DATA_TYPE, MESH_UP | MESH_WANT_ACK, MESH_MAX_HOPS, 0, CHILD, 11, &st, sizeof(st)));
+  deliverFrame(DEFAULT_MASTER_MAC, envelope(PWR_MESH_ACK_TYPE, 0, MESH_MAX_HOPS, 0, CHILD, 11));
+  TEST_ASSERT_EQUAL(1, sentOfType(PWR_MESH_ACK_TYPE).size());
+
+  uint8_t retry = (uint8_t)(1 << MESH_ATTEMPT_SHIFT);
+  deliverFrame(CHILD, envelope(PWR_MESH_DATA_TYPE, MESH_UP | MESH_WANT_ACK | retry, MESH_MAX_HOPS, 0, CHILD, 11, &st, sizeof(st)));
+  deliverFrame(DEFAULT_MASTER_MAC, envelope(PWR_MESH_ACK_TYPE, retry, MESH_MAX_HOPS, 0, CHILD, 11));
+
+  std::vector<PowerHalHost::Frame> acks = sentOfType(PWR_MESH_ACK_TYPE);
+  TEST_ASSERT_EQUAL(2, acks.size());
+  TEST_ASSERT_EQUAL_MEMORY(CHILD, acks[1].mac, 6);
+  TEST_ASSERT_EQUAL_UINT8(1, headerOf(acks[1]).flags >> MESH_ATTEMPT_SHIFT);
+  TEST_ASSERT_EQUAL_UINT32(0, node->mesh().stats().dupDropped);
+  TEST_ASSERT_EQUAL_UINT32(2, node->mesh().stats().forwardedUp);
+  TEST_ASSERT_EQUAL_UINT32(2, node->mesh().stats().forwardedDown);
+}
+
+//lato nodo: l'ACK del nodo riporta il tentativo del DATA sceso
+void test_node_ack_carries_data_attempt() {
+  sendBeacon(RELAY_A, 1, -60);
+  hal->clearSent();
+
+  PowerCmdPacket c = { PWR_CMD_TYPE, 0x01, 0x01, 1, 0 };
+  uint8_t retry = (uint8_t)(2 << MESH_ATTEMPT_SHIFT);
+  deliverFrame(RELAY_A, envelope(PWR_MESH_DATA_TYPE, MESH_WANT_ACK | retry, MESH_MAX_HOPS - 1, 1, MY_MAC, 4, &c, sizeof(c)));
+
+  std::vector<PowerHalHost::Frame> acks = sentOfType(PWR_MESH_ACK_TYPE);
+  TEST_ASSERT_EQUAL(1, acks.size());
+  TEST_ASSERT_EQUAL_UINT8(MESH_UP | retry, headerOf(acks[0]).flags);
+}
+
+void test_down_data_is_delivered_once_and_always_acked() {
+  sendBeacon(RELAY_A, 1, -60);
+  hal->clearSent();
+
+  PowerCmdPacket c = { PWR_CMD_TYPE, 0x01, 0x01, 1, 0 };
+  std::vector<uint8_t> f = envelope(PWR_MESH_DATA_TYPE, MESH_WANT_ACK, MESH_MAX_HOPS - 1, 1, MY_MAC, 3, &c, sizeof(c));
+  deliverFrame(RELAY_A, f);
+
+  TEST_ASSERT_TRUE(node->relayMaskGet(1));
+  std::vector<PowerHalHost::Frame> acks = sentOfType(PWR_MESH_ACK_TYPE);
+  TEST_ASSERT_EQUAL(1, acks.size());
+  PowerMeshHeader a = headerOf(acks[0]);
+  TEST_ASSERT_EQUAL_MEMORY(RELAY_A, acks[0].mac, 6);
+  TEST_ASSERT_EQUAL_UINT8(MESH_UP, a.flags);
+  TEST_ASSERT_EQUAL_MEMORY(MY_MAC, a.node, 6);
+  TEST_ASSERT_EQUAL_UINT16(3, a.seq);
+  //lo STATE di risposta risale in busta
+  std::vector<PowerHalHost::Frame> data = sentOfType(PWR_MESH_DATA_TYPE);
+  TEST_ASSERT_EQUAL(1, data.size());
+  TEST_ASSERT_EQUAL_UINT8(PWR_STATE_TYPE, data[0].data[sizeof(PowerMeshHeader)]);
+
+  //l'ACK si è perso e il master ritrasmette: nuovo ACK, niente di nuovo per la logica
+  hal->clearSent();
+  deliverFrame(RELAY_A, f);
+  TEST_ASSERT_EQUAL(1, sentOfType(PWR_MESH_ACK_TYPE).size());
+  TEST_ASSERT_EQUAL(0, sentOfType(PWR_MESH_DATA_TYPE).size());
+  TEST_ASSERT_EQUAL_UINT32(1, node->mesh().stats().delivered);
+  TEST_ASSERT_EQUAL_UINT32(1, node->mesh().stats().dupDropped);
+}
+
+void test_end_to_end_retry_rtt_and_timeout() {
+  sendBeacon(RELAY_A, 1, -60);   //HELLO_ACK (seq s) e STATE (seq s+1) in attesa di ACK
+  uint16_t seq0 = headerOf(hal->sent()[0]).seq;
+  hal->clearSent();
+
+  //timeout = 150 ms x 2 hop
+  hal->advance(299);
+  node->loopOnce();
+  TEST_ASSERT_EQUAL(0, sentOfType(PWR_MESH_DATA_TYPE).size());
+  hal->advance(1);
+  sendBeacon(RELAY_A, 1, -60);   //il relè resta vivo
+  node->loopOnce();
+  std::vector<PowerHalHost::Frame> retries = sentOfType(PWR_MESH_DATA_TYPE);
+  TEST_ASSERT_EQUAL(2, retries.size());
+  TEST_ASSERT_EQUAL_UINT8(1, headerOf(retries[0]).flags >> MESH_ATTEMPT_SHIFT);
+
+  //ACK del primo seq dopo 40 ms, passato da un relè
+  hal->advance(40);
+  deliverFrame(RELAY_A, envelope(PWR_MESH_ACK_TYPE, 0, MESH_MAX_HOPS - 1, 1, MY_MAC, seq0));
+  const PowerMeshStats& s = node->mesh().stats();
+  TEST_ASSERT_EQUAL_UINT32(1, s.acked);
+  TEST_ASSERT_EQUAL_UINT32(40, s.rttSumMs);
+  TEST_ASSERT_EQUAL_UINT32(2, s.rttHopSum);
+
+  //il secondo seq non viene mai confermato: ancora un tentativo, poi abbandonato
+  for (int i = 0; i < 3; i++) {
+    hal->advance(300);
+    sendBeacon(RELAY_A, 1, -60);
+    node->loopOnce();
+  }
+  TEST_ASSERT_EQUAL_UINT32(3, s.retries);
+  TEST_ASSERT_EQUAL_UINT32(1, s.timeouts);
+}
+
+void test_beacons_only_with_route_and_neighbor_timeout() {
+  node->initEspNowOnChannel(6);
+  node->loopOnce();
+  TEST_ASSERT_EQUAL(0, sentOfType(PWR_MESH_BEACON_TYPE).size());
+
+  sendHello(6, -50);
+  node->loopOnce();
+  std::vector<PowerHalHost::Frame> b = sentOfType(PWR_MESH_BEACON_TYPE);
+  TEST_ASSERT_EQUAL(1, b.size());
+  TEST_ASSERT_EQUAL_MEMORY(BCAST, b[0].mac, 6);
+  PowerMeshBeaconPacket bp;
+  memcpy(&bp, b[0].data.data(), sizeof(bp));
+  TEST_ASSERT_EQUAL_UINT8(1, bp.hops);
+  TEST_ASSERT_EQUAL_UINT8(6, bp.ch);
+  TEST_ASSERT_EQUAL_MEMORY(DEFAULT_MASTER_MAC, bp.master, 6);
+
+  //master sparito: dopo neighborTimeoutMs niente rotta e niente BEACON
+  hal->advance(5000);
+  hal->clearSent();
+  node->loopOnce();
+  TEST_ASSERT_EQUAL_UINT8(MESH_NO_ROUTE, node->mesh().hops());
+  TEST_ASSERT_NULL(node->mesh().parent());
+  hal->advance(2000);
+  node->loopOnce();
+  TEST_ASSERT_EQUAL(0, sentOfType(PWR_MESH_BEACON_TYPE).size());
+}
+
+//più figli dei peer ESP-NOW disponibili: la cache toglie i meno usati anche dalla radio, il master resta
+void test_peer_table_evicts_lru_and_keeps_master() {
+  sendHello(6, -50);
+  hal->clearSent();
+
+  PowerStatePacket st = { PWR_STATE_TYPE, 0, 1, 1, 0 };
+  const int CHILDREN = 24;
+  for (int i = 0; i < CHILDREN; i++) {
+    uint8_t child[6] = {0x24, 0x0A, 0xC4, 0x00, 0x01, (uint8_t)i};
+    deliverFrame(child, envelope(PWR_MESH_DATA_TYPE, MESH_UP, MESH_MAX_HOPS, 0, child, 1, &st, sizeof(st)));
+    deliverFrame(DEFAULT_MASTER_MAC, envelope(PWR_MESH_ACK_TYPE, 0, MESH_MAX_HOPS, 0, child, 1));
+    TEST_ASSERT_TRUE(hal->peerCount() <= MESH_MAX_PEERS + 1);
+  }
+
+  const PowerMeshStats& s = node->mesh().stats();
+  TEST_ASSERT_EQUAL_UINT32(0, s.sendFail);
+  TEST_ASSERT_EQUAL_UINT32(CHILDREN, s.forwardedUp);
+  TEST_ASSERT_EQUAL_UINT32(CHILDREN, s.forwardedDown);
+
+  //il master è ancora un peer: i pacchetti diretti del nodo partono
+  hal->clearSent();
+  sendHello(6, -50);
+  TEST_ASSERT_EQUAL(0, sentOfType(PWR_MESH_DATA_TYPE).size());
+  PowerCmdPacket c = { PWR_CMD_TYPE, 0x01, 0x01, 1, 0 };
+  hal->deliver(DEFAULT_MASTER_MAC, c);
+  TEST_ASSERT_EQUAL_UINT8(PWR_STATE_TYPE, hal->sent().back().type());
+  TEST_ASSERT_EQUAL_MEMORY(DEFAULT_MASTER_MAC, hal->sent().back().mac, 6);
+}
+
+void test_host_peer_table_has_espnow_limit() {
+  for (size_t i = 0; i < HOST_ESP_NOW_MAX_PEERS + 4; i++) {
+    uint8_t mac[6] = {0x24, 0x0A, 0xC4, 0x00, 0x02, (uint8_t)i};
+    hal->radioAddPeer(mac);
+  }
+  TEST_ASSERT_EQUAL(HOST_ESP_NOW_MAX_PEERS, hal->peerCount());
+  uint8_t extra[6] = {0x24, 0x0A, 0xC4, 0x00, 0x03, 0x00};
+  TEST_ASSERT_NOT_EQUAL(0, hal->radioAddPeer(extra));
+  uint8_t first[6] = {0x24, 0x0A, 0xC4, 0x00, 0x02, 0x00};
+  TEST_ASSERT_EQUAL(0, hal->radioDelPeer(first));
+  TEST_ASSERT_EQUAL(0, hal->radioAddPeer(extra));
+  TEST_ASSERT_NOT_EQUAL(0, hal->radioDelPeer(first));
+}
+
+//coda TX piena nel trasporto (Medium del fleet_sim): radioSend deve fallire come esp_now_send
+class FullQueueHal : public PowerHalHost {
+protected:
+  bool transmit(const Frame&) override { return false; }
+};
+
+void test_host_transmit_failure_reaches_firmware() {
+  FullQueueHal full;
+  PowerNode n(full);
+  n.enableMesh();
+  n.begin();
+  n.initEspNowOnChannel(1);
+  full.radioAddPeer(RELAY_A);
+  static const uint8_t payload[1] = { PWR_STATE_TYPE };
+  TEST_ASSERT_NOT_EQUAL(0, full.radioSend(RELAY_A, payload, sizeof(payload)));
+
+  PowerMeshBeaconPacket b = { PWR_MESH_BEACON_TYPE, 6, 1, {0}, 0 };
+  memcpy(b.master, DEFAULT_MASTER_MAC, 6);
+  full.deliver(RELAY_A, &b, sizeof(b), -60); //HELLO_ACK + STATE in busta: entrambi falliscono
+  TEST_ASSERT_EQUAL_UINT32(2, n.mesh().stats().sendFail);
+}
+
+//sull'ESP32 il lock è un mutex non ricorsivo: mai preso due volte, sempre rilasciato
+struct LockTrace {
+  int depth;
+  int maxDepth;
+  int takes;
+};
+
+static void traceLock(void* ctx, bool lock) {
+  LockTrace* t = static_cast<LockTrace*>(ctx);
+  t->depth += lock ? 1 : -1;
+  if (lock) t->takes++;
+  if (t->depth > t->maxDepth) t->maxDepth = t->depth;
+}
+
+void test_mesh_lock_is_balanced_and_not_nested() {
+  LockTrace t = { 0, 0, 0 };
+  node->setMeshLock(traceLock, &t);
+
+  sendBeacon(RELAY_A, 1, -60);
+  //CMD sceso: la consegna alla logica (che risponde con sendUp) avviene a lock rilasciato
+  PowerCmdPacket c = { PWR_CMD_TYPE, 0x01, 0x01, 1, 0 };
+  deliverFrame(RELAY_A, envelope(PWR_MESH_DATA_TYPE, MESH_WANT_ACK, MESH_MAX_HOPS - 1, 1, MY_MAC, 5, &c, sizeof(c)));
+  TEST_ASSERT_TRUE(node->relayMaskGet(1));
+  PowerStatePacket st = { PWR_STATE_TYPE, 0, 1, 1, 0 };
+  deliverFrame(CHILD, envelope(PWR_MESH_DATA_TYPE, MESH_UP, MESH_MAX_HOPS, 0, CHILD, 1, &st, sizeof(st)));
+  deliverFrame(RELAY_A, envelope(PWR_MESH_ACK_TYPE, 0, MESH_MAX_HOPS - 1, 1, MY_MAC, 1));
+  hal->advance(1000);
+  node->loopOnce();
+
+  TEST_ASSERT_TRUE(t.takes > 0);
+  TEST_ASSERT_EQUAL(1, t.maxDepth);
+  TEST_ASSERT_EQUAL(0, t.depth);
+  node->setMeshLock(nullptr, nullptr);
+}
+
+//reset del nodo (watchdog, corrente): il master ricorda ancora gli ultimi (nodo, seq) di prima
+void test_reboot_data_is_not_taken_for_duplicates() {
+  PowerMeshDedup master;
+  uint32_t delivered = 0, frames = 0;
+  for (int boot = 0; boot < 2; boot++) {
+    if (boot) {
+      delete node;
+      node = new PowerNode(*hal); //stessa HAL: NVS e RTC sopravvivono come sull'ESP32
+      node->enableMesh();
+      node->begin();
+      node->initEspNowOnChannel(1);
+    }
+    hal->clearSent();
+    sendBeacon(RELAY_A, 1, -60); //HELLO_ACK + STATE
+    for (uint16_t i = 0; i < 6; i++) { //6 CMD scesi -> 6 STATE
+      PowerCmdPacket c = { PWR_CMD_TYPE, 0x01, (uint8_t)(i & 1), 1, 0 };
+      deliverFrame(RELAY_A, envelope(PWR_MESH_DATA_TYPE, MESH_WANT_ACK, MESH_MAX_HOPS - 1, 1, MY_MAC,
+                                     (uint16_t)(100 + i), &c, sizeof(c)));
+    }
+    for (const PowerHalHost::Frame& f : sentOfType(PWR_MESH_DATA_TYPE)) {
+      PowerMeshHeader h = headerOf(f);
+      frames++;
+      if (!master.seen(h.node, h.seq, meshDeliverTag(h))) delivered++;
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32(16, frames);
+  TEST_ASSERT_EQUAL_UINT32(frames, delivered);
+}
+
+void test_child_is_never_chosen_as_parent() {
+  sendBeacon(RELAY_A, 1, -70);
+  PowerStatePacket st = { PWR_STATE_TYPE, 0, 1, 1, 0 };
+  deliverFrame(CHILD, envelope(PWR_MESH_DATA_TYPE, MESH_UP, MESH_MAX_HOPS, 0, CHILD, 1, &st, sizeof(st)));
+
+  //il figlio annuncia 1 hop (magari ha appena perso la sua strada): farebbe un anello
+  sendBeacon(CHILD, 1, -40);
+  TEST_ASSERT_EQUAL_MEMORY(RELAY_A, node->mesh().parent(), 6);
+}
+
+void test_mesh_off_ignores_mesh_frames() {
+  PowerHalHost plainHal;
+  PowerNode plain(plainHal);
+  plain.begin();
+  plain.initEspNowOnChannel(1);
+
+  PowerMeshBeaconPacket b = { PWR_MESH_BEACON_TYPE, 6, 1, {0}, 0 };
+  plainHal.deliver(RELAY_A, b);
+  TEST_ASSERT_FALSE(plain.channelReady());
+
+  HelloPacket h = { HELLO_TYPE, 6, 0 };
+  plainHal.deliver(DEFAULT_MASTER_MAC, h);
+  plainHal.clearSent();
+
+  PowerCmdPacket c = { PWR_CMD_TYPE, 0x01, 0x01, 1, 0 };
+  std::vector<uint8_t> f = envelope(PWR_MESH_DATA_TYPE, MESH_WANT_ACK, MESH_MAX_HOPS, 0, MY_MAC, 1, &c, sizeof(c));
+  plainHal.deliver(RELAY_A, f.data(), f.size());
+  TEST_ASSERT_EQUAL_UINT8(0, plain.relayMask());
+  TEST_ASSERT_EQUAL(0, plainHal.sent().size());
+  TEST_ASSERT_FALSE(plain.mesh().enabled());
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST(test_mesh_wire_sizes);
+  RUN_TEST(test_master_in_range_stays_plain);
+  RUN_TEST(test_beacon_locks_channel_and_wraps_traffic_to_parent);
+  RUN_TEST(test_weak_neighbor_is_not_a_route);
+  RUN_TEST(test_parent_prefers_fewer_hops_with_hysteresis);
+  RUN_TEST(test_relay_forwards_up_learns_route_and_forwards_down);
+  RUN_TEST(test_duplicates_and_ttl_are_dropped);
+  RUN_TEST(test_ack_of_retry_is_forwarded_after_lost_ack);
+  RUN_TEST(test_node_ack_carries_data_attempt);
+  RUN_TEST(test_down_data_is_delivered_once_and_always_acked);
+  RUN_TEST(test_end_to_end_retry_rtt_and_timeout);
+  RUN_TEST(test_beacons_only_with_route_and_neighbor_timeout);
+  RUN_TEST(test_peer_table_evicts_lru_and_keeps_master);
+  RUN_TEST(test_host_peer_table_has_espnow_limit);
+  RUN_TEST(test_host_transmit_failure_reaches_firmware);
+  RUN_TEST(test_mesh_lock_is_balanced_and_not_nested);
+  RUN_TEST(test_reboot_data_is_not_taken_for_duplicates);
+  RUN_TEST(test_child_is_never_chosen_as_parent);
+  RUN_TEST(test_mesh_off_ignores_mesh_frames);
+  return UNITY_END();
+}
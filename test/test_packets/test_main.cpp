@@ -0,0 +1,222 @@
+// Test host della gestione pacchetti ESP-NOW (onEspNowRecv)
+//   pio test -e native -f test_packets
+
+#include <unity.h>
+#include <string.h>
+
+#include "power_hal_host.h"
+#include "power_node.h"
+
+static PowerHalHost* hal;
+static PowerNode* node;
+
+static void sendHello(uint8_t ch) {
+  HelloPacket h = { HELLO_TYPE, ch, 1234 };
+  hal->deliver(DEFAULT_MASTER_MAC, h);
+}
+
+template <typename T> static T sentAs(size_t i) {
+  T p;
+  TEST_ASSERT_TRUE(i < hal->sent().size());
+  TEST_ASSERT_EQUAL(sizeof(T), hal->sent()[i].data.size());
+  memcpy(&p, hal->sent()[i].data.data(), sizeof(p));
+  return p;
+}
+
+void setUp() {
+  hal = new PowerHalHost();
+  node = new PowerNode(*hal);
+  node->begin();
+  node->initEspNowOnChannel(1);
+}
+
+void tearDown() {
+  delete node;
+  delete hal;
+}
+
+void test_wire_sizes() {
+  TEST_ASSERT_EQUAL(6, sizeof(HelloPacket));
+  TEST_ASSERT_EQUAL(7, sizeof(HelloAckPacket));
+  TEST_ASSERT_EQUAL(8, sizeof(PowerCmdPacket));
+  TEST_ASSERT_EQUAL(47, sizeof(PowerRelayRulesPacket));
+  TEST_ASSERT_EQUAL(8, sizeof(PowerStatePacket));
+  TEST_ASSERT_EQUAL(9, sizeof(PowerTimePacket));
+  TEST_ASSERT_EQUAL(8, sizeof(PowerScheduleAckPacket));
+  TEST_ASSERT_EQUAL(10, sizeof(PowerExecutedPacket));
+  TEST_ASSERT_EQUAL(8, sizeof(PowerErrorPacket));
+}
+
+void test_ignores_everything_before_hello() {
+  PowerCmdPacket c = { PWR_CMD_TYPE, 0x0F, 0x0F, 0, 0 };
+  hal->deliver(DEFAULT_MASTER_MAC, c);
+  PowerTimePacket t = { PWR_TIME_TYPE, 100, 0, 1, 0 };
+  hal->deliver(DEFAULT_MASTER_MAC, t);
+
+  TEST_ASSERT_FALSE(node->channelReady());
+  TEST_ASSERT_EQUAL_UINT8(0, node->relayMask());
+  TEST_ASSERT_FALSE(node->timeValid());
+  TEST_ASSERT_EQUAL(0, hal->sent().size());
+}
+
+void test_hello_locks_channel_and_acks() {
+  sendHello(6);
+
+  TEST_ASSERT_TRUE(node->channelReady());
+  TEST_ASSERT_EQUAL_UINT8(6, node->channel());
+  TEST_ASSERT_EQUAL_UINT8(6, hal->radioChannel());
+  TEST_ASSERT_EQUAL(2, hal->sent().size());
+  TEST_ASSERT_EQUAL_MEMORY(DEFAULT_MASTER_MAC, hal->sent()[0].mac, 6);
+
+  HelloAckPacket a = sentAs<HelloAckPacket>(0);
+  TEST_ASSERT_EQUAL_UINT8(PWR_HELLO_ACK_TYPE, a.type);
+  TEST_ASSERT_EQUAL_UINT8(6, a.ch);
+  TEST_ASSERT_EQUAL_UINT8(1, a.ok);
+
+  PowerStatePacket st = sentAs<PowerStatePacket>(1);
+  TEST_ASSERT_EQUAL_UINT8(PWR_STATE_TYPE, st.type);
+  TEST_ASSERT_EQUAL_UINT8(0, st.timeValid);
+}
+
+void test_hello_invalid_channel_keeps_current() {
+  sendHello(14);
+  TEST_ASSERT_TRUE(node->channelReady());
+  TEST_ASSERT_EQUAL_UINT8(1, node->channel());
+}
+
+void test_cmd_sets_only_masked_relays() {
+  sendHello(1);
+  hal->clearSent();
+
+  PowerCmdPacket c = { PWR_CMD_TYPE, 0x05, 0x05, 0, 0 };
+  hal->deliver(DEFAULT_MASTER_MAC, c);
+  TEST_ASSERT_EQUAL_UINT8(0x05, node->relayMask());
+
+  PowerCmdPacket c2 = { PWR_CMD_TYPE, 0x03, 0x02, 0, 0 };
+  hal->deliver(DEFAULT_MASTER_MAC, c2);
+  TEST_ASSERT_EQUAL_UINT8(0x06, node->relayMask());
+  TEST_ASSERT_TRUE(hal->pinLevel(RELAY_PINS[0]));
+  TEST_ASSERT_FALSE(hal->pinLevel(RELAY_PINS[1]));
+  TEST_ASSERT_FALSE(hal->pinLevel(RELAY_PINS[2]));
+  TEST_ASSERT_TRUE(hal->pinLevel(RELAY_PINS[3]));
+
+  TEST_ASSERT_EQUAL(2, hal->sent().size());
+  TEST_ASSERT_EQUAL_UINT8(0x06, sentAs<PowerStatePacket>(1).relayMask);
+}
+
+void test_state_reports_reset_reason() {
+  hal->setResetReason(4 /*ESP_RST_PANIC*/);
+  sendHello(1);
+  TEST_ASSERT_EQUAL_UINT8(4, sentAs<PowerStatePacket>(1).resetReason);
+}
+
+void test_rules_ack_ok() {
+  sendHello(1);
+  hal->clearSent();
+
+  PowerRelayRulesPacket rp;
+  memset(&rp, 0, sizeof(rp));
+  rp.type = PWR_RELAYRULE_TYPE;
+  rp.ch = 2;
+  rp.count = 3;
+  rp.rules[2] = { 1000, 1, 0x1F };
+  hal->deliver(DEFAULT_MASTER_MAC, rp);
+
+  TEST_ASSERT_EQUAL_UINT8(3, node->ruleCount(2));
+  TEST_ASSERT_EQUAL_UINT16(1000, node->rule(2, 2).minuteOfDay);
+
+  PowerScheduleAckPacket ack = sentAs<PowerScheduleAckPacket>(0);
+  TEST_ASSERT_EQUAL_UINT8(PWR_SCHED_ACK_TYPE, ack.type);
+  TEST_ASSERT_EQUAL_UINT8(2, ack.ch);
+  TEST_ASSERT_EQUAL_UINT8(1, ack.ok);
+  TEST_ASSERT_EQUAL_UINT8(3, ack.count);
+  TEST_ASSERT_EQUAL_UINT8(PWR_STATE_TYPE, hal->sent()[1].type());
+}
+
+void test_rules_count_clamped() {
+  sendHello(1);
+
+  PowerRelayRulesPacket rp;
+  memset(&rp, 0, sizeof(rp));
+  rp.type = PWR_RELAYRULE_TYPE;
+  rp.ch = 1;
+  rp.count = 200;
+  hal->deliver(DEFAULT_MASTER_MAC, rp);
+
+  TEST_ASSERT_EQUAL_UINT8(MAX_RULES, node->ruleCount(1));
+}
+
+void test_rules_invalid_channel_nacks_with_error() {
+  sendHello(1);
+  hal->clearSent();
+
+  PowerRelayRulesPacket rp;
+  memset(&rp, 0, sizeof(rp));
+  rp.type = PWR_RELAYRULE_TYPE;
+  rp.ch = 9;
+  hal->deliver(DEFAULT_MASTER_MAC, rp);
+
+  //l'ACK con ch fuori range non parte: resta solo l'ERROR
+  TEST_ASSERT_EQUAL(1, hal->sent().size());
+  PowerErrorPacket er = sentAs<PowerErrorPacket>(0);
+  TEST_ASSERT_EQUAL_UINT8(PWR_ERROR_TYPE, er.type);
+  TEST_ASSERT_EQUAL_UINT8(PWR_ERR_INVALID_CH, er.code);
+  TEST_ASSERT_EQUAL_UINT8(9, er.ch);
+}
+
+void test_time_invalid_clears_valid_flag() {
+  sendHello(1);
+  PowerTimePacket t = { PWR_TIME_TYPE, 1500, 9, 1, 0 };
+  hal->deliver(DEFAULT_MASTER_MAC, t);
+  TEST_ASSERT_TRUE(node->timeValid());
+  TEST_ASSERT_EQUAL_UINT16(60, node->minuteOfDay());
+  TEST_ASSERT_EQUAL_UINT8(2, node->weekday());
+
+  t.valid = 0;
+  hal->deliver(DEFAULT_MASTER_MAC, t);
+  TEST_ASSERT_FALSE(node->timeValid());
+}
+
+void test_unknown_length_and_wrong_type_ignored() {
+  sendHello(1);
+  hal->clearSent();
+
+  uint8_t junk[5] = { PWR_CMD_TYPE, 1, 1, 0, 0 };
+  hal->deliver(DEFAULT_MASTER_MAC, junk, sizeof(junk));
+
+  //stessa lunghezza di CMD ma tipo STATE
+  PowerCmdPacket c = { PWR_STATE_TYPE, 0x0F, 0x0F, 0, 0 };
+  hal->deliver(DEFAULT_MASTER_MAC, c);
+
+  TEST_ASSERT_EQUAL_UINT8(0, node->relayMask());
+  TEST_ASSERT_EQUAL(0, hal->sent().size());
+}
+
+void test_blocking_scan_finds_hello() {
+  //nessun HELLO: la scansione esaurisce i giri e ritorna false in tempo virtuale
+  TEST_ASSERT_FALSE(node->findChannelFromHello(7000));
+  TEST_ASSERT_TRUE(hal->millis() >= 7000);
+
+  node->scanStart(7000);
+  TEST_ASSERT_EQUAL(PowerNode::SCAN_RUNNING, node->scanPoll());
+  sendHello(11);
+  TEST_ASSERT_EQUAL(PowerNode::SCAN_FOUND, node->scanPoll());
+  TEST_ASSERT_EQUAL_INT8(11, hal->rtcLockedChannel());
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST(test_wire_sizes);
+  RUN_TEST(test_ignores_everything_before_hello);
+  RUN_TEST(test_hello_locks_channel_and_acks);
+  RUN_TEST(test_hello_invalid_channel_keeps_current);
+  RUN_TEST(test_cmd_sets_only_masked_relays);
+  RUN_TEST(test_state_reports_reset_reason);
+  RUN_TEST(test_rules_ack_ok);
+  RUN_TEST(test_rules_count_clamped);
+  RUN_TEST(test_rules_invalid_channel_nacks_with_error);
+  RUN_TEST(test_time_invalid_clears_valid_flag);
+  RUN_TEST(test_unknown_length_and_wrong_type_ignored);
+  RUN_TEST(test_blocking_scan_finds_hello);
+  return UNITY_END();
+}
@@ -0,0 +1,140 @@
+// Test host della persistenza NVS (regole, maschera relè) attraverso un "reboot":
+// stessa PowerHalHost (la flash), nuovo PowerNode (la RAM).
+//   pio test -e native -f test_persistence
+
+#include <unity.h>
+#include <string.h>
+
+#include "power_hal_host.h"
+#include "power_node.h"
+
+static PowerHalHost* hal;
+static PowerNode* node;
+
+static void bootNode() {
+  delete node;
+  node = new PowerNode(*hal);
+  node->begin();
+  node->initEspNowOnChannel(1);
+  HelloPacket h = { HELLO_TYPE, 1, 0 };
+  hal->deliver(DEFAULT_MASTER_MAC, h);
+  hal->clearSent();
+}
+
+static PowerRelayRulesPacket makeRules(uint8_t ch, uint8_t count) {
+  PowerRelayRulesPacket rp;
+  memset(&rp, 0, sizeof(rp));
+  rp.type = PWR_RELAYRULE_TYPE;
+  rp.ch = ch;
+  rp.count = count;
+  for (uint8_t k = 0; k < count && k < MAX_RULES; k++) {
+    rp.rules[k].minuteOfDay = 60 * k + ch;
+    rp.rules[k].on = k & 1;
+    rp.rules[k].daysMask = 0x7F;
+  }
+  return rp;
+}
+
+void setUp() {
+  hal = new PowerHalHost();
+  node = nullptr;
+  bootNode();
+}
+
+void tearDown() {
+  delete node;
+  delete hal;
+}
+
+void test_rules_survive_reboot() {
+  hal->deliver(DEFAULT_MASTER_MAC, makeRules(1, 4));
+  hal->deliver(DEFAULT_MASTER_MAC, makeRules(4, 10));
+
+  bootNode();
+
+  TEST_ASSERT_EQUAL_UINT8(4, node->ruleCount(1));
+  TEST_ASSERT_EQUAL_UINT8(0, node->ruleCount(2));
+  TEST_ASSERT_EQUAL_UINT8(10, node->ruleCount(4));
+  TEST_ASSERT_EQUAL_UINT16(60 * 3 + 1, node->rule(1, 3).minuteOfDay);
+  TEST_ASSERT_EQUAL_UINT16(60 * 9 + 4, node->rule(4, 9).minuteOfDay);
+}
+
+void test_relay_mask_restored_on_boot() {
+  PowerCmdPacket c = { PWR_CMD_TYPE, 0x0F, 0x09, 0, 0 };
+  hal->deliver(DEFAULT_MASTER_MAC, c);
+
+  //al reboot i pin tornano OFF e poi vengono riportati allo stato salvato
+  hal->pinWrite(RELAY_PINS[0], true);
+  bootNode();
+
+  TEST_ASSERT_EQUAL_UINT8(0x09, node->relayMask());
+  TEST_ASSERT_TRUE(hal->pinIsOutput(RELAY_PINS[0]));
+  TEST_ASSERT_FALSE(hal->pinLevel(RELAY_PINS[0]));
+  TEST_ASSERT_TRUE(hal->pinLevel(RELAY_PINS[1]));
+  TEST_ASSERT_FALSE(hal->pinLevel(RELAY_PINS[3]));
+}
+
+void test_relay_mask_written_only_on_change() {
+  PowerCmdPacket c = { PWR_CMD_TYPE, 0x01, 0x01, 0, 0 };
+  hal->deliver(DEFAULT_MASTER_MAC, c);
+  uint32_t w = hal->nvsWrites();
+
+  hal->deliver(DEFAULT_MASTER_MAC, c);
+  TEST_ASSERT_EQUAL_UINT32(w, hal->nvsWrites());
+}
+
+void test_nvs_fail_sends_nack_and_error() {
+  hal->setNvsWriteFail(true);
+  hal->deliver(DEFAULT_MASTER_MAC, makeRules(3, 2));
+
+  TEST_ASSERT_EQUAL(3, hal->sent().size());
+
+  PowerScheduleAckPacket ack;
+  memcpy(&ack, hal->sent()[0].data.data(), sizeof(ack));
+  TEST_ASSERT_EQUAL_UINT8(PWR_SCHED_ACK_TYPE, ack.type);
+  TEST_ASSERT_EQUAL_UINT8(0, ack.ok);
+
+  PowerErrorPacket er;
+  memcpy(&er, hal->sent()[1].data.data(), sizeof(er));
+  TEST_ASSERT_EQUAL_UINT8(PWR_ERROR_TYPE, er.type);
+  TEST_ASSERT_EQUAL_UINT8(PWR_ERR_NVS_SAVE_FAIL, er.code);
+  TEST_ASSERT_EQUAL_UINT8(3, er.ch);
+  TEST_ASSERT_EQUAL_UINT8(2, er.extra);
+
+  TEST_ASSERT_EQUAL_UINT8(PWR_STATE_TYPE, hal->sent()[2].type());
+
+  //in RAM le regole ci sono, ma dopo il reboot no
+  TEST_ASSERT_EQUAL_UINT8(2, node->ruleCount(3));
+  hal->setNvsWriteFail(false);
+  bootNode();
+  TEST_ASSERT_EQUAL_UINT8(0, node->ruleCount(3));
+}
+
+void test_corrupt_rule_blob_discarded() {
+  hal->deliver(DEFAULT_MASTER_MAC, makeRules(2, 5));
+
+  uint8_t shortBlob[7] = {0};
+  hal->nvsPutBytes("rb2", shortBlob, sizeof(shortBlob));
+  bootNode();
+
+  TEST_ASSERT_EQUAL_UINT8(0, node->ruleCount(2));
+}
+
+void test_stored_count_clamped() {
+  hal->deliver(DEFAULT_MASTER_MAC, makeRules(1, 3));
+  hal->nvsPutUChar("rc1", 99);
+  bootNode();
+
+  TEST_ASSERT_EQUAL_UINT8(MAX_RULES, node->ruleCount(1));
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST(test_rules_survive_reboot);
+  RUN_TEST(test_relay_mask_restored_on_boot);
+  RUN_TEST(test_relay_mask_written_only_on_change);
+  RUN_TEST(test_nvs_fail_sends_nack_and_error);
+  RUN_TEST(test_corrupt_rule_blob_discarded);
+  RUN_TEST(test_stored_count_clamped);
+  return UNITY_END();
+}
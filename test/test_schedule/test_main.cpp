@@ -0,0 +1,176 @@
+// Test host del motore schedulazioni (applyRulesExactNow + avanzamento minuti in loopOnce)
+//   pio test -e native -f test_schedule
+
+#include <unity.h>
+#include <string.h>
+
+#include "power_hal_host.h"
+#include "power_node.h"
+
+static PowerHalHost* hal;
+static PowerNode* node;
+
+static const uint8_t MON = 0, TUE = 1, SUN = 6;
+static const uint8_t ALL_DAYS = 0x7F;
+
+static void sendHello(uint8_t ch = 1) {
+  HelloPacket h = { HELLO_TYPE, ch, 0 };
+  hal->deliver(DEFAULT_MASTER_MAC, h);
+}
+
+static void sendTime(uint16_t minuteOfDay, uint8_t wd, uint8_t valid = 1) {
+  PowerTimePacket t = { PWR_TIME_TYPE, minuteOfDay, wd, valid, 0 };
+  hal->deliver(DEFAULT_MASTER_MAC, t);
+}
+
+static void sendRule(uint8_t ch, uint16_t at, bool on, uint8_t days = ALL_DAYS) {
+  PowerRelayRulesPacket rp;
+  memset(&rp, 0, sizeof(rp));
+  rp.type = PWR_RELAYRULE_TYPE;
+  rp.ch = ch;
+  rp.count = 1;
+  rp.rules[0].minuteOfDay = at;
+  rp.rules[0].on = on ? 1 : 0;
+  rp.rules[0].daysMask = days;
+  hal->deliver(DEFAULT_MASTER_MAC, rp);
+}
+
+//avanza il tempo virtuale di n minuti con un loopOnce() per minuto (come loop() ogni 20ms)
+static void runMinutes(uint32_t n) {
+  for (uint32_t i = 0; i < n; i++) {
+    hal->advance(60000UL);
+    node->loopOnce();
+  }
+}
+
+static size_t countSent(uint8_t type) {
+  size_t n = 0;
+  for (size_t i = 0; i < hal->sent().size(); i++) if (hal->sent()[i].type() == type) n++;
+  return n;
+}
+
+void setUp() {
+  hal = new PowerHalHost();
+  node = new PowerNode(*hal);
+  node->begin();
+  node->initEspNowOnChannel(1);
+  sendHello();
+  hal->clearSent();
+}
+
+void tearDown() {
+  delete node;
+  delete hal;
+}
+
+void test_no_time_no_fire() {
+  sendRule(1, 420, true);
+  TEST_ASSERT_FALSE(node->applyRulesExactNow(true));
+  TEST_ASSERT_EQUAL_UINT8(0, node->relayMask());
+}
+
+void test_rule_arrival_does_not_normalize() {
+  sendTime(600, MON);
+  sendRule(1, 420, true); //regola già "passata": non deve accendere subito
+  TEST_ASSERT_EQUAL_UINT8(0, node->relayMask());
+}
+
+void test_fires_exactly_at_minute() {
+  sendRule(1, 420, true);
+  sendTime(418, MON);
+  hal->clearSent();
+
+  runMinutes(1);
+  TEST_ASSERT_EQUAL_UINT8(0, node->relayMask());
+
+  runMinutes(1);
+  TEST_ASSERT_EQUAL_UINT16(420, node->minuteOfDay());
+  TEST_ASSERT_EQUAL_UINT8(0x01, node->relayMask());
+  TEST_ASSERT_FALSE(hal->pinLevel(RELAY_PINS[0])); //active low: ON = LOW
+  TEST_ASSERT_EQUAL(1, countSent(PWR_EXECUTED_TYPE));
+  TEST_ASSERT_EQUAL(1, countSent(PWR_STATE_TYPE));
+
+  PowerExecutedPacket ex;
+  memcpy(&ex, hal->sent()[0].data.data(), sizeof(ex));
+  TEST_ASSERT_EQUAL_UINT8(1, ex.ch);
+  TEST_ASSERT_EQUAL_UINT8(1, ex.state);
+  TEST_ASSERT_EQUAL_UINT16(420, ex.minuteOfDay);
+  TEST_ASSERT_EQUAL_UINT8(MON, ex.weekdayMon0);
+}
+
+void test_time_sync_on_minute_applies_without_executed() {
+  sendRule(2, 420, true);
+  hal->clearSent();
+
+  sendTime(420, MON);
+  TEST_ASSERT_EQUAL_UINT8(0x02, node->relayMask());
+  TEST_ASSERT_EQUAL(0, countSent(PWR_EXECUTED_TYPE));
+}
+
+void test_already_in_state_is_not_changed() {
+  PowerCmdPacket c = { PWR_CMD_TYPE, 0x01, 0x01, 0, 0 };
+  hal->deliver(DEFAULT_MASTER_MAC, c);
+  sendRule(1, 420, true);
+  sendTime(420, MON);
+  hal->clearSent();
+
+  TEST_ASSERT_FALSE(node->applyRulesExactNow(true));
+  TEST_ASSERT_EQUAL(0, countSent(PWR_EXECUTED_TYPE));
+}
+
+void test_day_mask_respected() {
+  sendRule(1, 420, true, 1 << TUE);
+  sendTime(420, MON);
+  TEST_ASSERT_EQUAL_UINT8(0, node->relayMask());
+
+  sendTime(420, TUE);
+  TEST_ASSERT_EQUAL_UINT8(0x01, node->relayMask());
+}
+
+void test_invalid_minute_ignored() {
+  sendRule(1, 1440, true);
+  sendTime(0, MON);
+  TEST_ASSERT_FALSE(node->applyRulesExactNow(true));
+}
+
+void test_midnight_rollover() {
+  sendRule(3, 0, true, 1 << MON);
+  sendTime(1439, SUN);
+
+  runMinutes(1);
+  TEST_ASSERT_EQUAL_UINT16(0, node->minuteOfDay());
+  TEST_ASSERT_EQUAL_UINT8(MON, node->weekday());
+  TEST_ASSERT_EQUAL_UINT8(0x04, node->relayMask());
+}
+
+void test_on_then_off_same_day() {
+  PowerRelayRulesPacket rp;
+  memset(&rp, 0, sizeof(rp));
+  rp.type = PWR_RELAYRULE_TYPE;
+  rp.ch = 4;
+  rp.count = 2;
+  rp.rules[0] = { 420, 1, ALL_DAYS };
+  rp.rules[1] = { 422, 0, ALL_DAYS };
+  hal->deliver(DEFAULT_MASTER_MAC, rp);
+  sendTime(419, MON);
+
+  runMinutes(1);
+  TEST_ASSERT_EQUAL_UINT8(0x08, node->relayMask());
+  runMinutes(2);
+  TEST_ASSERT_EQUAL_UINT8(0x00, node->relayMask());
+  TEST_ASSERT_TRUE(hal->pinLevel(RELAY_PINS[3]));
+}
+
+int main(int, char**) {
+  UNITY_BEGIN();
+  RUN_TEST(test_no_time_no_fire);
+  RUN_TEST(test_rule_arrival_does_not_normalize);
+  RUN_TEST(test_fires_exactly_at_minute);
+  RUN_TEST(test_time_sync_on_minute_applies_without_executed);
+  RUN_TEST(test_already_in_state_is_not_changed);
+  RUN_TEST(test_day_mask_respected);
+  RUN_TEST(test_invalid_minute_ignored);
+  RUN_TEST(test_midnight_rollover);
+  RUN_TEST(test_on_then_off_same_day);
+  return UNITY_END();
+}
@@ -0,0 +1,183 @@
+/*
+  EVE-POWER bench (Linux) - microbenchmark della logica del nodo (lib/power_bench)
+  Parsing e gestione di ogni tipo di pacchetto, motore regole al crescere delle regole,
+  loopOnce. HAL in memoria con la radio muta: si misura la logica, non la PowerHalHost.
+  Output: una riga JSON per caso (più una riga "meta"); la versione per ESP32 è tools/bench_target.
+
+  uso: bench [--samples N] [--batch B] [--rounds R] [--out FILE]
+       bench --compare VECCHIO NUOVO [--tolerance PCT] [--field p50|min]
+    --batch B   : chiamate per campione (default 2000, il contatore è in ns)
+    --rounds R  : ripete tutta la serie R volte (default 5) e per ogni caso tiene il giro col min
+                  più basso: un momento rumoroso dell'host non sposta più tutto il risultato
+    --compare   : confronta caso per caso due output (anche di bench_target, anche dentro un
+                  log seriale); exit 1 se un caso peggiora più di PCT% (default 15) e di
+                  almeno 5 unità.
+    --field     : di default min per i casi in ns (host: il p50 risente degli altri processi,
+                  due run dello stesso binario differivano fino a +57%) e p50 per i cicli
+                  (bench_target, senza scheduler di mezzo)
+  build: pio run -e bench   ->  .pio/build/bench/program
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "power_bench.h"
+#include "power_hal_host.h"
+#include "power_node.h"
+
+//radio muta: i frame inviati non si accumulano in sent()
+class BenchHal : public PowerHalHost {
+protected:
+  bool transmit(const Frame&) override { return true; }
+};
+
+static uint32_t counterNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec);
+}
+
+//righe di tutti i giri: per ogni caso resta quella col min più basso, le altre righe del primo giro
+struct RoundBest {
+  std::vector<std::string> order;
+  std::map<std::string, std::pair<double, std::string> > best;
+  bool first = true;
+};
+
+static void collectLine(void* ctx, const char* line) {
+  RoundBest* rb = (RoundBest*)ctx;
+  char name[64], unit[16];
+  double v;
+  if (!parseBenchLine(line, "min", name, sizeof(name), unit, sizeof(unit), v)) {
+    if (rb->first) rb->order.push_back(line);
+    return;
+  }
+  auto it = rb->best.find(name);
+  if (it == rb->best.end()) {
+    rb->order.push_back(std::string("\x01") + name);
+    rb->best[name] = std::make_pair(v, std::string(line));
+  } else if (v < it->second.first) {
+    it->second = std::make_pair(v, std::string(line));
+  }
+}
+
+static void usage() {
+  fprintf(stderr, "uso: bench [--samples N] [--batch B] [--rounds R] [--out FILE]\n"
+                  "     bench --compare VECCHIO NUOVO [--tolerance PCT] [--field p50|min]\n");
+}
+
+// ===================== CONFRONTO =====================
+//sotto questo scarto assoluto (ns o cicli) un caso non è mai una regressione: loop_idle e gpio_write
+//stanno in pochi ns e 1 ns in più sarebbe già +30%
+static const double MIN_DELTA = 5.0;
+
+struct BenchValue {
+  std::string unit;
+  double value;
+};
+
+//field nullptr = min per "ns", p50 per le altre unità
+static bool loadBench(const char* path, const char* field, std::vector<std::string>& order, std::map<std::string, BenchValue>& out) {
+  FILE* f = fopen(path, "r");
+  if (!f) { fprintf(stderr, "non riesco ad aprire %s\n", path); return false; }
+  char line[512], name[64], unit[16];
+  double v;
+  while (fgets(line, sizeof(line), f)) {
+    if (!parseBenchLine(line, field ? field : "min", name, sizeof(name), unit, sizeof(unit), v)) continue;
+    if (!field && strcmp(unit, "ns") != 0 &&
+        !parseBenchLine(line, "p50", name, sizeof(name), unit, sizeof(unit), v)) continue;
+    if (!out.count(name)) order.push_back(name);
+    out[name] = BenchValue{unit, v};
+  }
+  fclose(f);
+  if (out.empty()) { fprintf(stderr, "%s: nessuna riga bench\n", path); return false; }
+  return true;
+}
+
+static int compare(const char* oldPath, const char* newPath, const char* field, double tolerancePct) {
+  std::vector<std::string> oldOrder, newOrder;
+  std::map<std::string, BenchValue> oldB, newB;
+  if (!loadBench(oldPath, field, oldOrder, oldB) || !loadBench(newPath, field, newOrder, newB)) return 2;
+
+  int worse = 0;
+  printf("%-22s %12s %12s %8s   (%s)\n", "caso", "vecchio", "nuovo", "delta", field ? field : "min ns / p50 cicli");
+  for (const std::string& name : newOrder) {
+    const BenchValue& n = newB[name];
+    auto it = oldB.find(name);
+    if (it == oldB.end()) { printf("%-22s %12s %12.0f %8s\n", name.c_str(), "-", n.value, "nuovo"); continue; }
+    if (it->second.unit != n.unit) {
+      fprintf(stderr, "%s: unità diverse (%s / %s)\n", name.c_str(), it->second.unit.c_str(), n.unit.c_str());
+      return 2;
+    }
+    double delta = it->second.value > 0 ? (n.value / it->second.value - 1.0) * 100.0 : 0.0;
+    bool bad = delta > tolerancePct && n.value - it->second.value > MIN_DELTA;
+    if (bad) worse++;
+    printf("%-22s %12.0f %12.0f %+7.1f%%%s\n", name.c_str(), it->second.value, n.value, delta, bad ? "  PEGGIORATO" : "");
+  }
+  for (const std::string& name : oldOrder) {
+    if (!newB.count(name)) printf("%-22s %12.0f %12s %8s\n", name.c_str(), oldB[name].value, "-", "sparito");
+  }
+  printf("%s (%d casi oltre +%.0f%%)\n", worse ? "REGRESSIONE" : "OK", worse, tolerancePct);
+  return worse ? 1 : 0;
+}
+
+// ===================== MAIN =====================
+int main(int argc, char** argv) {
+  PowerBenchConfig cfg;
+  cfg.counter = counterNs;
+  cfg.unit = "ns";
+  cfg.unitsPerUs = 1000.0f;
+  cfg.samples = 100;
+  cfg.nvsSamples = 100;  //NVS in memoria: nessuna usura
+  cfg.batch = 2000;
+  const char* outPath = nullptr;
+  const char* cmpOld = nullptr;
+  const char* cmpNew = nullptr;
+  double tolerance = 15.0;
+  const char* field = nullptr;
+  int rounds = 5;
+
+  for (int i = 1; i < argc; i++) {
+    const char* a = argv[i];
+    const char* v = (i + 1 < argc) ? argv[i + 1] : nullptr;
+    if (!strcmp(a, "--samples") && v) { cfg.samples = cfg.nvsSamples = (uint16_t)atoi(v); i++; }
+    else if (!strcmp(a, "--batch") && v) { cfg.batch = (uint32_t)atoi(v); i++; }
+    else if (!strcmp(a, "--rounds") && v) { rounds = atoi(v) < 1 ? 1 : atoi(v); i++; }
+    else if (!strcmp(a, "--out") && v) { outPath = v; i++; }
+    else if (!strcmp(a, "--compare") && v && i + 2 < argc) { cmpOld = argv[i + 1]; cmpNew = argv[i + 2]; i += 2; }
+    else if (!strcmp(a, "--tolerance") && v) { tolerance = atof(v); i++; }
+    else if (!strcmp(a, "--field") && v) { field = v; i++; }
+    else { usage(); return 2; }
+  }
+
+  if (cmpOld) return compare(cmpOld, cmpNew, field, tolerance);
+
+  FILE* out = stdout;
+  if (outPath && !(out = fopen(outPath, "w"))) {
+    fprintf(stderr, "non riesco a scrivere %s\n", outPath);
+    return 2;
+  }
+
+  fprintf(out, "{\"meta\":\"power_bench\",\"target\":\"host\",\"unit\":\"ns\",\"compiler\":\"%s\",\"build\":\"%s %s\"}\n",
+          __VERSION__, __DATE__, __TIME__);
+
+  RoundBest rb;
+  for (int r = 0; r < rounds; r++) {
+    BenchHal hal;
+    PowerNode node(hal);
+    PowerBench bench(hal, node, cfg, collectLine, &rb);
+    bench.runAll();
+    rb.first = false;
+  }
+  for (const std::string& l : rb.order) {
+    fprintf(out, "%s\n", l[0] == '\x01' ? rb.best[l.substr(1)].second.c_str() : l.c_str());
+  }
+
+  if (out != stdout) fclose(out);
+  return 0;
+}
@@ -0,0 +1,62 @@
+/*
+  EVE-POWER bench_target (ESP32-C3) - benchmark dei percorsi caldi sull'hardware vero
+  Stessi casi di tools/bench (lib/power_bench) ma con PowerHalEsp32: handler per tipo di pacchetto
+  con NVS ed esp_now_send veri, scritture NVS di saveRelayMask / saveRules, esp_now_send,
+  digitalWrite, applyRulesExactNow al crescere delle regole. Tempo = contatore cicli della CPU.
+
+  Gira una volta al boot e stampa sulla seriale una riga JSON per caso, fra "#BENCH v1" e "#BENCH END".
+  Per rifare la misura: reset. Da confrontare con: bench --compare vecchio.log nuovo.log
+    pio run -e esp32c3_bench -t upload && pio device monitor -e esp32c3_bench | tee bench.log
+
+  ATTENZIONE: scheda dedicata. Il bench sovrascrive relayMask e regole del relè 1 nella NVS e fa
+  qualche centinaio di scritture in flash a ogni avvio. Lontano dal master (niente HELLO veri).
+*/
+
+#include <Arduino.h>
+#include "power_bench.h"
+#include "power_hal_esp32.h"
+#include "power_node.h"
+
+#define DBG_BAUD 115200
+#define DBG_PORT Serial
+
+#ifndef BENCH_GPIO_PIN
+#define BENCH_GPIO_PIN 7    //pin libero sulla esp32-c3-devkitm-1: il relè non deve scattare
+#endif
+#ifndef BENCH_GAP_MS
+#define BENCH_GAP_MS 5      //la coda TX di ESP-NOW si svuota fra un campione e l'altro
+#endif
+
+static PowerHalEsp32 hal(DBG_PORT);
+static PowerNode node(hal);
+
+static uint32_t counterCycles() { return ESP.getCycleCount(); }
+
+static void printLine(void*, const char* line) { DBG_PORT.println(line); }
+
+void setup() {
+  DBG_PORT.begin(DBG_BAUD);
+  delay(2000); //tempo al monitor USB CDC di agganciarsi
+
+  PowerBenchConfig cfg;
+  cfg.counter = counterCycles;
+  cfg.unit = "cycles";
+  cfg.unitsPerUs = (float)getCpuFrequencyMhz();
+  cfg.samples = 50;
+  cfg.nvsSamples = 20;
+  cfg.batch = 1;
+  cfg.gapMs = BENCH_GAP_MS;
+  cfg.gpioPin = BENCH_GPIO_PIN;
+
+  DBG_PORT.println("#BENCH v1");
+  DBG_PORT.printf("{\"meta\":\"power_bench\",\"target\":\"esp32c3\",\"unit\":\"cycles\",\"cpu_mhz\":%u,\"idf\":\"%s\",\"build\":\"%s %s\"}\n",
+                  (unsigned)getCpuFrequencyMhz(), esp_get_idf_version(), __DATE__, __TIME__);
+
+  PowerBench bench(hal, node, cfg, printLine, nullptr);
+  bench.runAll();
+  DBG_PORT.printf("#BENCH END cases=%lu\n", (unsigned long)bench.cases());
+}
+
+void loop() {
+  delay(1000);
+}
@@ -0,0 +1,288 @@
+#include "bridge.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "schedule_json.h"
+
+//HELLO veloce solo a chi non ha ancora agganciato: i nodi rispondono a OGNI HELLO con
+//HELLO_ACK+STATE, con 200 nodi il fleet_sim mostra il canale saturo di sole risposte.
+//Ai nodi agganciati basta un HELLO ogni tanto (riaggancio dopo un reboot).
+static const uint32_t HELLO_KEEPALIVE_MS = 5000;
+static const uint32_t TIME_RESYNC_MIN_MS = 1000;
+
+static const uint8_t BCAST[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+Bridge::Bridge(MqttLite& mqtt, PowerUdpLink& udp, const BridgeConfig& cfg)
+  : mqtt_(mqtt), udp_(udp), cfg_(cfg) {}
+
+// ===================== NODI =====================
+void Bridge::addNode(const uint8_t* mac, const std::string& root) {
+  if (findNode(mac)) return;
+  nodes_.emplace_back();
+  Node& n = nodes_.back();
+  n.owner = this;
+  memcpy(n.mac, mac, 6);
+  if (root.empty()) {
+    char m12[13];
+    snprintf(m12, sizeof(m12), "%02X%02X%02X%02X%02X%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    n.root = cfg_.prefix + "/" + m12;
+  } else {
+    n.root = root;
+  }
+  memset(&n.ep, 0, sizeof(n.ep));
+  PowerCmdQueueConfig qc;
+  qc.batchMs = cfg_.batchMs;
+  qc.retryMs = cfg_.retryMs;
+  qc.maxRetries = cfg_.maxRetries;
+  n.cmd.begin(qc, queueSend, &n);
+
+  if (mqtt_.connected()) {
+    mqtt_.subscribe((n.root + "/relay/+/set").c_str());
+    mqtt_.subscribe((n.root + "/relay/+/schedule/set").c_str());
+  }
+  char ms[18];
+  formatMac(mac, ms, sizeof(ms));
+  fprintf(stderr, "[BRIDGE] nodo %s -> %s\n", ms, n.root.c_str());
+}
+
+void Bridge::subscribeAll() {
+  for (auto& n : nodes_) {
+    mqtt_.subscribe((n.root + "/relay/+/set").c_str());
+    mqtt_.subscribe((n.root + "/relay/+/schedule/set").c_str());
+  }
+}
+
+Bridge::Node* Bridge::findNode(const uint8_t* mac) {
+  for (auto& n : nodes_) if (memcmp(n.mac, mac, 6) == 0) return &n;
+  return nullptr;
+}
+
+size_t Bridge::lockedCount() const {
+  size_t c = 0;
+  for (auto& n : nodes_) if (n.locked) c++;
+  return c;
+}
+
+BridgeStats Bridge::stats() const {
+  BridgeStats s = stats_;
+  for (auto& n : nodes_) {
+    const PowerCmdQueueStats& q = n.cmd.stats();
+    s.cmdFrames += q.cmdFrames;
+    s.cmdRetries += q.cmdRetries;
+    s.cmdDropped += q.cmdDropped;
+    s.rulesFrames += q.rulesFrames;
+  }
+  return s;
+}
+
+// ===================== TX =====================
+void Bridge::queueSend(void* ctx, const void* pkt, size_t len) {
+  Node* n = static_cast<Node*>(ctx);
+  n->owner->sendTo(*n, pkt, len);
+}
+
+void Bridge::sendTo(Node& n, const void* pkt, size_t len) {
+  if (!n.haveEp) return;
+  udp_.send(n.ep, POWER_UDP_DATA, cfg_.channel, cfg_.mac, n.mac, (const uint8_t*)pkt, len);
+}
+
+void Bridge::sendTime(Node& n, uint64_t nowMs) {
+  time_t t = time(nullptr);
+  struct tm lt;
+  localtime_r(&t, &lt);
+
+  PowerTimePacket p;
+  p.type = PWR_TIME_TYPE;
+  p.minuteOfDay = (uint16_t)(lt.tm_hour * 60 + lt.tm_min);
+  p.weekdayMon0 = (uint8_t)((lt.tm_wday + 6) % 7); //tm_wday: 0=domenica
+  p.valid = 1;
+  p.ms = (uint32_t)nowMs;
+  sendTo(n, &p, sizeof(p));
+  n.lastTimeMs = nowMs;
+  n.timeSent = true;
+  stats_.timeFrames++;
+}
+
+void Bridge::publishRelay(Node& n, int ch, const char* sub, bool on, bool retain) {
+  char t[32];
+  snprintf(t, sizeof(t), "/relay/%d/%s", ch, sub);
+  mqtt_.publish(n.root + t, on ? "ON" : "OFF", retain);
+}
+
+// ===================== MQTT -> NODI =====================
+void Bridge::onMqtt(const std::string& topic, const uint8_t* payload, size_t len) {
+  for (auto& n : nodes_) {
+    const std::string pre = n.root + "/relay/";
+    if (topic.compare(0, pre.size(), pre) != 0) continue;
+
+    const char* p = topic.c_str() + pre.size();
+    char* end = nullptr;
+    long ch = strtol(p, &end, 10);
+    if (end == p || ch < 1 || ch > 4) return;
+    int idx = (int)ch - 1;
+
+    if (!strcmp(end, "/set")) {
+      std::string v((const char*)payload, len);
+      PowerSetOp op;
+      if (v == "ON") op = POWER_SET_ON;
+      else if (v == "OFF") op = POWER_SET_OFF;
+      else if (v == "TOGGLE") op = POWER_SET_TOGGLE;
+      else return;
+      stats_.mqttSet++;
+      n.cmd.set((uint8_t)ch, op, nowMs_);
+      return;
+    }
+
+    if (!strcmp(end, "/schedule/set")) {
+      std::vector<RelayRuleBin> rules;
+      std::string err;
+      if (!scheduleFromJson(payload, len, rules, err)) {
+        fprintf(stderr, "[BRIDGE] %s: schedule non valida (%s)\n", topic.c_str(), err.c_str());
+        return;
+      }
+      PowerRelayRulesPacket r;
+      memset(&r, 0, sizeof(r));
+      r.type = PWR_RELAYRULE_TYPE;
+      r.ch = (uint8_t)ch;
+      r.count = (uint8_t)rules.size();
+      for (size_t k = 0; k < rules.size(); k++) r.rules[k] = rules[k];
+      n.rulesJson[idx] = scheduleToJson(r.rules, r.count);
+      n.cmd.setRules(r, nowMs_);
+    }
+    return;
+  }
+}
+
+// ===================== NODI -> MQTT =====================
+void Bridge::onState(Node& n, uint8_t mask, uint8_t timeValid, uint64_t nowMs) {
+  uint8_t changed = n.maskKnown ? (uint8_t)(mask ^ n.cmd.relayMask()) : 0x0F;
+  n.maskKnown = true;
+  for (int i = 0; i < 4; i++) {
+    if (changed & (1 << i)) {
+      publishRelay(n, i + 1, "state", mask & (1 << i), true);
+      stats_.statePub++;
+    }
+  }
+
+  n.cmd.onState(mask, nowMs);
+
+  if (!timeValid && n.locked && nowMs - n.lastTimeMs >= TIME_RESYNC_MIN_MS) sendTime(n, nowMs);
+}
+
+void Bridge::onUdp(const PowerUdpFrame& f) {
+  Node* n = findNode(f.hdr.src);
+  if (!n) {
+    if (!cfg_.autoAdd || f.hdr.kind != POWER_UDP_BEACON) return;
+    addNode(f.hdr.src, "");
+    n = findNode(f.hdr.src);
+  }
+  n->ep = f.from;
+  n->haveEp = true;
+
+  //BEACON da un altro canale = il nodo sta scandendo (reboot): torna agli HELLO veloci
+  if (f.hdr.kind == POWER_UDP_BEACON && f.hdr.ch != cfg_.channel) {
+    n->locked = false;
+    n->cmd.linkDown();
+  }
+  if (f.hdr.kind != POWER_UDP_DATA) return;
+  if (f.hdr.ch != cfg_.channel) return;
+  if (memcmp(f.hdr.dst, cfg_.mac, 6) != 0 && !PowerUdpLink::isBroadcast(f.hdr.dst)) return;
+
+  const uint8_t* d = f.data;
+  size_t len = f.hdr.len;
+  if (len < 1) return;
+
+  if (d[0] == PWR_HELLO_ACK_TYPE && len == sizeof(HelloAckPacket)) {
+    bool first = !n->locked;
+    n->locked = true;
+    if (first || !n->timeSent) sendTime(*n, nowMs_);
+    n->cmd.linkUp(nowMs_);
+    return;
+  }
+
+  if (d[0] == PWR_STATE_TYPE && len == sizeof(PowerStatePacket)) {
+    PowerStatePacket p;
+    memcpy(&p, d, sizeof(p));
+    stats_.stateRx++;
+    onState(*n, p.relayMask, p.timeValid, nowMs_);
+    return;
+  }
+
+  if (d[0] == PWR_SCHED_ACK_TYPE && len == sizeof(PowerScheduleAckPacket)) {
+    PowerScheduleAckPacket p;
+    memcpy(&p, d, sizeof(p));
+    if (p.ch < 1 || p.ch > 4) return;
+    int idx = p.ch - 1;
+
+    char t[40];
+    snprintf(t, sizeof(t), "/relay/%d/schedule/slave/ack", (int)p.ch);
+    mqtt_.publish(n->root + t, p.ok ? "OK" : "KO");
+    if (p.ok && !n->cmd.rulesDirty(p.ch)) {
+      snprintf(t, sizeof(t), "/relay/%d/schedule", (int)p.ch);
+      mqtt_.publish(n->root + t, "OK SCHEDULAZIONE", true);
+      snprintf(t, sizeof(t), "/relay/%d/schedule/current", (int)p.ch);
+      mqtt_.publish(n->root + t, n->rulesJson[idx].c_str(), true);
+    }
+    n->cmd.onRulesAck(p.ch, nowMs_);
+    return;
+  }
+
+  if (d[0] == PWR_EXECUTED_TYPE && len == sizeof(PowerExecutedPacket)) {
+    PowerExecutedPacket p;
+    memcpy(&p, d, sizeof(p));
+    if (p.ch < 1 || p.ch > 4) return;
+    stats_.executedRx++;
+    publishRelay(*n, p.ch, "executed", p.state, false);
+    uint8_t bit = (uint8_t)(1u << (p.ch - 1));
+    uint8_t mask = p.state ? (n->cmd.relayMask() | bit) : (n->cmd.relayMask() & ~bit);
+    onState(*n, mask, 1, nowMs_);
+    return;
+  }
+
+  if (d[0] == PWR_ERROR_TYPE && len == sizeof(PowerErrorPacket)) {
+    PowerErrorPacket p;
+    memcpy(&p, d, sizeof(p));
+    stats_.errorsRx++;
+    fprintf(stderr, "[BRIDGE] %s: ERROR code=%u ch=%u extra=%u\n", n->root.c_str(), p.code, p.ch, p.extra);
+    //il nodo manda ERROR solo per le RULES (ch fuori range o NVS): il CMD in volo non c'entra
+    if (p.code == PWR_ERR_INVALID_CH || p.code == PWR_ERR_NVS_SAVE_FAIL) n->cmd.rulesFailed(p.ch);
+    return;
+  }
+
+  if (cfg_.verbose) fprintf(stderr, "[BRIDGE] pacchetto sconosciuto type=%u len=%u\n", d[0], (unsigned)len);
+}
+
+// ===================== TIMER =====================
+void Bridge::service(uint64_t nowMs) {
+  nowMs_ = nowMs;
+  bool helloRound = nowMs >= nextHelloMs_;
+  if (helloRound) nextHelloMs_ = nowMs + cfg_.helloMs;
+
+  for (auto& n : nodes_) {
+    if (!n.haveEp) continue;
+
+    if (helloRound && (!n.locked || nowMs - n.lastHelloMs >= HELLO_KEEPALIVE_MS)) {
+      HelloPacket h;
+      h.type = HELLO_TYPE;
+      h.ch = cfg_.channel;
+      h.ms = (uint32_t)nowMs;
+      udp_.send(n.ep, POWER_UDP_DATA, cfg_.channel, cfg_.mac, BCAST, (const uint8_t*)&h, sizeof(h));
+      n.lastHelloMs = nowMs;
+      stats_.helloFrames++;
+    }
+
+    if (n.locked && nowMs - n.lastTimeMs >= cfg_.timeSyncMs) sendTime(n, nowMs);
+
+    uint8_t gaveUp = n.cmd.service(nowMs);
+    for (int i = 0; i < 4; i++) {
+      if (!(gaveUp & (1 << i))) continue;
+      char t[40];
+      snprintf(t, sizeof(t), "/relay/%d/schedule/slave/ack", i + 1);
+      mqtt_.publish(n.root + t, "KO");
+    }
+  }
+}
@@ -0,0 +1,107 @@
+#pragma once
+/*
+  EVE-POWER bridge - master di riferimento Linux
+  Fa quello che fa il MASTER sull'ESP32 (PROTOCOLLO_POWER_MASTER_SCHED.md) ma su Linux:
+  topic MQTT <-> pacchetti POWER, con i nodi raggiunti via UDP (lib/power_udp).
+
+  Topic (root = radice del nodo, es. progetto/EVE/POWER):
+    <root>/relay/N/set               ON|OFF|TOGGLE            -> CMD (accorpati per nodo)
+    <root>/relay/N/schedule/set      [{"at","state","days"}]  -> RULES
+    <root>/relay/N/state             ON|OFF (retained)        <- STATE / EXECUTED
+    <root>/relay/N/executed          ON|OFF                   <- EXECUTED
+    <root>/relay/N/schedule/slave/ack  OK|KO                  <- SCHED_ACK
+    <root>/relay/N/schedule          "OK SCHEDULAZIONE" (retained)
+    <root>/relay/N/schedule/current  json (retained)
+
+  Batching CMD e RULES "l'ultima vince": una PowerCmdQueue per nodo (lib/power_cmd_queue).
+*/
+
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <netinet/in.h>
+
+#include "mqtt_lite.h"
+#include "power_cmd_queue.h"
+#include "power_protocol.h"
+#include "power_udp.h"
+
+struct BridgeConfig {
+  std::string prefix = "progetto/EVE/POWER";
+  uint8_t channel = 1;
+  uint8_t mac[6] = {0x0C, 0x4E, 0xA0, 0x30, 0x37, 0x20}; //MAC "del master" (DEFAULT_MASTER_MAC dei nodi)
+  uint32_t helloMs = 200;
+  uint32_t timeSyncMs = 60000;
+  uint32_t batchMs = 2;
+  uint32_t retryMs = 150;
+  uint8_t maxRetries = 3;
+  bool autoAdd = true;     //nodi sconosciuti che mandano BEACON -> <prefix>/<MAC12>
+  bool verbose = false;
+};
+
+struct BridgeStats {
+  uint64_t mqttSet = 0;       //relay/N/set ricevuti
+  uint64_t cmdFrames = 0;     //CMD inviati (retry esclusi)
+  uint64_t cmdRetries = 0;
+  uint64_t cmdDropped = 0;    //CMD abbandonati dopo maxRetries
+  uint64_t rulesFrames = 0;
+  uint64_t stateRx = 0;
+  uint64_t statePub = 0;
+  uint64_t executedRx = 0;
+  uint64_t errorsRx = 0;
+  uint64_t helloFrames = 0;
+  uint64_t timeFrames = 0;
+};
+
+class Bridge {
+public:
+  Bridge(MqttLite& mqtt, PowerUdpLink& udp, const BridgeConfig& cfg);
+
+  //root vuota = <prefix>/<MAC12>
+  void addNode(const uint8_t* mac, const std::string& root);
+  //da chiamare dopo ogni (ri)connessione MQTT
+  void subscribeAll();
+
+  void onMqtt(const std::string& topic, const uint8_t* payload, size_t len);
+  void onUdp(const PowerUdpFrame& f);
+  //timer: HELLO, TIME, flush dei batch, retry
+  void service(uint64_t nowMs);
+
+  //contatori del bridge più quelli delle code dei nodi
+  BridgeStats stats() const;
+  size_t nodeCount() const { return nodes_.size(); }
+  size_t lockedCount() const;
+
+private:
+  struct Node {
+    Bridge* owner = nullptr;
+    uint8_t mac[6];
+    std::string root;
+    bool haveEp = false;
+    sockaddr_in ep;
+
+    bool locked = false;       //HELLO_ACK ricevuto
+    bool maskKnown = false;
+    uint64_t lastTimeMs = 0;
+    uint64_t lastHelloMs = 0;
+    bool timeSent = false;
+
+    PowerCmdQueue cmd;         //CMD accorpati e RULES, con i retry
+    std::string rulesJson[4];  //ultima schedulazione per relè, per schedule/current
+  };
+
+  Node* findNode(const uint8_t* mac);
+  static void queueSend(void* ctx, const void* pkt, size_t len);
+  void sendTo(Node& n, const void* pkt, size_t len);
+  void sendTime(Node& n, uint64_t nowMs);
+  void publishRelay(Node& n, int ch, const char* sub, bool on, bool retain);
+  void onState(Node& n, uint8_t mask, uint8_t timeValid, uint64_t nowMs);
+
+  MqttLite& mqtt_;
+  PowerUdpLink& udp_;
+  BridgeConfig cfg_;
+  std::deque<Node> nodes_;   //deque: i Node non si spostano, la coda tiene un puntatore al suo
+  BridgeStats stats_;
+  uint64_t nowMs_ = 0;
+  uint64_t nextHelloMs_ = 0;
+};
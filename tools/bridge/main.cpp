@@ -0,0 +1,152 @@
+/*
+  EVE-POWER bridge (Linux) - master di riferimento MQTT <-> POWER su UDP
+  Stessi topic del MASTER ESP32, nodi raggiunti via lib/power_udp (node_host o altro).
+
+  uso: bridge [--broker HOST:PORTA] [--user U --pass P] [--udp PORTA] [--channel CH]
+              [--prefix P] [--node MAC[=ROOT]]... [--no-auto]
+              [--hello-ms MS] [--batch-ms MS] [--retry-ms MS] [--stats S] [--verbose]
+    --node MAC=progetto/EVE/POWER  : impianto con un solo POWER, topic identici al MASTER
+    --node MAC                     : root = <prefix>/<MAC senza ':'>
+    senza --no-auto i nodi che mandano BEACON vengono aggiunti da soli (root di default)
+  build: pio run -e bridge   ->  .pio/build/bridge/program
+*/
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+
+#include "bridge.h"
+#include "mqtt_lite.h"
+#include "power_udp.h"
+
+static uint64_t monoMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000ull + (uint64_t)ts.tv_nsec / 1000000ull;
+}
+
+static void usage() {
+  fprintf(stderr, "uso: bridge [--broker HOST:PORTA] [--user U --pass P] [--udp PORTA] [--channel CH] [--prefix P]\n"
+                  "            [--node MAC[=ROOT]]... [--no-auto] [--hello-ms MS] [--batch-ms MS] [--retry-ms MS]\n"
+                  "            [--stats S] [--verbose]\n");
+}
+
+static void onMessage(void* ctx, const std::string& topic, const uint8_t* payload, size_t len) {
+  ((Bridge*)ctx)->onMqtt(topic, payload, len);
+}
+
+static bool mqttConnect(MqttLite& mqtt, const std::string& host, uint16_t port, const char* user, const char* pass) {
+  char id[32];
+  snprintf(id, sizeof(id), "eve-power-bridge-%ld", (long)time(nullptr) % 100000);
+  if (!mqtt.connect(host.c_str(), port, id, user, pass)) return false;
+  fprintf(stderr, "[BRIDGE] MQTT connesso a %s:%u\n", host.c_str(), (unsigned)port);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  BridgeConfig cfg;
+  std::string broker = "127.0.0.1:1883";
+  const char* user = nullptr;
+  const char* pass = nullptr;
+  uint16_t udpPort = 4210;
+  uint32_t statsS = 10;
+
+  struct NodeArg { uint8_t mac[6]; std::string root; };
+  std::vector<NodeArg> nodeArgs;
+
+  for (int i = 1; i < argc; i++) {
+    const char* a = argv[i];
+    const char* v = (i + 1 < argc) ? argv[i + 1] : nullptr;
+    if (!strcmp(a, "--broker") && v) { broker = v; i++; }
+    else if (!strcmp(a, "--user") && v) { user = v; i++; }
+    else if (!strcmp(a, "--pass") && v) { pass = v; i++; }
+    else if (!strcmp(a, "--udp") && v) { udpPort = (uint16_t)atoi(v); i++; }
+    else if (!strcmp(a, "--channel") && v) { cfg.channel = (uint8_t)atoi(v); i++; }
+    else if (!strcmp(a, "--prefix") && v) { cfg.prefix = v; i++; }
+    else if (!strcmp(a, "--node") && v) {
+      NodeArg n;
+      const char* eq = strchr(v, '=');
+      if (!parseMac(v, n.mac)) { fprintf(stderr, "MAC non valido: %s\n", v); return 2; }
+      if (eq) n.root = eq + 1;
+      nodeArgs.push_back(n);
+      i++;
+    }
+    else if (!strcmp(a, "--no-auto")) cfg.autoAdd = false;
+    else if (!strcmp(a, "--hello-ms") && v) { cfg.helloMs = (uint32_t)atoi(v); i++; }
+    else if (!strcmp(a, "--batch-ms") && v) { cfg.batchMs = (uint32_t)atoi(v); i++; }
+    else if (!strcmp(a, "--retry-ms") && v) { cfg.retryMs = (uint32_t)atoi(v); i++; }
+    else if (!strcmp(a, "--stats") && v) { statsS = (uint32_t)atoi(v); i++; }
+    else if (!strcmp(a, "--verbose")) cfg.verbose = true;
+    else { usage(); return 2; }
+  }
+  if (cfg.channel < 1 || cfg.channel > 13 || cfg.helloMs == 0) { usage(); return 2; }
+
+  size_t colon = broker.rfind(':');
+  if (colon == std::string::npos) { usage(); return 2; }
+  std::string host = broker.substr(0, colon);
+  uint16_t port = (uint16_t)atoi(broker.c_str() + colon + 1);
+
+  PowerUdpLink udp;
+  if (!udp.open(udpPort)) {
+    fprintf(stderr, "bind UDP %u fallito\n", (unsigned)udpPort);
+    return 1;
+  }
+
+  MqttLite mqtt;
+  Bridge bridge(mqtt, udp, cfg);
+  mqtt.onMessage(onMessage, &bridge);
+  for (auto& n : nodeArgs) bridge.addNode(n.mac, n.root);
+
+  if (!mqttConnect(mqtt, host, port, user, pass)) {
+    fprintf(stderr, "MQTT: connessione a %s fallita\n", broker.c_str());
+    return 1;
+  }
+  bridge.subscribeAll();
+  fprintf(stderr, "[BRIDGE] UDP :%u  canale %u\n", (unsigned)udp.localPort(), (unsigned)cfg.channel);
+
+  uint64_t nextStatsMs = monoMs() + statsS * 1000ull;
+  uint64_t nextReconnectMs = 0;
+  BridgeStats last;
+
+  for (;;) {
+    pollfd pfds[2];
+    int n = 0;
+    pfds[n].fd = udp.fd(); pfds[n].events = POLLIN; n++;
+    if (mqtt.connected()) { pfds[n].fd = mqtt.fd(); pfds[n].events = POLLIN; n++; }
+    //1ms: la finestra di batch e i retry sono dell'ordine dei ms
+    poll(pfds, n, 1);
+
+    uint64_t now = monoMs();
+    bridge.service(now);
+
+    PowerUdpFrame f;
+    while (udp.recv(f)) bridge.onUdp(f);
+
+    if (mqtt.connected()) {
+      if (!mqtt.service(now)) fprintf(stderr, "[BRIDGE] MQTT disconnesso\n");
+    } else if (now >= nextReconnectMs) {
+      nextReconnectMs = now + 2000;
+      if (mqttConnect(mqtt, host, port, user, pass)) bridge.subscribeAll();
+    }
+
+    if (statsS && now >= nextStatsMs) {
+      nextStatsMs = now + statsS * 1000ull;
+      const BridgeStats& s = bridge.stats();
+      uint64_t set = s.mqttSet - last.mqttSet;
+      uint64_t cmd = s.cmdFrames - last.cmdFrames;
+      printf("nodi=%zu agganciati=%zu set=%llu cmd=%llu (%.2f set/cmd) retry=%llu persi=%llu "
+             "state=%llu exec=%llu rules=%llu hello=%llu time=%llu err=%llu\n",
+             bridge.nodeCount(), bridge.lockedCount(), (unsigned long long)set, (unsigned long long)cmd,
+             cmd ? (double)set / (double)cmd : 0.0,
+             (unsigned long long)(s.cmdRetries - last.cmdRetries), (unsigned long long)(s.cmdDropped - last.cmdDropped),
+             (unsigned long long)(s.stateRx - last.stateRx), (unsigned long long)(s.executedRx - last.executedRx),
+             (unsigned long long)(s.rulesFrames - last.rulesFrames), (unsigned long long)(s.helloFrames - last.helloFrames),
+             (unsigned long long)(s.timeFrames - last.timeFrames), (unsigned long long)(s.errorsRx - last.errorsRx));
+      fflush(stdout);
+      last = s;
+    }
+  }
+}
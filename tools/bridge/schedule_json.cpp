@@ -0,0 +1,60 @@
+#include "schedule_json.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <ArduinoJson.h>
+
+bool scheduleFromJson(const uint8_t* payload, size_t len, std::vector<RelayRuleBin>& out, std::string& err) {
+  out.clear();
+
+  JsonDocument doc;
+  DeserializationError e = deserializeJson(doc, (const char*)payload, len);
+  if (e) { err = e.c_str(); return false; }
+  if (!doc.is<JsonArray>()) { err = "atteso un array"; return false; }
+
+  JsonArray arr = doc.as<JsonArray>();
+  if (arr.size() > MAX_RULES) { err = "troppe regole (max 10)"; return false; }
+
+  for (JsonObject o : arr) {
+    const char* at = o["at"] | "";
+    const char* state = o["state"] | "";
+    const char* days = o["days"] | "1111111";
+
+    unsigned h = 0, m = 0;
+    if (sscanf(at, "%u:%u", &h, &m) != 2 || h > 23 || m > 59) { err = "at non valido"; return false; }
+
+    RelayRuleBin r;
+    r.minuteOfDay = (uint16_t)(h * 60 + m);
+    if (!strcmp(state, "ON")) r.on = 1;
+    else if (!strcmp(state, "OFF")) r.on = 0;
+    else { err = "state non valido"; return false; }
+
+    if (strlen(days) != 7) { err = "days non valido"; return false; }
+    r.daysMask = 0;
+    for (int i = 0; i < 7; i++) {
+      if (days[i] == '1') r.daysMask |= (1 << i);
+      else if (days[i] != '0') { err = "days non valido"; return false; }
+    }
+    out.push_back(r);
+  }
+  return true;
+}
+
+std::string scheduleToJson(const RelayRuleBin* rules, uint8_t count) {
+  JsonDocument doc;
+  JsonArray arr = doc.to<JsonArray>();
+  for (uint8_t k = 0; k < count && k < MAX_RULES; k++) {
+    char at[6], days[8];
+    snprintf(at, sizeof(at), "%02u:%02u", (unsigned)(rules[k].minuteOfDay / 60), (unsigned)(rules[k].minuteOfDay % 60));
+    for (int i = 0; i < 7; i++) days[i] = (rules[k].daysMask >> i) & 1 ? '1' : '0';
+    days[7] = 0;
+
+    JsonObject o = arr.add<JsonObject>();
+    o["at"] = std::string(at);
+    o["state"] = rules[k].on ? "ON" : "OFF";
+    o["days"] = std::string(days);
+  }
+  std::string out;
+  serializeJson(doc, out);
+  return out;
+}
@@ -0,0 +1,15 @@
+#pragma once
+/*
+  Conversione payload MQTT schedulazioni <-> RelayRuleBin (PROTOCOLLO_POWER_MASTER_SCHED.md)
+  [{"at":"07:00","state":"ON","days":"1111111"}, ...]   max 10 regole, days lun→dom
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "power_protocol.h"
+
+//false + err se il payload non è valido
+bool scheduleFromJson(const uint8_t* payload, size_t len, std::vector<RelayRuleBin>& out, std::string& err);
+std::string scheduleToJson(const RelayRuleBin* rules, uint8_t count);
@@ -0,0 +1,288 @@
+/*
+  EVE-POWER fleet simulator (Linux)
+  Tanti PowerNode veri su un mezzo ESP-NOW modellato (airtime, collisioni, perdita,
+  deriva del clock per nodo) + un master finto guidato da uno scenario.
+
+  uso: fleet_sim <scenario.sim> [--nodes N] [--seed S] [--loss P] [--csv nodi.csv] [--verbose]
+  build: pio run -e fleet_sim   ->  .pio/build/fleet_sim/program
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include "sim_core.h"
+#include "sim_master.h"
+#include "sim_medium.h"
+#include "sim_node.h"
+#include "sim_script.h"
+
+static void usage() {
+  fprintf(stderr, "uso: fleet_sim <scenario.sim> [--nodes N] [--seed S] [--loss P] [--csv file] [--verbose]\n");
+}
+
+//riga "nome n=.. p50=.. p99=.. max=.." per un campione di latenze in ms
+static void printLatency(const char* name, std::vector<double>& v, uint64_t lost) {
+  if (v.empty()) {
+    printf("  %-16s n=0 persi=%llu\n", name, (unsigned long long)lost);
+    return;
+  }
+  printf("  %-16s n=%zu persi=%llu min=%.1f p50=%.1f p99=%.1f max=%.1f ms\n", name, v.size(),
+         (unsigned long long)lost, percentile(v, 0), percentile(v, 50), percentile(v, 99), percentile(v, 100));
+}
+
+//EXECUTED attesi dalle RULES mandate e mai arrivati (RULES perse comprese)
+static uint32_t execLost(const NodeTrack& tr) {
+  uint32_t got = (uint32_t)tr.execLatMs.size();
+  return tr.execExpected > got ? tr.execExpected - got : 0;
+}
+
+static void writeCsv(const char* path, const std::vector<SimNode*>& nodes, const SimMaster& master) {
+  FILE* f = fopen(path, "w");
+  if (!f) {
+    fprintf(stderr, "csv: non riesco a scrivere %s\n", path);
+    return;
+  }
+  fprintf(f, "node,mac,drift_ppm,boot_ms,lock_ms,tx_queued,tx_ok,tx_fail,tx_dropped,tx_collisions,"
+             "rx_ok,rx_lost,rx_collided,rx_missed,airtime_ms,"
+             "cmd_sent,cmd_lost,cmd_p50_ms,cmd_p99_ms,rules_sent,rules_lost,ack_p50_ms,ack_p99_ms,"
+             "executed,exec_lost,exec_p50_ms,exec_p99_ms,exec_max_ms,errors,"
+             "x_m,y_m,hops,parent_rssi,fwd_up,fwd_down,mesh_originated,mesh_acked,mesh_retries,mesh_timeouts,"
+             "dup_dropped,ttl_dropped,noroute_dropped,rtt_avg_ms\n");
+  for (size_t i = 0; i < nodes.size(); i++) {
+    SimNode* n = nodes[i];
+    NodeTrack tr = master.track((uint32_t)i);
+    const StationStats& s = n->stats;
+    const uint8_t* m = n->mac();
+    const PowerMesh& mesh = n->node().mesh();
+    const PowerMeshStats& ms = mesh.stats();
+    double lockMs = tr.locked ? (double)(tr.lockedAt - n->bootAt()) / 1000.0 : -1.0;
+    fprintf(f, "%zu,%02X:%02X:%02X:%02X:%02X:%02X,%.1f,%.1f,%.1f,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%.2f,"
+               "%u,%u,%.2f,%.2f,%u,%u,%.2f,%.2f,%zu,%u,%.2f,%.2f,%.2f,%u,"
+               "%.1f,%.1f,%d,%d,%u,%u,%u,%u,%u,%u,%u,%u,%u,%.2f\n",
+            i, m[0], m[1], m[2], m[3], m[4], m[5], n->driftPpm(), (double)n->bootAt() / 1000.0, lockMs,
+            (unsigned long long)s.txQueued, (unsigned long long)s.txOk, (unsigned long long)s.txFail,
+            (unsigned long long)s.txDropped, (unsigned long long)s.txCollisions,
+            (unsigned long long)s.rxOk, (unsigned long long)s.rxLost, (unsigned long long)s.rxCollided,
+            (unsigned long long)s.rxMissed, (double)s.airtimeUs / 1000.0,
+            tr.cmdSent, tr.cmdLost, percentile(tr.cmdLatMs, 50), percentile(tr.cmdLatMs, 99),
+            tr.rulesSent, tr.rulesLost, percentile(tr.ackLatMs, 50), percentile(tr.ackLatMs, 99),
+            tr.execLatMs.size(), execLost(tr), percentile(tr.execLatMs, 50), percentile(tr.execLatMs, 99),
+            percentile(tr.execLatMs, 100), tr.errors,
+            n->x, n->y, mesh.hops() == MESH_NO_ROUTE ? -1 : (int)mesh.hops(), (int)mesh.parentRssi(),
+            ms.forwardedUp, ms.forwardedDown, ms.originated, ms.acked, ms.retries, ms.timeouts,
+            ms.dupDropped, ms.ttlDropped, ms.noRouteDropped,
+            ms.rttCount ? (double)ms.rttSumMs / ms.rttCount : 0.0);
+  }
+  fclose(f);
+}
+
+// ===================== MULTI-HOP =====================
+static void printMesh(const std::vector<SimNode*>& nodes, const SimMaster& master) {
+  uint32_t byHops[MESH_MAX_HOPS + 1] = {};
+  uint32_t noRoute = 0, relays = 0, maxFwdNode = 0;
+  uint64_t fwdUp = 0, fwdDown = 0, maxFwd = 0, dup = 0, ttl = 0, lost = 0, fail = 0;
+  uint64_t originated = 0, acked = 0, retries = 0, timeouts = 0, rttSum = 0, rttHops = 0, rttMax = 0;
+  for (size_t i = 0; i < nodes.size(); i++) {
+    const PowerMesh& m = nodes[i]->node().mesh();
+    const PowerMeshStats& s = m.stats();
+    if (m.hops() == MESH_NO_ROUTE || m.hops() > MESH_MAX_HOPS) noRoute++;
+    else byHops[m.hops()]++;
+    uint64_t fwd = s.forwardedUp + s.forwardedDown;
+    if (fwd) relays++;
+    if (fwd > maxFwd) { maxFwd = fwd; maxFwdNode = (uint32_t)i; }
+    fwdUp += s.forwardedUp; fwdDown += s.forwardedDown;
+    dup += s.dupDropped; ttl += s.ttlDropped; lost += s.noRouteDropped; fail += s.sendFail;
+    originated += s.originated; acked += s.acked; retries += s.retries; timeouts += s.timeouts;
+    rttSum += s.rttSumMs; rttHops += s.rttHopSum;
+    if (s.rttMaxMs > rttMax) rttMax = s.rttMaxMs;
+  }
+
+  printf("multi-hop: nodi per hop");
+  for (uint8_t h = 1; h <= MESH_MAX_HOPS; h++) if (byHops[h]) printf(" %u=%u", (unsigned)h, byHops[h]);
+  printf(" senza_rotta=%u\n", noRoute);
+  printf("  inoltri: su=%llu giù=%llu relè attivi=%u max=%llu (nodo %u)\n", (unsigned long long)fwdUp,
+         (unsigned long long)fwdDown, relays, (unsigned long long)maxFwd, maxFwdNode);
+  printf("  scarti: duplicati=%llu ttl=%llu senza_rotta=%llu invio_fallito=%llu\n", (unsigned long long)dup,
+         (unsigned long long)ttl, (unsigned long long)lost, (unsigned long long)fail);
+  printf("  nodi->master in busta: partiti=%llu confermati=%llu ritrasmessi=%llu abbandonati=%llu\n",
+         (unsigned long long)originated, (unsigned long long)acked, (unsigned long long)retries,
+         (unsigned long long)timeouts);
+  if (rttHops) {
+    printf("  RTT end-to-end (nodo): media=%.1f max=%llu ms, hop medi=%.2f -> %.1f ms per hop\n",
+           (double)rttSum / (double)acked, (unsigned long long)rttMax, (double)rttHops / (double)acked,
+           (double)rttSum / (2.0 * (double)rttHops));
+  }
+
+  MeshMasterStats ms = master.meshStats();
+  printf("  master: buste ricevute=%u duplicati=%u | verso i nodi in busta=%u confermate=%u ritrasmesse=%u perse=%u\n",
+         ms.upData, ms.upDup, ms.downSent, ms.downAcked, ms.downRetries, ms.downLost);
+  printLatency("RTT master->nodo", ms.downRttMs, ms.downLost);
+  for (uint8_t h = 1; h <= MESH_MAX_HOPS; h++) {
+    if (ms.upLatMs[h].empty()) continue;
+    char name[24];
+    snprintf(name, sizeof(name), "salita %u hop", (unsigned)h);
+    printLatency(name, ms.upLatMs[h], 0);
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) { usage(); return 2; }
+
+  Scenario sc;
+  if (!loadScenario(argv[1], sc)) return 2;
+
+  const char* csvPath = nullptr;
+  bool verbose = false;
+  for (int i = 2; i < argc; i++) {
+    if (!strcmp(argv[i], "--nodes") && i + 1 < argc) sc.nodes = (uint32_t)strtoul(argv[++i], nullptr, 0);
+    else if (!strcmp(argv[i], "--seed") && i + 1 < argc) sc.seed = strtoull(argv[++i], nullptr, 0);
+    else if (!strcmp(argv[i], "--loss") && i + 1 < argc) sc.loss = strtod(argv[++i], nullptr);
+    else if (!strcmp(argv[i], "--csv") && i + 1 < argc) csvPath = argv[++i];
+    else if (!strcmp(argv[i], "--verbose")) verbose = true;
+    else { usage(); return 2; }
+  }
+  if (sc.nodes == 0 || sc.nodes > 0xFFFFFF) { fprintf(stderr, "nodes fuori range\n"); return 2; }
+
+  //le selezioni si controllano ora che il numero di nodi è definitivo
+  std::vector<std::vector<uint32_t> > selections(sc.actions.size());
+  for (size_t i = 0; i < sc.actions.size(); i++) {
+    if (!resolveSelection(sc.actions[i].sel, sc.nodes, selections[i])) {
+      fprintf(stderr, "%s:%d: selezione nodi non valida '%s' (nodi=%u)\n",
+              argv[1], sc.actions[i].line, sc.actions[i].sel.c_str(), sc.nodes);
+      return 2;
+    }
+  }
+
+  Sim sim(sc.seed);
+  MediumConfig mc;
+  mc.lossProb = sc.loss;
+  mc.retryLimit = sc.retries;
+  mc.txQueueMax = sc.queue;
+  mc.rangeM = sc.rangeM;
+  Medium medium(sim, mc);
+
+  PowerMeshConfig meshCfg;
+  meshCfg.beaconMs = sc.beaconMs;
+  meshCfg.minRssi = (int8_t)sc.minRssi;
+
+  //griglia: colonne = radice del numero di nodi; master nell'angolo (0,0), nodi da (SPACING, 0)
+  uint32_t cols = (uint32_t)ceil(sqrt((double)sc.nodes));
+  std::vector<SimNode*> nodes;
+  for (uint32_t i = 0; i < sc.nodes; i++) {
+    double drift = (sim.uniform() * 2.0 - 1.0) * sc.driftPpm;
+    SimNode* n = new SimNode(sim, medium, i, drift, sc.tickMs);
+    if (sc.layout == Scenario::LAYOUT_LINE) {
+      n->x = sc.spacingM * (i + 1);
+    } else if (sc.layout == Scenario::LAYOUT_GRID) {
+      n->x = sc.spacingM * (i % cols + 1);
+      n->y = sc.spacingM * (i / cols);
+    }
+    if (sc.mesh) n->enableMesh(meshCfg);
+    medium.attach(n);
+    nodes.push_back(n);
+  }
+  SimMaster master(sim, medium, nodes, sc.channel);
+  if (sc.mesh) master.enableMesh(meshCfg);
+  medium.attach(&master);
+  master.setClock(sc.clockMinute, sc.clockWeekday);
+  master.startHello(sc.helloMs);
+
+  //ogni azione periodica si riprogramma da sola: le closure vivono qui
+  std::vector<std::function<void()> > runners(sc.actions.size());
+  for (size_t i = 0; i < sc.actions.size(); i++) {
+    const ScriptAction* a = &sc.actions[i];
+    const std::vector<uint32_t>* sel = &selections[i];
+    std::function<void()>* self = &runners[i];
+    *self = [&sim, &master, &nodes, a, sel, self]() {
+      switch (a->kind) {
+        case ScriptAction::BOOT:
+          for (size_t k = 0; k < sel->size(); k++) {
+            SimNode* n = nodes[(*sel)[k]];
+            if (n->phase() != SimNode::OFF) continue;
+            SimTime d = a->spread ? (SimTime)(sim.uniform() * (double)a->spread) : 0;
+            sim.after(d, [n]() { n->boot(); });
+          }
+          break;
+        case ScriptAction::TIME:  master.sendTime(*sel); break;
+        case ScriptAction::RULES: master.sendRules(*sel, a->ch, a->rules); break;
+        case ScriptAction::CMD:   master.sendCmd(*sel, a->maskSet, a->maskVal); break;
+      }
+      if (a->every) sim.after(a->every, *self);
+    };
+    sim.at(a->at, *self);
+  }
+
+  if (verbose) {
+    printf("scenario %s: %u nodi, %zu azioni, durata %.1fs\n", argv[1], sc.nodes, sc.actions.size(),
+           (double)sc.duration / 1e6);
+  }
+
+  auto t0 = std::chrono::steady_clock::now();
+  sim.runUntil(sc.duration);
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  master.closeOutstanding();
+
+  // ===================== REPORT =====================
+  StationStats agg;
+  uint32_t locked = 0, running = 0;
+  std::vector<double> lockMs, cmdLat, ackLat, execLat;
+  uint64_t cmdLost = 0, rulesLost = 0, execLostN = 0, execExpected = 0, execGenerated = 0, errors = 0;
+  for (size_t i = 0; i < nodes.size(); i++) {
+    const StationStats& s = nodes[i]->stats;
+    agg.txQueued += s.txQueued; agg.txOk += s.txOk; agg.txFail += s.txFail; agg.txDropped += s.txDropped;
+    agg.txAttempts += s.txAttempts; agg.txCollisions += s.txCollisions;
+    agg.rxOk += s.rxOk; agg.rxLost += s.rxLost; agg.rxCollided += s.rxCollided;
+    if (nodes[i]->phase() == SimNode::RUNNING) running++;
+
+    const NodeTrack& tr = master.track((uint32_t)i);
+    if (tr.locked) { locked++; lockMs.push_back((double)(tr.lockedAt - nodes[i]->bootAt()) / 1000.0); }
+    cmdLat.insert(cmdLat.end(), tr.cmdLatMs.begin(), tr.cmdLatMs.end());
+    ackLat.insert(ackLat.end(), tr.ackLatMs.begin(), tr.ackLatMs.end());
+    execLat.insert(execLat.end(), tr.execLatMs.begin(), tr.execLatMs.end());
+    cmdLost += tr.cmdLost;
+    rulesLost += tr.rulesLost;
+    execLostN += execLost(tr);
+    execExpected += tr.execExpected;
+    execGenerated += nodes[i]->executedGenerated();
+    errors += tr.errors;
+  }
+  const StationStats& ms = master.stats;
+
+  printf("=== EVE-POWER fleet sim ===\n");
+  printf("nodi=%u durata=%.1fs seed=%llu canale=%u loss=%.3f drift=+-%.0fppm tick=%ums\n",
+         sc.nodes, (double)sc.duration / 1e6, (unsigned long long)sc.seed, (unsigned)sc.channel,
+         sc.loss, sc.driftPpm, sc.tickMs);
+  printf("eventi=%llu tempo reale=%.2fs (x%.0f realtime)\n", (unsigned long long)sim.processed(), wall,
+         wall > 0 ? ((double)sc.duration / 1e6) / wall : 0.0);
+  printf("canale %u occupato %.1f%%\n", (unsigned)sc.channel, 100.0 * medium.utilization(sc.channel, sc.duration));
+  printf("nodi in RUNNING=%u agganciati (HELLO_ACK al master)=%u\n", running, locked);
+  printLatency("aggancio", lockMs, sc.nodes - locked);
+  printf("nodi->master: accodati=%llu ok=%llu falliti=%llu scartati=%llu tentativi=%llu collisioni=%llu consegna=%.2f%%\n",
+         (unsigned long long)agg.txQueued, (unsigned long long)agg.txOk, (unsigned long long)agg.txFail,
+         (unsigned long long)agg.txDropped, (unsigned long long)agg.txAttempts, (unsigned long long)agg.txCollisions,
+         agg.txQueued ? 100.0 * (double)agg.txOk / (double)agg.txQueued : 0.0);
+  printf("master->nodi: accodati=%llu ok=%llu falliti=%llu scartati=%llu tentativi=%llu collisioni=%llu\n",
+         (unsigned long long)ms.txQueued, (unsigned long long)ms.txOk, (unsigned long long)ms.txFail,
+         (unsigned long long)ms.txDropped, (unsigned long long)ms.txAttempts, (unsigned long long)ms.txCollisions);
+  std::vector<double> masterQ = ms.queueDelayMs;
+  printLatency("coda master", masterQ, 0);
+  printLatency("CMD->STATE", cmdLat, cmdLost);
+  printLatency("RULES->ACK", ackLat, rulesLost);
+  printLatency("regola->EXEC", execLat, execLostN);
+  if (execExpected) {
+    printf("  EXECUTED attesi=%llu generati dai nodi=%llu ricevuti=%zu\n", (unsigned long long)execExpected,
+           (unsigned long long)execGenerated, execLat.size());
+  }
+  if (errors) printf("  ERROR ricevuti=%llu\n", (unsigned long long)errors);
+  if (sc.mesh) printMesh(nodes, master);
+
+  if (csvPath) writeCsv(csvPath, nodes, master);
+
+  for (size_t i = 0; i < nodes.size(); i++) delete nodes[i];
+  return 0;
+}
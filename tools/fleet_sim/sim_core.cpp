@@ -0,0 +1,13 @@
+#include "sim_core.h"
+
+#include <algorithm>
+#include <math.h>
+
+double percentile(std::vector<double>& v, double p) {
+  if (v.empty()) return NAN;
+  std::sort(v.begin(), v.end());
+  double rank = p / 100.0 * (double)(v.size() - 1);
+  size_t lo = (size_t)rank;
+  size_t hi = std::min(lo + 1, v.size() - 1);
+  return v[lo] + (v[hi] - v[lo]) * (rank - (double)lo);
+}
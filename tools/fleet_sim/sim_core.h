@@ -0,0 +1,71 @@
+#pragma once
+/*
+  EVE-POWER fleet simulator - nucleo a eventi discreti
+  Tempo simulato in microsecondi, coda di eventi ordinata per (tempo, ordine di inserimento)
+  così due run con lo stesso seed sono identici.
+*/
+
+#include <stdint.h>
+#include <functional>
+#include <queue>
+#include <random>
+#include <vector>
+
+typedef uint64_t SimTime; //microsecondi dall'inizio della simulazione
+
+static inline SimTime simMs(uint64_t ms) { return ms * 1000ULL; }
+
+class Sim {
+public:
+  typedef std::function<void()> Action;
+
+  explicit Sim(uint64_t seed) : now_(0), seq_(0), processed_(0), rng_(seed) {}
+
+  SimTime now() const { return now_; }
+  uint64_t processed() const { return processed_; }
+
+  void at(SimTime t, Action fn) {
+    if (t < now_) t = now_;
+    q_.push(Event{ t, seq_++, fn });
+  }
+  void after(SimTime dt, Action fn) { at(now_ + dt, fn); }
+
+  //esegue gli eventi fino a end (incluso); ritorna false se la coda si è svuotata prima
+  bool runUntil(SimTime end) {
+    while (!q_.empty()) {
+      if (q_.top().t > end) { now_ = end; return true; }
+      Event e = q_.top();
+      q_.pop();
+      now_ = e.t;
+      processed_++;
+      e.fn();
+    }
+    now_ = end;
+    return false;
+  }
+
+  std::mt19937_64& rng() { return rng_; }
+  double uniform() { return std::uniform_real_distribution<double>(0.0, 1.0)(rng_); }
+  uint32_t randInt(uint32_t maxIncl) { return std::uniform_int_distribution<uint32_t>(0, maxIncl)(rng_); }
+
+private:
+  struct Event {
+    SimTime t;
+    uint64_t seq;
+    Action fn;
+  };
+  struct Later {
+    bool operator()(const Event& a, const Event& b) const {
+      return a.t != b.t ? a.t > b.t : a.seq > b.seq;
+    }
+  };
+
+  SimTime now_;
+  uint64_t seq_;
+  uint64_t processed_;
+  std::priority_queue<Event, std::vector<Event>, Later> q_;
+  std::mt19937_64 rng_;
+};
+
+//percentili su un campione di latenze (ms); il vettore viene ordinato
+double percentile(std::vector<double>& v, double p);
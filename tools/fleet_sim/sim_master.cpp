@@ -0,0 +1,304 @@
+#include "sim_master.h"
+
+#include <string.h>
+
+static const uint8_t BROADCAST[6] = { 0xFF,0xFF,0xFF,0xFF,0xFF,0xFF };
+static const uint64_t WEEK_MS = 7ULL * 1440ULL * 60000ULL;
+
+SimMaster::SimMaster(Sim& sim, Medium& medium, std::vector<SimNode*>& nodes, uint8_t ch)
+  : sim_(sim), medium_(medium), nodes_(nodes), tracks_(nodes.size()), ch_(ch) {}
+
+uint64_t SimMaster::wallMs() const {
+  return wallAt(sim_.now()) % WEEK_MS;
+}
+
+uint64_t SimMaster::wallAt(SimTime t) const {
+  return wallBaseMs_ + (t - wallBaseAt_) / 1000ULL;
+}
+
+//come applyRulesExactNow: al minuto della regola il relè va allo stato chiesto, EXECUTED solo se cambia
+void SimMaster::countExpected(NodeTrack& tr, uint8_t ch, SimTime t) {
+  const std::vector<RelayRuleBin>& rules = tr.rules[ch];
+  uint64_t from = wallAt(tr.rulesFrom[ch]) / 60000ULL;
+  uint64_t to = wallAt(t) / 60000ULL;
+  tr.rulesFrom[ch] = t;
+  uint8_t bit = (uint8_t)(1u << ch);
+  for (uint64_t m = from + 1; m <= to && !rules.empty(); m++) {
+    uint16_t minute = (uint16_t)(m % 1440ULL);
+    uint8_t wd = (uint8_t)((m / 1440ULL) % 7);
+    for (size_t k = 0; k < rules.size(); k++) {
+      const RelayRuleBin& r = rules[k];
+      if (r.minuteOfDay != minute || !((r.daysMask >> wd) & 0x01)) continue;
+      bool on = (tr.ruleMask & bit) != 0;
+      if (on == (r.on == 1)) continue;
+      tr.ruleMask = (uint8_t)(tr.ruleMask ^ bit);
+      tr.execExpected++;
+    }
+  }
+}
+
+void SimMaster::setClock(uint16_t minuteOfDay, uint8_t weekdayMon0) {
+  wallBaseMs_ = ((uint64_t)(weekdayMon0 % 7) * 1440ULL + (minuteOfDay % 1440)) * 60000ULL;
+  wallBaseAt_ = sim_.now();
+}
+
+int SimMaster::indexOf(const uint8_t* mac) const {
+  //MAC dei nodi simulati: 24:0A:C4:<indice a 24 bit>
+  if (mac[0] != 0x24 || mac[1] != 0x0A || mac[2] != 0xC4) return -1;
+  uint32_t i = ((uint32_t)mac[3] << 16) | ((uint32_t)mac[4] << 8) | mac[5];
+  return i < nodes_.size() ? (int)i : -1;
+}
+
+// ===================== TX =====================
+void SimMaster::startHello(uint32_t periodMs) {
+  bool running = helloPeriodMs_ != 0;
+  helloPeriodMs_ = periodMs;
+  if (!running && periodMs) hello();
+}
+
+void SimMaster::hello() {
+  if (!helloPeriodMs_) return;
+  HelloPacket h = { HELLO_TYPE, ch_, (uint32_t)(sim_.now() / 1000ULL) };
+  medium_.send(this, BROADCAST, (const uint8_t*)&h, sizeof(h));
+  sim_.after(simMs(helloPeriodMs_), [this]() { hello(); });
+}
+
+void SimMaster::sendTime(const std::vector<uint32_t>& sel) {
+  uint64_t w = wallMs();
+  PowerTimePacket t;
+  t.type = PWR_TIME_TYPE;
+  t.minuteOfDay = (uint16_t)((w / 60000ULL) % 1440ULL);
+  t.weekdayMon0 = (uint8_t)(w / (1440ULL * 60000ULL));
+  t.valid = 1;
+  t.ms = (uint32_t)(sim_.now() / 1000ULL);
+  for (size_t i = 0; i < sel.size(); i++) sendTo(sel[i], &t, sizeof(t));
+}
+
+void SimMaster::sendRules(const std::vector<uint32_t>& sel, uint8_t ch, const std::vector<RelayRuleBin>& rules) {
+  PowerRelayRulesPacket rp;
+  memset(&rp, 0, sizeof(rp));
+  rp.type = PWR_RELAYRULE_TYPE;
+  rp.ch = ch;
+  rp.count = (uint8_t)(rules.size() > MAX_RULES ? MAX_RULES : rules.size());
+  for (uint8_t k = 0; k < rp.count; k++) rp.rules[k] = rules[k];
+  rp.ms = (uint32_t)(sim_.now() / 1000ULL);
+
+  for (size_t i = 0; i < sel.size(); i++) {
+    NodeTrack& tr = tracks_[sel[i]];
+    if (ch >= 1 && ch <= RELAY_COUNT) {
+      countExpected(tr, ch - 1, sim_.now()); //le regole di prima valgono fino a qui
+      tr.rules[ch - 1].assign(rp.rules, rp.rules + rp.count);
+      uint8_t bit = (uint8_t)(1u << (ch - 1));
+      tr.ruleMask = (uint8_t)((tr.ruleMask & ~bit) | (tr.relayMask & bit));
+      if (tr.rulesPending[ch - 1]) tr.rulesLost++;
+      tr.rulesPending[ch - 1] = true;
+      tr.rulesSentAt[ch - 1] = sim_.now();
+    }
+    tr.rulesSent++;
+    sendTo(sel[i], &rp, sizeof(rp));
+  }
+}
+
+void SimMaster::sendCmd(const std::vector<uint32_t>& sel, uint8_t maskSet, uint8_t maskVal) {
+  PowerCmdPacket c = { PWR_CMD_TYPE, maskSet, maskVal, 1, (uint32_t)(sim_.now() / 1000ULL) };
+  for (size_t i = 0; i < sel.size(); i++) {
+    NodeTrack& tr = tracks_[sel[i]];
+    if (tr.cmdPending) tr.cmdLost++;
+    tr.cmdPending = true;
+    tr.cmdSentAt = sim_.now();
+    tr.cmdSet = maskSet;
+    tr.cmdVal = maskVal;
+    tr.cmdSent++;
+    sendTo(sel[i], &c, sizeof(c));
+  }
+}
+
+// ===================== MULTI-HOP TX =====================
+void SimMaster::sendTo(uint32_t idx, const void* pkt, size_t len) {
+  const NodeTrack& tr = tracks_[idx];
+  if (!mesh_ || tr.hops < 2) {
+    medium_.send(this, nodes_[idx]->mac(), (const uint8_t*)pkt, len);
+    return;
+  }
+  DownPending p;
+  p.node = idx;
+  p.seq = ++downSeq_;
+  p.attempt = 0;
+  p.sentAt = 0;
+  p.data.assign((const uint8_t*)pkt, (const uint8_t*)pkt + len);
+  down_.push_back(p);
+  meshStats_.downSent++;
+  sendDown(down_.back());
+}
+
+//busta verso il primo relè della strada; l'ACK end-to-end si aspetta ackTimeoutMs per hop
+void SimMaster::sendDown(DownPending& p) {
+  const NodeTrack& tr = tracks_[p.node];
+  PowerMeshHeader h;
+  h.type = PWR_MESH_DATA_TYPE;
+  h.flags = (uint8_t)(MESH_WANT_ACK | (p.attempt << MESH_ATTEMPT_SHIFT));
+  h.ttl = MESH_MAX_HOPS;
+  h.hops = 0;
+  memcpy(h.node, nodes_[p.node]->mac(), 6);
+  h.seq = p.seq;
+
+  uint8_t buf[MESH_MAX_FRAME];
+  size_t n = meshWrap(buf, sizeof(buf), h, p.data.data(), p.data.size());
+  p.sentAt = sim_.now();
+  medium_.send(this, tr.via, buf, n);
+
+  uint16_t seq = p.seq;
+  uint8_t attempt = p.attempt;
+  sim_.after(simMs((uint64_t)meshCfg_.ackTimeoutMs * tr.hops), [this, seq, attempt]() { checkDown(seq, attempt); });
+}
+
+void SimMaster::checkDown(uint16_t seq, uint8_t attempt) {
+  for (std::list<DownPending>::iterator it = down_.begin(); it != down_.end(); ++it) {
+    if (it->seq != seq) continue;
+    if (it->attempt != attempt) return; //è già partito un altro tentativo
+    if (it->attempt >= meshCfg_.maxRetries) {
+      meshStats_.downLost++;
+      down_.erase(it);
+      return;
+    }
+    it->attempt++;
+    meshStats_.downRetries++;
+    sendDown(*it);
+    return;
+  }
+}
+
+void SimMaster::closeOutstanding() {
+  for (size_t i = 0; i < tracks_.size(); i++) {
+    NodeTrack& tr = tracks_[i];
+    if (tr.cmdPending) { tr.cmdLost++; tr.cmdPending = false; }
+    for (uint8_t ch = 0; ch < RELAY_COUNT; ch++) {
+      if (tr.rulesPending[ch]) { tr.rulesLost++; tr.rulesPending[ch] = false; }
+      countExpected(tr, ch, sim_.now());
+    }
+  }
+  meshStats_.downLost += (uint32_t)down_.size();
+  down_.clear();
+}
+
+// ===================== RX =====================
+void SimMaster::onAirRx(const AirFrame& f, int8_t /*rssi*/) {
+  if (memcmp(f.dst, DEFAULT_MASTER_MAC, 6) != 0) return; //HELLO e BEACON degli altri ecc.
+  if (f.data.empty()) return;
+  if (mesh_ && (f.data[0] == PWR_MESH_DATA_TYPE || f.data[0] == PWR_MESH_ACK_TYPE)) {
+    meshRx(f);
+    return;
+  }
+  int idx = indexOf(f.src);
+  if (idx < 0) return;
+  handlePacket((uint32_t)idx, f.data.data(), f.data.size(), 1, true);
+}
+
+//busta salita: ACK end-to-end subito (anche ai duplicati), poi il pacchetto come se fosse diretto
+void SimMaster::meshRx(const AirFrame& f) {
+  if (f.data.size() < sizeof(PowerMeshHeader)) return;
+  PowerMeshHeader h;
+  memcpy(&h, f.data.data(), sizeof(h));
+  int idx = indexOf(h.node);
+  if (idx < 0 || !(h.flags & MESH_UP)) return;
+
+  NodeTrack& tr = tracks_[idx];
+  uint8_t hops = (uint8_t)(h.hops + 1);
+  tr.hops = hops;
+  memcpy(tr.via, f.src, 6);
+
+  if (h.type == PWR_MESH_ACK_TYPE) {
+    meshStats_.upAcks++;
+    for (std::list<DownPending>::iterator it = down_.begin(); it != down_.end(); ++it) {
+      if (it->seq != h.seq || it->node != (uint32_t)idx) continue;
+      meshStats_.downAcked++;
+      meshStats_.downRttMs.push_back((double)(sim_.now() - it->sentAt) / 1000.0);
+      down_.erase(it);
+      break;
+    }
+    return;
+  }
+
+  if (h.flags & MESH_WANT_ACK) {
+    PowerMeshHeader a;
+    a.type = PWR_MESH_ACK_TYPE;
+    a.flags = (uint8_t)(h.flags & MESH_ATTEMPT_MASK); //tentativo del DATA, come fa PowerMesh::sendAck
+    a.ttl = MESH_MAX_HOPS;
+    a.hops = 0;
+    memcpy(a.node, h.node, 6);
+    a.seq = h.seq;
+    medium_.send(this, f.src, (const uint8_t*)&a, sizeof(a));
+  }
+  if (tr.dedup.seen(h.node, h.seq, meshDeliverTag(h))) { meshStats_.upDup++; return; }
+  meshStats_.upData++;
+  handlePacket((uint32_t)idx, f.data.data() + sizeof(h), f.data.size() - sizeof(h), hops,
+               (h.flags >> MESH_ATTEMPT_SHIFT) == 0);
+}
+
+void SimMaster::handlePacket(uint32_t idx, const uint8_t* d, size_t len, uint8_t hops, bool firstAttempt) {
+  NodeTrack& tr = tracks_[idx];
+  const SimTime now = sim_.now();
+  if (len == 0) return;
+
+  if (hops == 1) tr.hops = 1; //di nuovo in portata: si torna al diretto
+  //tutti i pacchetti nodo -> master finiscono con ms (millis() del nodo quando l'ha creato)
+  if (mesh_ && firstAttempt && len >= 5 && hops <= MESH_MAX_HOPS) {
+    uint32_t ms;
+    memcpy(&ms, d + len - 4, 4);
+    meshStats_.upLatMs[hops].push_back((double)(nodes_[idx]->localMillis() - ms));
+  }
+
+  switch (d[0]) {
+    case PWR_HELLO_ACK_TYPE:
+      if (len == sizeof(HelloAckPacket) && !tr.locked) {
+        tr.locked = true;
+        tr.lockedAt = now;
+      }
+      break;
+
+    case PWR_STATE_TYPE:
+      if (len == sizeof(PowerStatePacket)) {
+        PowerStatePacket st;
+        memcpy(&st, d, sizeof(st));
+        tr.states++;
+        tr.relayMask = st.relayMask;
+        if (tr.cmdPending && (st.relayMask & tr.cmdSet) == (tr.cmdVal & tr.cmdSet)) {
+          tr.cmdLatMs.push_back((double)(now - tr.cmdSentAt) / 1000.0);
+          tr.cmdPending = false;
+        }
+      }
+      break;
+
+    case PWR_SCHED_ACK_TYPE:
+      if (len == sizeof(PowerScheduleAckPacket)) {
+        PowerScheduleAckPacket ack;
+        memcpy(&ack, d, sizeof(ack));
+        if (ack.ch >= 1 && ack.ch <= RELAY_COUNT && tr.rulesPending[ack.ch - 1]) {
+          tr.rulesPending[ack.ch - 1] = false;
+          tr.ackLatMs.push_back((double)(now - tr.rulesSentAt[ack.ch - 1]) / 1000.0);
+          if (!ack.ok) tr.rulesNack++;
+        }
+      }
+      break;
+
+    case PWR_EXECUTED_TYPE:
+      if (len == sizeof(PowerExecutedPacket)) {
+        PowerExecutedPacket ex;
+        memcpy(&ex, d, sizeof(ex));
+        int64_t ruleMs = ((int64_t)(ex.weekdayMon0 % 7) * 1440 + ex.minuteOfDay) * 60000;
+        int64_t diff = (int64_t)wallMs() - ruleMs;
+        //riporta in [-mezza settimana, +mezza settimana)
+        if (diff >= (int64_t)WEEK_MS / 2) diff -= (int64_t)WEEK_MS;
+        if (diff < -(int64_t)WEEK_MS / 2) diff += (int64_t)WEEK_MS;
+        tr.execLatMs.push_back((double)diff);
+      }
+      break;
+
+    case PWR_ERROR_TYPE:
+      tr.errors++;
+      break;
+
+    default:
+      break;
+  }
+}
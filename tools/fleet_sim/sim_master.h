@@ -0,0 +1,124 @@
+#pragma once
+/*
+  EVE-POWER fleet simulator - MASTER finto (stand-in scriptabile)
+  Parla il protocollo di power_protocol.h con MAC = DEFAULT_MASTER_MAC:
+  - HELLO broadcast periodico sul suo canale
+  - TIME / RULES / CMD unicast verso i nodi scelti dallo script
+  - misura per nodo: aggancio, latenza CMD -> STATE, RULES -> SCHED_ACK,
+    minuto della regola -> EXECUTED ricevuto (deriva + congestione)
+  - con "mesh on" fa la parte master del multi-hop (power_mesh.h): apre le buste che salgono
+    (duplicati, rotte, ACK end-to-end), manda in busta verso i nodi che sente solo tramite relè
+    e ritrasmette se l'ACK non torna. Latenza nodo -> master per numero di hop dal campo ms.
+*/
+
+#include <stdint.h>
+#include <list>
+#include <vector>
+#include "power_mesh.h"
+#include "power_protocol.h"
+#include "sim_core.h"
+#include "sim_medium.h"
+#include "sim_node.h"
+
+struct NodeTrack {
+  bool locked = false;
+  SimTime lockedAt = 0;
+
+  bool cmdPending = false;
+  SimTime cmdSentAt = 0;
+  uint8_t cmdSet = 0, cmdVal = 0;
+  uint32_t cmdSent = 0, cmdLost = 0;
+  std::vector<double> cmdLatMs;
+
+  bool rulesPending[RELAY_COUNT] = {};
+  SimTime rulesSentAt[RELAY_COUNT] = {};
+  uint32_t rulesSent = 0, rulesLost = 0, rulesNack = 0;
+  std::vector<double> ackLatMs;
+
+  std::vector<double> execLatMs; //negativo = il nodo è in anticipo sull'orologio del master
+  //EXECUTED attesi secondo le RULES mandate: ogni minuto di regola passato che cambia il relè
+  uint32_t execExpected = 0;
+  std::vector<RelayRuleBin> rules[RELAY_COUNT]; //ultime RULES mandate per relè
+  SimTime rulesFrom[RELAY_COUNT] = {};          //da quando valgono (poi: fin dove sono già contate)
+  uint8_t relayMask = 0;                        //relè dell'ultimo STATE
+  uint8_t ruleMask = 0;                         //relè secondo le regole (parte dall'ultimo STATE)
+  uint32_t states = 0, errors = 0;
+
+  //multi-hop: strada dell'ultimo pacchetto arrivato (hops 0 = mai sentito, 1 = diretto)
+  uint8_t hops = 0;
+  uint8_t via[6] = {};
+  PowerMeshDedup dedup;          //per nodo: un ring unico si riempirebbe in fretta con tanti nodi
+};
+
+//multi-hop visto dal master
+struct MeshMasterStats {
+  uint32_t upData = 0, upDup = 0, upAcks = 0;  //buste salite, duplicati scartati, ACK dei nodi
+  uint32_t downSent = 0, downAcked = 0, downRetries = 0, downLost = 0;
+  std::vector<double> upLatMs[MESH_MAX_HOPS + 1]; //nodo -> master per hop, primo tentativo
+  std::vector<double> downRttMs;                  //busta verso il nodo -> ACK end-to-end
+};
+
+class SimMaster : public Station {
+public:
+  SimMaster(Sim& sim, Medium& medium, std::vector<SimNode*>& nodes, uint8_t ch);
+
+  const uint8_t* mac() const override { return DEFAULT_MASTER_MAC; }
+  uint8_t channel() const override { return ch_; }
+  bool listening() const override { return true; }
+  void onAirRx(const AirFrame& f, int8_t rssi) override;
+
+  void enableMesh(const PowerMeshConfig& cfg) { mesh_ = true; meshCfg_ = cfg; }
+
+  //orologio da parete del master (minuto del giorno + giorno lun=0) valido da adesso
+  void setClock(uint16_t minuteOfDay, uint8_t weekdayMon0);
+  void startHello(uint32_t periodMs);
+
+  void sendTime(const std::vector<uint32_t>& sel);
+  void sendRules(const std::vector<uint32_t>& sel, uint8_t ch, const std::vector<RelayRuleBin>& rules);
+  void sendCmd(const std::vector<uint32_t>& sel, uint8_t maskSet, uint8_t maskVal);
+
+  //a fine simulazione: ciò che è ancora in attesa conta come perso
+  void closeOutstanding();
+
+  const NodeTrack& track(uint32_t i) const { return tracks_[i]; }
+  const MeshMasterStats& meshStats() const { return meshStats_; }
+
+private:
+  struct DownPending {
+    uint32_t node;
+    uint16_t seq;
+    uint8_t attempt;
+    SimTime sentAt;
+    std::vector<uint8_t> data; //pacchetto POWER senza busta
+  };
+
+  //unicast verso un nodo: diretto, o in busta se il nodo si sente solo tramite relè
+  void sendTo(uint32_t idx, const void* pkt, size_t len);
+  void sendDown(DownPending& p);
+  void checkDown(uint16_t seq, uint8_t attempt);
+  void meshRx(const AirFrame& f);
+  void handlePacket(uint32_t idx, const uint8_t* d, size_t len, uint8_t hops, bool firstAttempt);
+
+  uint64_t wallMs() const;   //ms dall'inizio della settimana (lun 00:00)
+  uint64_t wallAt(SimTime t) const; //come wallMs ma senza giro di settimana
+  //conta in execExpected i minuti di regola del relè ch (0..3) fino a t
+  void countExpected(NodeTrack& tr, uint8_t ch, SimTime t);
+  void hello();
+  int indexOf(const uint8_t* mac) const;
+
+  Sim& sim_;
+  Medium& medium_;
+  std::vector<SimNode*>& nodes_;
+  std::vector<NodeTrack> tracks_;
+  uint8_t ch_;
+
+  uint64_t wallBaseMs_ = 0;
+  SimTime wallBaseAt_ = 0;
+  uint32_t helloPeriodMs_ = 0;
+
+  bool mesh_ = false;
+  PowerMeshConfig meshCfg_;
+  uint16_t downSeq_ = 0;
+  std::list<DownPending> down_;
+  MeshMasterStats meshStats_;
+};
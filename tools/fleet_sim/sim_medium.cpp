@@ -0,0 +1,195 @@
+#include "sim_medium.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+static const uint8_t BROADCAST[6] = { 0xFF,0xFF,0xFF,0xFF,0xFF,0xFF };
+
+uint64_t Medium::macKey(const uint8_t* mac) {
+  uint64_t k = 0;
+  for (int i = 0; i < 6; i++) k = (k << 8) | mac[i];
+  return k;
+}
+
+void Medium::attach(Station* st) {
+  stations_.push_back(st);
+  byMac_[macKey(st->mac())] = st;
+  tx_[st].cw = cfg_.cwMin;
+}
+
+uint32_t Medium::airtimeUs(size_t payloadLen) const {
+  //1 Mbps -> 8us per byte
+  return cfg_.phyOverheadUs + (uint32_t)(cfg_.macOverheadBytes + payloadLen) * 8;
+}
+
+//-90 dBm al limite della portata, +30 dB per ogni decade più vicino (esponente di perdita 3, indoor)
+bool Medium::link(const Station* a, const Station* b, int8_t& rssi) const {
+  if (cfg_.rangeM <= 0.0) { rssi = -50; return true; }
+  double d = std::max(1.0, hypot(a->x - b->x, a->y - b->y));
+  if (d > cfg_.rangeM) return false;
+  rssi = (int8_t)std::min(-20.0, -90.0 + 30.0 * log10(cfg_.rangeM / d));
+  return true;
+}
+
+double Medium::utilization(uint8_t ch, SimTime elapsed) const {
+  std::map<uint8_t, Channel>::const_iterator it = channels_.find(ch);
+  if (it == channels_.end() || elapsed == 0) return 0.0;
+  return std::min(1.0, (double)it->second.busyUs / (double)elapsed);
+}
+
+bool Medium::send(Station* st, const uint8_t* dst, const uint8_t* data, size_t len) {
+  TxState& ts = tx_[st];
+  if (ts.queue.size() >= cfg_.txQueueMax) {
+    st->stats.txDropped++;
+    return false;
+  }
+
+  AirFrame f;
+  memcpy(f.src, st->mac(), 6);
+  memcpy(f.dst, dst, 6);
+  f.data.assign(data, data + len);
+  f.queuedAt = sim_.now();
+  f.attempts = 1;
+  ts.queue.push_back(f);
+  st->stats.txQueued++;
+
+  if (!ts.busy) {
+    ts.cw = cfg_.cwMin;
+    scheduleAttempt(st, sim_.now());
+  }
+  return true;
+}
+
+void Medium::scheduleAttempt(Station* st, SimTime earliest) {
+  TxState& ts = tx_[st];
+  ts.busy = true;
+  SimTime t = std::max(earliest, sim_.now()) + cfg_.difsUs + (SimTime)sim_.randInt(ts.cw) * cfg_.slotUs;
+  sim_.at(t, [this, st]() { attempt(st); });
+}
+
+void Medium::attempt(Station* st) {
+  TxState& ts = tx_[st];
+  if (ts.queue.empty()) { ts.busy = false; return; }
+
+  const SimTime now = sim_.now();
+  const uint8_t ch = st->channel();
+  Channel& c = channels_[ch];
+  const AirFrame& f = ts.queue.front();
+  const bool unicast = memcmp(f.dst, BROADCAST, 6) != 0;
+
+  //carrier sense: le trasmissioni partite da almeno uno slot si sentono
+  SimTime sensedUntil = 0;
+  for (size_t i = 0; i < c.active.size(); i++) {
+    const Tx& o = c.active[i];
+    if (now - o.start >= cfg_.slotUs) sensedUntil = std::max(sensedUntil, o.end);
+  }
+  if (now < sensedUntil) {
+    scheduleAttempt(st, sensedUntil);
+    return;
+  }
+
+  Tx t;
+  t.id = nextTxId_++;
+  t.from = st;
+  t.start = now;
+  t.end = now + airtimeUs(f.data.size());
+  t.corrupted = false;
+
+  //quelle partite nello stesso slot non si sentono: collisione per tutti
+  for (size_t i = 0; i < c.active.size(); i++) {
+    Tx& o = c.active[i];
+    if (now - o.start < cfg_.slotUs) {
+      if (!o.corrupted) o.from->stats.txCollisions++;
+      o.corrupted = true;
+      if (!t.corrupted) st->stats.txCollisions++;
+      t.corrupted = true;
+    }
+  }
+
+  SimTime occupied = t.end + (unicast ? cfg_.sifsUs + cfg_.ackUs : 0);
+  c.active.push_back(t);
+  SimTime from = std::max(now, c.busyUntil);
+  if (occupied > from) {
+    c.busyUs += occupied - from;
+    c.busyUntil = occupied;
+  }
+
+  ts.txFrom = now;
+  ts.txUntil = t.end;
+  st->stats.txAttempts++;
+  st->stats.airtimeUs += t.end - now;
+
+  uint64_t id = t.id;
+  sim_.at(occupied, [this, st, id, ch]() { finish(st, id, ch); });
+}
+
+void Medium::finish(Station* st, uint64_t txId, uint8_t ch) {
+  Channel& c = channels_[ch];
+  Tx t = {};
+  for (size_t i = 0; i < c.active.size(); i++) {
+    if (c.active[i].id == txId) {
+      t = c.active[i];
+      c.active.erase(c.active.begin() + i);
+      break;
+    }
+  }
+
+  TxState& ts = tx_[st];
+  AirFrame f = ts.queue.front();
+  const bool unicast = memcmp(f.dst, BROADCAST, 6) != 0;
+
+  //esito per un singolo ricevitore
+  auto receives = [&](Station* r, int8_t& rssi) -> bool {
+    if (r == st || !link(st, r, rssi)) return false;
+    if (!r->listening() || r->channel() != ch) { r->stats.rxMissed++; return false; }
+    const TxState& rs = tx_[r];
+    if (rs.txFrom < t.end && rs.txUntil > t.start) { r->stats.rxMissed++; return false; }
+    if (t.corrupted) { r->stats.rxCollided++; return false; }
+    if (sim_.uniform() < cfg_.lossProb) { r->stats.rxLost++; return false; }
+    r->stats.rxOk++;
+    return true;
+  };
+
+  int8_t rssi = 0;
+  if (!unicast) {
+    std::vector<std::pair<Station*, int8_t> > got;
+    for (size_t i = 0; i < stations_.size(); i++) {
+      if (receives(stations_[i], rssi)) got.push_back(std::make_pair(stations_[i], rssi));
+    }
+    completeHead(st, true);
+    for (size_t i = 0; i < got.size(); i++) got[i].first->onAirRx(f, got[i].second);
+    return;
+  }
+
+  std::map<uint64_t, Station*>::iterator it = byMac_.find(macKey(f.dst));
+  if (it != byMac_.end() && receives(it->second, rssi)) {
+    completeHead(st, true);
+    it->second->onAirRx(f, rssi);
+    return;
+  }
+
+  //nessun ACK: ritrasmetto con finestra di contesa più larga
+  if (f.attempts <= cfg_.retryLimit) {
+    ts.queue.front().attempts++;
+    ts.cw = std::min(ts.cw * 2 + 1, cfg_.cwMax);
+    scheduleAttempt(st, sim_.now());
+    return;
+  }
+  completeHead(st, false);
+}
+
+void Medium::completeHead(Station* st, bool ok) {
+  TxState& ts = tx_[st];
+  const AirFrame& f = ts.queue.front();
+  if (ok) {
+    st->stats.txOk++;
+    st->stats.queueDelayMs.push_back((double)(sim_.now() - f.queuedAt) / 1000.0);
+  } else {
+    st->stats.txFail++;
+  }
+  ts.queue.pop_front();
+  ts.busy = false;
+  ts.cw = cfg_.cwMin;
+  if (!ts.queue.empty()) scheduleAttempt(st, sim_.now());
+}
@@ -0,0 +1,123 @@
+#pragma once
+/*
+  EVE-POWER fleet simulator - mezzo radio ESP-NOW condiviso
+  Modello semplificato di 802.11 DCF a 1 Mbps (rate di default di ESP-NOW):
+  - airtime = preambolo PHY + (overhead MAC/vendor action + payload) * 8us
+  - carrier sense: chi trova il canale occupato rimanda a fine trasmissione + DIFS + backoff
+  - collisione: due trasmissioni che partono a meno di uno slot l'una dall'altra
+    (non si "sentono") si rovinano a vicenda per tutti i ricevitori
+  - unicast: ACK + ritrasmissioni con finestra di contesa che raddoppia
+  - broadcast (HELLO): nessun ACK, nessuna ritrasmissione
+  - perdita casuale per frame e half-duplex (chi trasmette non riceve)
+  - portata (rangeM > 0): riceve solo chi sta entro rangeM metri, con un RSSI che scende col
+    logaritmo della distanza. Carrier sense e collisioni restano per canale (tutti sentono tutti
+    i trasmettitori): niente terminale nascosto, i risultati multi-hop sono pessimisti sul carico.
+  Ogni stazione ha la sua coda TX: un frame alla volta, in ordine.
+*/
+
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <vector>
+#include "sim_core.h"
+
+struct MediumConfig {
+  double lossProb = 0.0;        //probabilità di perdere un frame integro (per ricevitore)
+  uint32_t retryLimit = 7;      //ritrasmissioni unicast oltre al primo tentativo
+  uint32_t slotUs = 20;
+  uint32_t sifsUs = 10;
+  uint32_t difsUs = 50;
+  uint32_t cwMin = 15;
+  uint32_t cwMax = 1023;
+  uint32_t phyOverheadUs = 192; //preambolo lungo + PLCP a 1 Mbps
+  uint32_t macOverheadBytes = 43; //header 802.11 + action/OUI + vendor IE ESP-NOW + FCS
+  uint32_t ackUs = 304;
+  uint32_t txQueueMax = 32;     //frame in coda per stazione oltre i quali esp_now_send fallisce
+  double rangeM = 0.0;          //0 = tutti si sentono (RSSI fisso -50 dBm)
+};
+
+struct AirFrame {
+  uint8_t src[6];
+  uint8_t dst[6];
+  std::vector<uint8_t> data;
+  SimTime queuedAt;
+  uint32_t attempts;
+};
+
+struct StationStats {
+  uint64_t txQueued = 0;     //frame passati a esp_now_send
+  uint64_t txDropped = 0;    //rifiutati: coda piena
+  uint64_t txAttempts = 0;   //trasmissioni in aria (compresi retry)
+  uint64_t txOk = 0;         //unicast con ACK / broadcast trasmessi
+  uint64_t txFail = 0;       //unicast falliti dopo tutti i retry
+  uint64_t txCollisions = 0; //tentativi finiti in collisione
+  uint64_t rxOk = 0;
+  uint64_t rxLost = 0;       //persi per rumore/perdita casuale
+  uint64_t rxCollided = 0;
+  uint64_t rxMissed = 0;     //destinatario su altro canale / radio spenta / stava trasmettendo
+  uint64_t airtimeUs = 0;
+  std::vector<double> queueDelayMs; //da esp_now_send alla fine della trasmissione riuscita
+};
+
+class Station {
+public:
+  virtual ~Station() {}
+  virtual const uint8_t* mac() const = 0;
+  virtual uint8_t channel() const = 0;
+  virtual bool listening() const = 0;
+  virtual void onAirRx(const AirFrame& f, int8_t rssi) = 0;
+
+  StationStats stats;
+  double x = 0.0, y = 0.0; //posizione in metri (conta solo con rangeM > 0)
+};
+
+class Medium {
+public:
+  Medium(Sim& sim, const MediumConfig& cfg) : sim_(sim), cfg_(cfg) {}
+
+  void attach(Station* st);
+  //mette il frame nella coda TX della stazione; false se la coda è piena
+  bool send(Station* st, const uint8_t* dst, const uint8_t* data, size_t len);
+
+  uint32_t airtimeUs(size_t payloadLen) const;
+  //false se b è fuori portata da a; altrimenti l'RSSI con cui b sente a
+  bool link(const Station* a, const Station* b, int8_t& rssi) const;
+  //frazione di tempo in cui il canale è stato occupato (almeno una trasmissione in aria)
+  double utilization(uint8_t ch, SimTime elapsed) const;
+
+private:
+  struct Tx {
+    uint64_t id;
+    Station* from;
+    SimTime start;
+    SimTime end;
+    bool corrupted;
+  };
+  struct TxState {
+    std::deque<AirFrame> queue;
+    bool busy = false;     //c'è un tentativo in corso/programmato
+    uint32_t cw = 0;
+    SimTime txFrom = 0;    //ultima trasmissione in aria [txFrom, txUntil] (half-duplex)
+    SimTime txUntil = 0;
+  };
+  struct Channel {
+    uint64_t busyUs = 0;      //unione degli intervalli occupati: le collisioni non contano due volte
+    SimTime busyUntil = 0;
+    std::vector<Tx> active;
+  };
+
+  void scheduleAttempt(Station* st, SimTime earliest);
+  void attempt(Station* st);
+  void finish(Station* st, uint64_t txId, uint8_t ch);
+  void completeHead(Station* st, bool ok);
+
+  static uint64_t macKey(const uint8_t* mac);
+
+  Sim& sim_;
+  MediumConfig cfg_;
+  uint64_t nextTxId_ = 1;
+  std::vector<Station*> stations_;
+  std::map<uint64_t, Station*> byMac_;
+  std::map<Station*, TxState> tx_;
+  std::map<uint8_t, Channel> channels_;
+};
@@ -0,0 +1,84 @@
+#include "sim_node.h"
+
+#include <string.h>
+
+// ===================== HAL =====================
+uint32_t SimHal::millis() { return owner_.localMillis(); }
+
+//coda TX del Medium piena: come esp_now_send, il firmware vede NO_MEM
+bool SimHal::transmit(const Frame& f) {
+  return medium_.send(&owner_, f.mac, f.data.data(), f.data.size());
+}
+
+// ===================== NODO =====================
+SimNode::SimNode(Sim& sim, Medium& medium, uint32_t index, double driftPpm, uint32_t tickMs)
+  : sim_(sim), medium_(medium), index_(index), driftPpm_(driftPpm), tickMs_(tickMs),
+    hal_(sim, medium, *this), node_(hal_) {
+  //MAC Espressif finto ma stabile: 24:0A:C4:00:hi:lo
+  mac_[0] = 0x24; mac_[1] = 0x0A; mac_[2] = 0xC4; mac_[3] = (uint8_t)(index >> 16);
+  mac_[4] = (uint8_t)(index >> 8); mac_[5] = (uint8_t)index;
+  hal_.setMac(mac_);
+}
+
+uint32_t SimNode::localMillis() const {
+  if (phase_ == OFF) return 0;
+  double us = (double)(sim_.now() - bootAt_) * (1.0 + driftPpm_ * 1e-6);
+  return (uint32_t)(uint64_t)(us / 1000.0);
+}
+
+void SimNode::boot() {
+  bootAt_ = sim_.now();
+  phase_ = SCANNING;
+
+  node_.begin();
+  node_.initEspNowOnChannel(1);
+
+  SimTime stall = simMs(hal_.takeStallMs());
+  int8_t locked = hal_.rtcLockedChannel();
+  if (locked < 1 || locked > 13) {
+    sim_.after(stall, [this]() {
+      node_.scanStart(7000);
+      scanStep();
+    });
+  } else {
+    sim_.after(stall, [this]() { finishBoot(); });
+  }
+}
+
+void SimNode::scanStep() {
+  PowerNode::ScanResult r = node_.scanPoll();
+  if (r == PowerNode::SCAN_RUNNING) {
+    sim_.after(simMs(5), [this]() { scanStep(); });
+    return;
+  }
+  if (r == PowerNode::SCAN_NOT_FOUND) hal_.rtcSetLockedChannel(1);
+  finishBoot();
+}
+
+void SimNode::finishBoot() {
+  //come setup(): esp_now_deinit, delay(30), init sul canale agganciato
+  hal_.radioEnd();
+  sim_.after(simMs(30), [this]() {
+    node_.initEspNowOnChannel((uint8_t)hal_.rtcLockedChannel());
+    phase_ = RUNNING;
+    runningAt_ = sim_.now();
+    tick();
+  });
+}
+
+void SimNode::tick() {
+  //in loopOnce i relè cambiano solo per le regole, e ogni relè cambiato manda un EXECUTED
+  uint8_t before = node_.relayMask();
+  node_.loopOnce();
+  execGenerated_ += (uint32_t)__builtin_popcount((unsigned)(before ^ node_.relayMask()));
+  sim_.after(simMs(tickMs_), [this]() { tick(); });
+}
+
+void SimNode::onAirRx(const AirFrame& f, int8_t rssi) {
+  //ESP-NOW consegna solo i frame per il nostro MAC o broadcast
+  bool forMe = memcmp(f.dst, mac_, 6) == 0;
+  bool bcast = true;
+  for (int i = 0; i < 6; i++) bcast = bcast && f.dst[i] == 0xFF;
+  if (!forMe && !bcast) return;
+  hal_.deliver(f.src, f.data.data(), f.data.size(), rssi);
+}
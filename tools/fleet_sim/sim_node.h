@@ -0,0 +1,87 @@
+#pragma once
+/*
+  EVE-POWER fleet simulator - un nodo POWER simulato
+  Gira il PowerNode VERO (lib/power_core) sopra una PowerHalHost il cui tempo è
+  il tempo simulato deformato dalla deriva del quarzo del nodo, e i cui pacchetti
+  vanno sul Medium invece che in sent().
+  Il boot replica PowerNode::setup() ma a eventi (la scansione canali usa scanPoll ogni 5ms).
+  Con "mesh on" il nodo inoltra per i vicini (PowerNode::enableMesh) e sente l'RSSI del Medium.
+*/
+
+#include <stdint.h>
+#include "power_hal_host.h"
+#include "power_node.h"
+#include "sim_core.h"
+#include "sim_medium.h"
+
+class SimNode;
+
+class SimHal : public PowerHalHost {
+public:
+  SimHal(Sim& sim, Medium& medium, SimNode& owner) : sim_(sim), medium_(medium), owner_(owner) {}
+
+  uint32_t millis() override;
+  //nel simulatore i delay del boot non bloccano: si accumulano e il passo successivo parte dopo
+  void delayMs(uint32_t ms) override { stallMs_ += ms; }
+  //dal generatore del simulatore: stesso seed, stessa run
+  uint32_t randomU32() override { return (uint32_t)sim_.rng()(); }
+
+  uint32_t takeStallMs() { uint32_t s = stallMs_; stallMs_ = 0; return s; }
+
+protected:
+  bool transmit(const Frame& f) override;
+
+private:
+  Sim& sim_;
+  Medium& medium_;
+  SimNode& owner_;
+  uint32_t stallMs_ = 0;
+};
+
+class SimNode : public Station {
+public:
+  enum Phase { OFF, SCANNING, RUNNING };
+
+  SimNode(Sim& sim, Medium& medium, uint32_t index, double driftPpm, uint32_t tickMs);
+
+  void boot();
+
+  const uint8_t* mac() const override { return mac_; }
+  uint8_t channel() const override { return hal_.radioChannel(); }
+  bool listening() const override { return hal_.radioUp(); }
+  void onAirRx(const AirFrame& f, int8_t rssi) override;
+
+  void enableMesh(const PowerMeshConfig& cfg) { node_.enableMesh(cfg); }
+
+  uint32_t index() const { return index_; }
+  double driftPpm() const { return driftPpm_; }
+  Phase phase() const { return phase_; }
+  SimTime bootAt() const { return bootAt_; }
+  SimTime runningAt() const { return runningAt_; }
+  //millis() locale del nodo
+  uint32_t localMillis() const;
+  const PowerNode& node() const { return node_; }
+  //EXECUTED che il nodo ha generato (regole scattate con cambio del relè), arrivati o no
+  uint32_t executedGenerated() const { return execGenerated_; }
+  Medium& medium() { return medium_; }
+
+private:
+  void scanStep();
+  void finishBoot();
+  void tick();
+
+  Sim& sim_;
+  Medium& medium_;
+  uint32_t index_;
+  double driftPpm_;
+  uint32_t tickMs_;
+  uint8_t mac_[6];
+
+  SimHal hal_;
+  PowerNode node_;
+
+  Phase phase_ = OFF;
+  SimTime bootAt_ = 0;
+  SimTime runningAt_ = 0;
+  uint32_t execGenerated_ = 0;
+};
@@ -0,0 +1,197 @@
+#include "sim_script.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+
+static bool parseTime(const std::string& s, SimTime& out) {
+  char* end = nullptr;
+  double v = strtod(s.c_str(), &end);
+  if (end == s.c_str() || v < 0) return false;
+  std::string unit(end);
+  double ms;
+  if (unit.empty() || unit == "ms") ms = v;
+  else if (unit == "s") ms = v * 1000.0;
+  else if (unit == "m") ms = v * 60000.0;
+  else if (unit == "h") ms = v * 3600000.0;
+  else return false;
+  out = (SimTime)(ms * 1000.0);
+  return true;
+}
+
+static bool parseUInt(const std::string& s, uint64_t& out) {
+  if (s.size() > 2 && s[0] == '0' && (s[1] == 'b' || s[1] == 'B')) {
+    char* end = nullptr;
+    out = strtoull(s.c_str() + 2, &end, 2);
+    return *end == 0;
+  }
+  char* end = nullptr;
+  out = strtoull(s.c_str(), &end, 0);
+  return end != s.c_str() && *end == 0;
+}
+
+//"HH:MM" -> minuto del giorno
+static bool parseHHMM(const std::string& s, uint16_t& out) {
+  unsigned h = 0, m = 0;
+  if (sscanf(s.c_str(), "%u:%u", &h, &m) != 2 || h > 23 || m > 59) return false;
+  out = (uint16_t)(h * 60 + m);
+  return true;
+}
+
+static bool parseWeekday(const std::string& s, uint8_t& out) {
+  static const char* names[7] = { "mon","tue","wed","thu","fri","sat","sun" };
+  for (uint8_t i = 0; i < 7; i++) if (s == names[i]) { out = i; return true; }
+  uint64_t v;
+  if (parseUInt(s, v) && v < 7) { out = (uint8_t)v; return true; }
+  return false;
+}
+
+//"1111100" (lun→dom, come il payload MQTT) -> daysMask bit0 = lun
+static bool parseDays(const std::string& s, uint8_t& out) {
+  if (s.size() != 7) return false;
+  out = 0;
+  for (int i = 0; i < 7; i++) {
+    if (s[i] == '1') out |= (1 << i);
+    else if (s[i] != '0') return false;
+  }
+  return true;
+}
+
+bool resolveSelection(const std::string& sel, uint32_t nodes, std::vector<uint32_t>& out) {
+  out.clear();
+  uint64_t a, b;
+  if (sel == "all") {
+    a = 0;
+    b = nodes ? nodes - 1 : 0;
+    if (!nodes) return true;
+  } else {
+    size_t dash = sel.find('-');
+    if (dash == std::string::npos) {
+      if (!parseUInt(sel, a)) return false;
+      b = a;
+    } else if (!parseUInt(sel.substr(0, dash), a) || !parseUInt(sel.substr(dash + 1), b)) {
+      return false;
+    }
+  }
+  if (a > b || b >= nodes) return false;
+  for (uint64_t i = a; i <= b; i++) out.push_back((uint32_t)i);
+  return true;
+}
+
+static bool parseAction(std::istringstream& in, ScriptAction& a) {
+  std::string kind;
+  if (!(in >> kind >> a.sel)) return false;
+
+  if (kind == "boot") {
+    a.kind = ScriptAction::BOOT;
+    std::string kw, t;
+    if (in >> kw) {
+      if (kw != "spread" || !(in >> t) || !parseTime(t, a.spread)) return false;
+    }
+    return true;
+  }
+  if (kind == "time") {
+    a.kind = ScriptAction::TIME;
+    return true;
+  }
+  if (kind == "rules") {
+    a.kind = ScriptAction::RULES;
+    uint64_t ch;
+    std::string s;
+    if (!(in >> s) || !parseUInt(s, ch) || ch > 255) return false;
+    a.ch = (uint8_t)ch;
+    std::string at, state, days;
+    while (in >> at) {
+      RelayRuleBin r;
+      if (!(in >> state >> days)) return false;
+      if (!parseHHMM(at, r.minuteOfDay) || !parseDays(days, r.daysMask)) return false;
+      if (state == "ON") r.on = 1;
+      else if (state == "OFF") r.on = 0;
+      else return false;
+      a.rules.push_back(r);
+    }
+    return a.rules.size() <= MAX_RULES;
+  }
+  if (kind == "cmd") {
+    a.kind = ScriptAction::CMD;
+    std::string s1, s2;
+    uint64_t set, val;
+    if (!(in >> s1 >> s2) || !parseUInt(s1, set) || !parseUInt(s2, val) || set > 0xFF || val > 0xFF) return false;
+    a.maskSet = (uint8_t)set;
+    a.maskVal = (uint8_t)val;
+    return true;
+  }
+  return false;
+}
+
+bool loadScenario(const char* path, Scenario& sc) {
+  std::ifstream f(path);
+  if (!f) {
+    fprintf(stderr, "scenario: non riesco ad aprire %s\n", path);
+    return false;
+  }
+
+  std::string raw;
+  int lineNo = 0;
+  while (std::getline(f, raw)) {
+    lineNo++;
+    size_t hash = raw.find('#');
+    if (hash != std::string::npos) raw.erase(hash);
+
+    std::istringstream in(raw);
+    std::string key;
+    if (!(in >> key)) continue;
+
+    bool ok = true;
+    std::string v, v2;
+    uint64_t u;
+    if (key == "nodes")         ok = (in >> v) && parseUInt(v, u) && u > 0 && u <= 0xFFFFFF && ((sc.nodes = (uint32_t)u), true);
+    else if (key == "seed")     ok = (in >> v) && parseUInt(v, u) && ((sc.seed = u), true);
+    else if (key == "channel")  ok = (in >> v) && parseUInt(v, u) && u >= 1 && u <= 13 && ((sc.channel = (uint8_t)u), true);
+    else if (key == "loss")     ok = (in >> sc.loss) && sc.loss >= 0.0 && sc.loss <= 1.0;
+    else if (key == "drift")    ok = (in >> sc.driftPpm) && sc.driftPpm >= 0.0;
+    else if (key == "retries")  ok = (in >> v) && parseUInt(v, u) && ((sc.retries = (uint32_t)u), true);
+    else if (key == "queue")    ok = (in >> v) && parseUInt(v, u) && u > 0 && ((sc.queue = (uint32_t)u), true);
+    else if (key == "tick")     { SimTime t; ok = (in >> v) && parseTime(v, t) && t >= 1000 && ((sc.tickMs = (uint32_t)(t / 1000)), true); }
+    else if (key == "duration") ok = (in >> v) && parseTime(v, sc.duration);
+    else if (key == "hello")    { SimTime t; ok = (in >> v) && parseTime(v, t) && ((sc.helloMs = (uint32_t)(t / 1000)), true); }
+    else if (key == "clock")    ok = (in >> v >> v2) && parseHHMM(v, sc.clockMinute) && parseWeekday(v2, sc.clockWeekday);
+    else if (key == "range")    ok = (in >> sc.rangeM) && sc.rangeM >= 0.0;
+    else if (key == "layout") {
+      ok = (in >> v >> sc.spacingM) && sc.spacingM > 0.0;
+      if (v == "line") sc.layout = Scenario::LAYOUT_LINE;
+      else if (v == "grid") sc.layout = Scenario::LAYOUT_GRID;
+      else ok = false;
+    }
+    else if (key == "mesh")     ok = (in >> v) && (v == "on" || v == "off") && ((sc.mesh = (v == "on")), true);
+    else if (key == "beacon")   { SimTime t; ok = (in >> v) && parseTime(v, t) && t >= 1000 && ((sc.beaconMs = (uint32_t)(t / 1000)), true); }
+    else if (key == "minrssi")  ok = (in >> sc.minRssi) && sc.minRssi >= -127 && sc.minRssi <= 0;
+    else if (key == "at" || key == "every") {
+      ScriptAction a;
+      a.line = lineNo;
+      a.at = 0;
+      a.every = 0;
+      if (key == "at") {
+        ok = (in >> v) && parseTime(v, a.at);
+      } else {
+        ok = (in >> v) && parseTime(v, a.every) && a.every > 0;
+        std::streampos pos = in.tellg();
+        std::string kw;
+        if (ok && (in >> kw) && kw == "from") ok = (in >> v2) && parseTime(v2, a.at);
+        else { in.clear(); in.seekg(pos); }
+      }
+      ok = ok && parseAction(in, a);
+      if (ok) sc.actions.push_back(a);
+    } else {
+      ok = false;
+    }
+
+    if (!ok) {
+      fprintf(stderr, "%s:%d: riga non valida: %s\n", path, lineNo, raw.c_str());
+      return false;
+    }
+  }
+  return true;
+}
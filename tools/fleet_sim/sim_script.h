@@ -0,0 +1,70 @@
+#pragma once
+/*
+  EVE-POWER fleet simulator - scenario testuale
+  Una direttiva per riga, '#' commento. Tempi: 500ms, 12s, 5m, 1h (numero nudo = ms).
+  Nodi: all | 17 | 0-49
+
+  Parametri:
+    nodes N | seed N | channel C | loss P | drift PPM | retries N | queue N
+    tick T | duration T | clock HH:MM DAY | hello T (0 = spento)
+  Topologia e multi-hop:
+    range M                       portata radio in metri (default 0 = tutti si sentono)
+    layout line|grid SPACING      nodi in fila o a griglia, SPACING metri; il master sta in (0,0)
+    mesh on|off                   inoltro multi-hop sui nodi e sul master
+    beacon T | minrssi DBM        periodo dei BEACON, RSSI minimo per una rotta
+  Azioni del master:
+    at T <azione>                 una volta al tempo T
+    every T [from T0] <azione>    periodica
+  <azione>:
+    boot SEL [spread T]           accende i nodi (distribuiti a caso su spread)
+    time SEL                      TIME dall'orologio del master
+    rules SEL CH [HH:MM ON|OFF 1111111]...   sostituisce le regole del relè CH
+    cmd SEL MASKSET MASKVAL       comando manuale (0x0F, 0b0101, 5 ...)
+*/
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "power_protocol.h"
+#include "sim_core.h"
+
+struct ScriptAction {
+  enum Kind { BOOT, TIME, RULES, CMD };
+
+  Kind kind;
+  SimTime at;
+  SimTime every;               //0 = una volta sola
+  std::string sel;             //selezione nodi, risolta quando si conosce il numero di nodi
+  SimTime spread = 0;          //BOOT
+  uint8_t ch = 0;              //RULES
+  std::vector<RelayRuleBin> rules;
+  uint8_t maskSet = 0, maskVal = 0; //CMD
+  int line = 0;
+};
+
+struct Scenario {
+  uint32_t nodes = 50;
+  uint64_t seed = 1;
+  uint8_t channel = 6;
+  double loss = 0.0;
+  double driftPpm = 20.0;
+  uint32_t retries = 7;
+  uint32_t queue = 32;
+  uint32_t tickMs = 20;
+  SimTime duration = simMs(10ULL * 60ULL * 1000ULL);
+  uint16_t clockMinute = 0;
+  uint8_t clockWeekday = 0;
+  uint32_t helloMs = 100;
+  double rangeM = 0.0;
+  enum Layout { LAYOUT_NONE, LAYOUT_LINE, LAYOUT_GRID } layout = LAYOUT_NONE;
+  double spacingM = 0.0;
+  bool mesh = false;
+  uint32_t beaconMs = 1000;
+  int minRssi = -85;
+  std::vector<ScriptAction> actions;
+};
+
+//false + messaggio su stderr se il file non è valido
+bool loadScenario(const char* path, Scenario& out);
+//"all" | "N" | "A-B" -> indici; false se fuori range
+bool resolveSelection(const std::string& sel, uint32_t nodes, std::vector<uint32_t>& out);
@@ -0,0 +1,213 @@
+/*
+  EVE-POWER loadgen (Linux) - carico MQTT sul bridge e latenza comando -> stato
+  Per ogni relè di ogni nodo: pubblica relay/N/set ON|OFF (alternati) e misura quando
+  arriva relay/N/state con quel valore. Un solo comando in volo per relè; il ritmo
+  complessivo è --rate comandi/s (0 = ad anello chiuso, appena il relè è libero).
+
+  uso: loadgen [--broker HOST:PORTA] [--prefix P] [--mac-base MAC] [--nodes N] [--root R]...
+               [--rate R] [--duration S] [--warmup S] [--timeout-ms MS] [--json]
+    --mac-base/--nodes : root = <prefix>/<MAC12> per i nodi di node_host (MAC base + i)
+    --root R           : radice esplicita (ripetibile), es. progetto/EVE/POWER
+  build: pio run -e loadgen   ->  .pio/build/loadgen/program
+*/
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "mqtt_lite.h"
+#include "power_udp.h"
+
+static uint64_t monoUs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000ull;
+}
+
+//un relè = uno slot con al massimo un comando in volo
+struct Slot {
+  std::string setTopic;
+  std::string stateTopic;
+  bool known = false;   //stato retained ricevuto
+  bool state = false;
+  bool busy = false;
+  bool want = false;
+  bool counted = false; //inviato dentro la finestra di misura
+  uint64_t sentUs = 0;
+};
+
+struct Run {
+  std::vector<Slot> slots;
+  std::vector<double> latMs;
+  uint64_t sent = 0, done = 0, timeouts = 0, skipped = 0;
+  bool measuring = false;
+};
+
+static void onMessage(void* ctx, const std::string& topic, const uint8_t* payload, size_t len) {
+  Run* r = (Run*)ctx;
+  bool on = (len == 2 && !memcmp(payload, "ON", 2));
+  for (auto& s : r->slots) {
+    if (s.stateTopic != topic) continue;
+    s.known = true;
+    s.state = on;
+    if (s.busy && on == s.want) {
+      s.busy = false;
+      if (s.counted) {
+        r->latMs.push_back((double)(monoUs() - s.sentUs) / 1000.0);
+        r->done++;
+      }
+    }
+    return;
+  }
+}
+
+static double percentile(std::vector<double>& v, double p) {
+  if (v.empty()) return 0.0;
+  std::sort(v.begin(), v.end());
+  size_t i = (size_t)(p / 100.0 * (double)(v.size() - 1) + 0.5);
+  return v[std::min(i, v.size() - 1)];
+}
+
+static void usage() {
+  fprintf(stderr, "uso: loadgen [--broker HOST:PORTA] [--prefix P] [--mac-base MAC] [--nodes N] [--root R]...\n"
+                  "             [--rate R] [--duration S] [--warmup S] [--timeout-ms MS] [--json]\n");
+}
+
+int main(int argc, char** argv) {
+  std::string broker = "127.0.0.1:1883";
+  std::string prefix = "progetto/EVE/POWER";
+  uint8_t macBase[6] = {0x24, 0x0A, 0xC4, 0x10, 0x00, 0x00};
+  uint32_t count = 0;
+  std::vector<std::string> roots;
+  double rate = 0;
+  double durationS = 10, warmupS = 1;
+  uint32_t timeoutMs = 2000;
+  bool json = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char* a = argv[i];
+    const char* v = (i + 1 < argc) ? argv[i + 1] : nullptr;
+    if (!strcmp(a, "--broker") && v) { broker = v; i++; }
+    else if (!strcmp(a, "--prefix") && v) { prefix = v; i++; }
+    else if (!strcmp(a, "--mac-base") && v) {
+      if (!parseMac(v, macBase)) { fprintf(stderr, "MAC non valido: %s\n", v); return 2; }
+      i++;
+    }
+    else if (!strcmp(a, "--nodes") && v) { count = (uint32_t)atoi(v); i++; }
+    else if (!strcmp(a, "--root") && v) { roots.push_back(v); i++; }
+    else if (!strcmp(a, "--rate") && v) { rate = atof(v); i++; }
+    else if (!strcmp(a, "--duration") && v) { durationS = atof(v); i++; }
+    else if (!strcmp(a, "--warmup") && v) { warmupS = atof(v); i++; }
+    else if (!strcmp(a, "--timeout-ms") && v) { timeoutMs = (uint32_t)atoi(v); i++; }
+    else if (!strcmp(a, "--json")) json = true;
+    else { usage(); return 2; }
+  }
+
+  //stesse MAC di node_host: base + i sugli ultimi 3 byte
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t lo = ((uint32_t)macBase[3] << 16 | (uint32_t)macBase[4] << 8 | macBase[5]) + i;
+    char m12[13];
+    snprintf(m12, sizeof(m12), "%02X%02X%02X%02X%02X%02X", macBase[0], macBase[1], macBase[2],
+             (lo >> 16) & 0xFF, (lo >> 8) & 0xFF, lo & 0xFF);
+    roots.push_back(prefix + "/" + m12);
+  }
+  if (roots.empty()) { usage(); return 2; }
+
+  size_t colon = broker.rfind(':');
+  if (colon == std::string::npos) { usage(); return 2; }
+  std::string host = broker.substr(0, colon);
+  uint16_t port = (uint16_t)atoi(broker.c_str() + colon + 1);
+
+  Run run;
+  for (auto& r : roots) {
+    for (int ch = 1; ch <= 4; ch++) {
+      Slot s;
+      s.setTopic = r + "/relay/" + std::to_string(ch) + "/set";
+      s.stateTopic = r + "/relay/" + std::to_string(ch) + "/state";
+      run.slots.push_back(s);
+    }
+  }
+
+  MqttLite mqtt;
+  mqtt.onMessage(onMessage, &run);
+  char id[32];
+  snprintf(id, sizeof(id), "eve-power-loadgen-%ld", (long)time(nullptr) % 100000);
+  if (!mqtt.connect(host.c_str(), port, id)) {
+    fprintf(stderr, "MQTT: connessione a %s fallita\n", broker.c_str());
+    return 1;
+  }
+  for (auto& r : roots) mqtt.subscribe((r + "/relay/+/state").c_str());
+
+  uint64_t t0 = monoUs();
+  uint64_t measureFrom = t0 + (uint64_t)(warmupS * 1e6);
+  uint64_t endAt = measureFrom + (uint64_t)(durationS * 1e6);
+  uint64_t periodUs = rate > 0 ? (uint64_t)(1e6 / rate) : 0;
+  uint64_t nextSendUs = t0;
+  size_t rr = 0;
+
+  for (;;) {
+    pollfd p;
+    p.fd = mqtt.fd();
+    p.events = POLLIN;
+    poll(&p, 1, 1);
+
+    uint64_t now = monoUs();
+    if (!mqtt.service(now / 1000)) {
+      fprintf(stderr, "MQTT disconnesso\n");
+      return 1;
+    }
+    if (now >= endAt) break;
+    if (!run.measuring && now >= measureFrom) run.measuring = true;
+
+    //timeout: il relè torna libero, il comando conta come perso
+    for (auto& s : run.slots) {
+      if (s.busy && now - s.sentUs >= (uint64_t)timeoutMs * 1000ull) {
+        s.busy = false;
+        if (s.counted) run.timeouts++;
+      }
+    }
+
+    //invio: a ritmo fisso (--rate) o su ogni slot libero
+    size_t budget = run.slots.size();
+    if (periodUs) {
+      budget = 0;
+      while (nextSendUs <= now) { budget++; nextSendUs += periodUs; }
+    }
+    for (size_t k = 0; k < run.slots.size() && budget; k++) {
+      Slot& s = run.slots[(rr + k) % run.slots.size()];
+      if (s.busy) continue;
+      s.want = !s.state;
+      s.busy = true;
+      s.sentUs = monoUs();
+      s.counted = run.measuring;
+      mqtt.publish(s.setTopic, s.want ? "ON" : "OFF");
+      if (run.measuring) run.sent++;
+      budget--;
+    }
+    if (periodUs && budget && run.measuring) run.skipped += budget; //tutti i relè occupati: il ritmo non regge
+    rr = (rr + 1) % run.slots.size();
+  }
+
+  double secs = durationS > 0 ? durationS : 1;
+  double thr = (double)run.done / secs;
+  double p50 = percentile(run.latMs, 50), p99 = percentile(run.latMs, 99), mx = percentile(run.latMs, 100);
+
+  if (json) {
+    printf("{\"relays\":%zu,\"sent\":%llu,\"completed\":%llu,\"timeouts\":%llu,\"skipped\":%llu,"
+           "\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f,\"throughput_cmd_s\":%.1f}\n",
+           run.slots.size(), (unsigned long long)run.sent, (unsigned long long)run.done,
+           (unsigned long long)run.timeouts, (unsigned long long)run.skipped, p50, p99, mx, thr);
+  } else {
+    printf("relè=%zu  inviati=%llu completati=%llu timeout=%llu saltati=%llu\n", run.slots.size(),
+           (unsigned long long)run.sent, (unsigned long long)run.done, (unsigned long long)run.timeouts,
+           (unsigned long long)run.skipped);
+    printf("comando->stato: p50=%.2f p99=%.2f max=%.2f ms   throughput=%.1f cmd/s\n", p50, p99, mx, thr);
+  }
+  mqtt.disconnect();
+  return 0;
+}
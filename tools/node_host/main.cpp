@@ -0,0 +1,241 @@
+/*
+  EVE-POWER node_host - N nodi POWER veri (lib/power_core) come processo Linux
+  Ogni nodo ha la sua PowerHalHost con tempo reale (steady_clock) e la radio su UDP
+  (lib/power_udp): i frame ESP-NOW vanno al master/bridge, quelli ricevuti passano
+  il filtro canale + MAC come in aria. Ogni secondo il nodo manda un BEACON al master
+  così il bridge impara il suo endpoint.
+
+  uso: node_host --master HOST:PORTA [--nodes N] [--port P] [--mac-base 24:0A:C4:10:00:00] [--verbose]
+                 [--capture FILE [--capture-bytes B]]
+    --port P       : il nodo i ascolta su P+i (0 = porte effimere)
+    --capture FILE : cattura (power_capture.h) del nodo 0, scritta su FILE a Ctrl-C / SIGTERM;
+                     si rigioca con tools/replay
+*/
+
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <memory>
+#include <vector>
+
+#include "power_hal_host.h"
+#include "power_node.h"
+#include "power_udp.h"
+
+static const uint32_t LOOP_MS = 20;    //come il delay(20) di loop() su ESP32
+static const uint32_t SCAN_POLL_MS = 5;
+static const uint32_t BEACON_MS = 1000;
+
+static volatile sig_atomic_t stopRequested = 0;
+static void onSignal(int) { stopRequested = 1; }
+
+static void writeLine(void* ctx, const char* line) { fprintf((FILE*)ctx, "%s\n", line); }
+
+static uint64_t monoMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000ull + (uint64_t)ts.tv_nsec / 1000000ull;
+}
+
+// ===================== HAL UDP =====================
+class UdpHal : public PowerHalHost {
+public:
+  UdpHal(PowerUdpLink& link, const sockaddr_in& master, const uint8_t* mac)
+    : link_(link), master_(master), bootMs_(monoMs()) { memcpy(mac_, mac, 6); setMac(mac); }
+
+  uint32_t millis() override { return (uint32_t)(monoMs() - bootMs_); }
+  //i delay del boot bloccherebbero tutti gli altri nodi: si accumulano e li sconta il runner
+  void delayMs(uint32_t ms) override { stallMs_ += ms; }
+  uint32_t takeStallMs() { uint32_t s = stallMs_; stallMs_ = 0; return s; }
+
+  void beacon() {
+    if (!radioUp()) return;
+    static const uint8_t bcast[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    link_.send(master_, POWER_UDP_BEACON, radioChannel(), mac_, bcast, nullptr, 0);
+  }
+
+protected:
+  bool transmit(const Frame& f) override {
+    return link_.send(master_, POWER_UDP_DATA, radioChannel(), mac_, f.mac, f.data.data(), f.data.size());
+  }
+
+private:
+  PowerUdpLink& link_;
+  sockaddr_in master_;
+  uint8_t mac_[6];
+  uint64_t bootMs_;
+  uint32_t stallMs_ = 0;
+};
+
+// ===================== NODO =====================
+//stesso boot di PowerNode::setup() ma non bloccante (come SimNode del fleet_sim)
+struct HostNode {
+  enum Phase { SCANNING, REINIT, RUNNING };
+
+  PowerUdpLink link;
+  uint8_t mac[6];
+  std::unique_ptr<UdpHal> hal;
+  std::unique_ptr<PowerNode> node;
+  Phase phase = SCANNING;
+  uint64_t nextStepMs = 0;
+  uint64_t nextBeaconMs = 0;
+
+  void boot(uint64_t now) {
+    node->begin();
+    node->initEspNowOnChannel(1);
+    int8_t locked = hal->rtcLockedChannel();
+    if (locked < 1 || locked > 13) {
+      node->scanStart(7000);
+      phase = SCANNING;
+    } else {
+      hal->radioEnd();
+      phase = REINIT;
+    }
+    nextStepMs = now + hal->takeStallMs();
+  }
+
+  void step(uint64_t now) {
+    if (now < nextStepMs) return;
+    switch (phase) {
+      case SCANNING: {
+        PowerNode::ScanResult r = node->scanPoll();
+        if (r == PowerNode::SCAN_RUNNING) { nextStepMs = now + SCAN_POLL_MS; break; }
+        if (r == PowerNode::SCAN_NOT_FOUND) hal->rtcSetLockedChannel(1);
+        hal->radioEnd();
+        phase = REINIT;
+        nextStepMs = now + 30;
+        break;
+      }
+      case REINIT:
+        node->initEspNowOnChannel((uint8_t)hal->rtcLockedChannel());
+        phase = RUNNING;
+        nextStepMs = now;
+        break;
+      case RUNNING:
+        node->loopOnce();
+        nextStepMs = now + LOOP_MS + hal->takeStallMs();
+        break;
+    }
+    if (now >= nextBeaconMs) {
+      hal->beacon();
+      nextBeaconMs = now + BEACON_MS;
+    }
+  }
+
+  void rx() {
+    PowerUdpFrame f;
+    while (link.recv(f)) {
+      if (f.hdr.kind != POWER_UDP_DATA) continue;
+      //in aria: solo il nostro canale, solo per noi o broadcast
+      if (!hal->radioUp() || f.hdr.ch != hal->radioChannel()) continue;
+      if (memcmp(f.hdr.dst, mac, 6) != 0 && !PowerUdpLink::isBroadcast(f.hdr.dst)) continue;
+      hal->deliver(f.hdr.src, f.data, f.hdr.len);
+    }
+  }
+};
+
+static void usage() {
+  fprintf(stderr, "uso: node_host --master HOST:PORTA [--nodes N] [--port P] [--mac-base MAC] [--verbose]\n"
+                  "                 [--capture FILE [--capture-bytes B]]\n");
+}
+
+int main(int argc, char** argv) {
+  const char* master = nullptr;
+  uint32_t count = 1;
+  uint32_t basePort = 0;
+  uint8_t macBase[6] = {0x24, 0x0A, 0xC4, 0x10, 0x00, 0x00};
+  bool verbose = false;
+  const char* capturePath = nullptr;
+  size_t captureBytes = 65536;
+
+  for (int i = 1; i < argc; i++) {
+    const char* a = argv[i];
+    const char* v = (i + 1 < argc) ? argv[i + 1] : nullptr;
+    if (!strcmp(a, "--master") && v) { master = v; i++; }
+    else if (!strcmp(a, "--nodes") && v) { count = (uint32_t)atoi(v); i++; }
+    else if (!strcmp(a, "--port") && v) { basePort = (uint32_t)atoi(v); i++; }
+    else if (!strcmp(a, "--mac-base") && v) {
+      if (!parseMac(v, macBase)) { fprintf(stderr, "MAC non valido: %s\n", v); return 2; }
+      i++;
+    }
+    else if (!strcmp(a, "--verbose")) verbose = true;
+    else if (!strcmp(a, "--capture") && v) { capturePath = v; i++; }
+    else if (!strcmp(a, "--capture-bytes") && v) { captureBytes = (size_t)atoi(v); i++; }
+    else { usage(); return 2; }
+  }
+
+  sockaddr_in masterEp;
+  if (!master || !PowerUdpLink::parseEndpoint(master, masterEp) || count == 0) { usage(); return 2; }
+
+  //ring della cattura: sull'host può essere molto più grande della RTC RAM
+  std::vector<uint32_t> capStore(capturePath ? (captureBytes + 3) / 4 : 1);
+  PowerCapture cap(capStore.data(), capStore.size() * 4);
+  cap.begin(false);
+
+  std::vector<std::unique_ptr<HostNode>> nodes;
+  uint64_t now = monoMs();
+  for (uint32_t i = 0; i < count; i++) {
+    std::unique_ptr<HostNode> n(new HostNode());
+    if (!n->link.open(basePort ? (uint16_t)(basePort + i) : 0)) {
+      fprintf(stderr, "bind UDP fallito (nodo %u)\n", (unsigned)i);
+      return 1;
+    }
+    //MAC = base + i sugli ultimi 3 byte
+    uint32_t lo = ((uint32_t)macBase[3] << 16 | (uint32_t)macBase[4] << 8 | macBase[5]) + i;
+    memcpy(n->mac, macBase, 3);
+    n->mac[3] = (uint8_t)(lo >> 16); n->mac[4] = (uint8_t)(lo >> 8); n->mac[5] = (uint8_t)lo;
+
+    n->hal.reset(new UdpHal(n->link, masterEp, n->mac));
+    n->hal->setVerbose(verbose);
+    n->node.reset(new PowerNode(*n->hal));
+    if (capturePath && i == 0) n->node->attachCapture(&cap);
+    n->boot(now);
+
+    char ms[18];
+    formatMac(n->mac, ms, sizeof(ms));
+    printf("nodo %u: %s  udp:%u\n", (unsigned)i, ms, (unsigned)n->link.localPort());
+    nodes.push_back(std::move(n));
+  }
+  fflush(stdout);
+
+  std::vector<pollfd> pfds(nodes.size());
+  for (size_t i = 0; i < nodes.size(); i++) {
+    pfds[i].fd = nodes[i]->link.fd();
+    pfds[i].events = POLLIN;
+  }
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  while (!stopRequested) {
+    //il passo più vicino decide il timeout
+    now = monoMs();
+    uint64_t next = now + LOOP_MS;
+    for (auto& n : nodes) if (n->nextStepMs < next) next = n->nextStepMs;
+    int timeout = next > now ? (int)(next - now) : 0;
+
+    if (poll(pfds.data(), pfds.size(), timeout) < 0) continue;
+    for (size_t i = 0; i < nodes.size(); i++) {
+      if (pfds[i].revents & POLLIN) nodes[i]->rx();
+    }
+    now = monoMs();
+    for (auto& n : nodes) n->step(now);
+  }
+
+  if (capturePath) {
+    FILE* f = fopen(capturePath, "w");
+    if (!f) {
+      fprintf(stderr, "non riesco a scrivere %s\n", capturePath);
+      return 1;
+    }
+    cap.dump(writeLine, f);
+    fclose(f);
+    fprintf(stderr, "cattura: %lu record (%lu scartati, %lu HELLO contati) -> %s\n",
+            (unsigned long)cap.records(), (unsigned long)cap.dropped(), (unsigned long)cap.folded(), capturePath);
+  }
+  return 0;
+}
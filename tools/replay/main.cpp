@@ -0,0 +1,78 @@
+/*
+  EVE-POWER replay (Linux) - rigioca una cattura ESP-NOW sulla logica vera del nodo
+  Input: il dump "cap dump" del firmware (anche dentro un log seriale completo) o il file
+  scritto da node_host --capture. Tempo virtuale: stesso risultato a ogni esecuzione.
+
+  uso: replay <cattura.txt> [--verbose] [--bench N] [--json]
+    --verbose : log del PowerNode durante il replay
+    --bench N : rigioca N volte e misura il tempo (la cattura come carico di regressione)
+    --json    : una riga JSON invece del riepilogo
+  exit: 0 replay identico alla cattura, 1 divergenza, 2 errore
+  build: pio run -e replay   ->  .pio/build/replay/program
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "power_replay.h"
+
+static void usage() {
+  fprintf(stderr, "uso: replay <cattura.txt> [--verbose] [--bench N] [--json]\n");
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) { usage(); return 2; }
+
+  ReplayOptions opt;
+  uint32_t bench = 0;
+  bool json = false;
+  for (int i = 2; i < argc; i++) {
+    if (!strcmp(argv[i], "--verbose")) opt.verbose = true;
+    else if (!strcmp(argv[i], "--bench") && i + 1 < argc) bench = (uint32_t)strtoul(argv[++i], nullptr, 0);
+    else if (!strcmp(argv[i], "--json")) json = true;
+    else { usage(); return 2; }
+  }
+
+  std::vector<CaptureRecord> recs;
+  std::string err;
+  if (!loadCapture(argv[1], recs, err)) {
+    fprintf(stderr, "replay: %s\n", err.c_str());
+    return 2;
+  }
+
+  ReplayResult r = replayCapture(recs, opt);
+
+  //carico di regressione: stessi record, log spenti, N giri
+  double nsPerRec = 0;
+  if (bench) {
+    ReplayOptions quiet;
+    auto t0 = std::chrono::steady_clock::now();
+    for (uint32_t n = 0; n < bench; n++) replayCapture(recs, quiet);
+    double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+    nsPerRec = ns / ((double)bench * (double)recs.size());
+  }
+
+  if (json) {
+    printf("{\"records\":%zu,\"segments\":%u,\"skipped\":%u,\"rx\":%u,\"tx_expected\":%u,\"tx_produced\":%u,"
+           "\"tx_mismatch\":%u,\"snap_checked\":%u,\"snap_mismatch\":%u,\"tx_ms_skew\":%d,\"ok\":%s",
+           recs.size(), r.segments, r.skipped, r.rx, r.txExpected, r.txProduced, r.txMismatch,
+           r.snapChecked, r.snapMismatch, r.txMsMaxSkew, r.ok() ? "true" : "false");
+    if (bench) printf(",\"bench_iters\":%u,\"ns_per_record\":%.1f", bench, nsPerRec);
+    printf("}\n");
+  } else {
+    printf("cattura: %zu record, %u segmenti (%u record prima del primo SNAP saltati)\n",
+           recs.size(), r.segments, r.skipped);
+    printf("RX consegnati: %u\n", r.rx);
+    printf("TX: attesi %u, prodotti %u, diversi %u (scarto max campo ms: %d)\n",
+           r.txExpected, r.txProduced, r.txMismatch, r.txMsMaxSkew);
+    printf("SNAP verificati: %u, diversi %u\n", r.snapChecked, r.snapMismatch);
+    if (!r.ok()) printf("prima divergenza: %s\n", r.firstDivergence.c_str());
+    printf("%s\n", r.ok() ? "REPLAY OK" : "REPLAY DIVERGE");
+    if (bench) printf("bench: %u giri, %.1f ns/record\n", bench, nsPerRec);
+  }
+  return r.ok() ? 0 : 1;
+}